@@ -1,30 +1,68 @@
 #include "BaseSocket.h"
+#include "connTrace.h"
+#include "sessionRegistry.h"
+#include "reliableChannel.h"
+#include "clock.h"
 #include "log.h"
+#include "flatHashMap.h"
+#include <set>
+#include <fstream>
 
-typedef hash_map<net_handle_t, BaseSocket::ptr> SocketMap;
-SocketMap g_socket_map;
+typedef FlatHashMap<net_handle_t, BaseSocket::ptr> SocketMap;
+
+/// socket表分片数，必须是2的幂
+#define SOCKET_MAP_SHARD_COUNT 64
+
+/**
+ * @brief socket表分片
+ * @details 多个事件循环和扇出线程同时查找、注册、移除socket，按句柄分片加读写锁，
+ *          句柄是连续的小整数，取低位即可均匀分布
+ */
+struct alignas(64) SocketMapShard
+{
+    RWMutex mutex;
+    SocketMap sockets;
+};
+
+static SocketMapShard g_socket_shards[SOCKET_MAP_SHARD_COUNT];
 static Logger::ptr g_logger = LOG_NAME("system");
 
-void addBaseSocket(BaseSocket::ptr pSocket)
+static SocketMapShard &SocketShardOf(net_handle_t fd)
 {
-    g_socket_map.insert(std::make_pair((net_handle_t)pSocket->getSocket(), pSocket));
+    return g_socket_shards[(U32_t)fd & (SOCKET_MAP_SHARD_COUNT - 1)];
 }
 
-void removeBaseSocket(BaseSocket::ptr pSocket)
+void addBaseSocket(BaseSocket::ptr pSocket)
 {
-    g_socket_map.erase((net_handle_t)pSocket->getSocket());
+    net_handle_t fd = (net_handle_t)pSocket->getSocket();
+    SocketMapShard &shard = SocketShardOf(fd);
+    RWMutex::WriteLock lock(shard.mutex);
+    shard.sockets.insert(std::make_pair(fd, std::move(pSocket)));
 }
 
-BaseSocket::ptr findBaseSocket(net_handle_t fd)
+void removeBaseSocket(net_handle_t fd)
 {
-    BaseSocket::ptr pSocket = nullptr;
-    SocketMap::iterator it = g_socket_map.find(fd);
-    if (it != g_socket_map.end())
+    BaseSocket::ptr pSocket;
+    SocketMapShard &shard = SocketShardOf(fd);
     {
-        pSocket = it->second;
+        RWMutex::WriteLock lock(shard.mutex);
+        auto it = shard.sockets.find(fd);
+        if (it == shard.sockets.end())
+        {
+            return;
+        }
+        pSocket.swap(it->second);
+        shard.sockets.erase(it);
     }
+    // 最后一个引用在锁外释放
+}
 
-    return pSocket;
+BaseSocket::ptr findBaseSocket(net_handle_t fd)
+{
+    SocketMapShard &shard = SocketShardOf(fd);
+    RWMutex::ReadLock lock(shard.mutex);
+    auto it = shard.sockets.find(fd);
+    return it != shard.sockets.end() ? it->second : nullptr;
 }
 
 ///------------------------------------------------------------------
@@ -39,6 +77,21 @@ BaseSocket::~BaseSocket()
 {
 }
 
+BaseSocket::ptr BaseSocket::Create()
+{
+    return MakePooled<BaseSocket>();
+}
+
+ObjectPoolStats BaseSocket::GetPoolStats()
+{
+    return GetFixedPool<BaseSocket>().getStats();
+}
+
+void BaseSocket::ReservePool(size_t count)
+{
+    GetFixedPool<BaseSocket>().reserve(count);
+}
+
 void BaseSocket::setSendBufSize(U32_t send_size)
 {
     int ret = setsockopt(m_socket, SOL_SOCKET, SO_SNDBUF, &send_size, 4);
@@ -69,10 +122,14 @@ void BaseSocket::setRecvBufSize(U32_t recv_size)
 
 int BaseSocket::listen(std::string server_ip, U16_t port, Callback_t callback, std::any data)
 {
-    m_local_ip = server_ip;
-    m_local_port = port;
-    m_callback = callback;
-    m_callback_data = data;
+    m_handler = std::make_shared<SocketHandler>();
+    m_handler->callback = callback;
+    m_handler->data = data;
+    // 接受的连接共用回调函数，回调数据由上层按连接单独设置
+    SocketColdState &cold = _cold();
+    cold.local_port = port;
+    cold.child_handler = std::make_shared<SocketHandler>();
+    cold.child_handler->callback = callback;
 
     m_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (m_socket == INVALID_SOCKET)
@@ -85,6 +142,8 @@ int BaseSocket::listen(std::string server_ip, U16_t port, Callback_t callback, s
     _setNonBlock(m_socket);
 
     sockaddr_in serv_addr;
+    _setAddr(server_ip, port, &serv_addr);
+    cold.local_ip = serv_addr.sin_addr.s_addr;
     int ret = ::bind(m_socket, (sockaddr *)&serv_addr, sizeof(serv_addr));
     if (ret == SOCKET_ERROR)
     {
@@ -102,7 +161,7 @@ int BaseSocket::listen(std::string server_ip, U16_t port, Callback_t callback, s
 
     LOG_DEBUG(g_logger) << "BaseSocket::Listening on";
 
-    addBaseSocket(BaseSocket::ptr(this));
+    addBaseSocket(shared_from_this());
     // EventDispatch::getInstance()->addEvent(m_socket, SOCKET_READ | SOCKET_EXCEP);
 
     return NETLIB_OK;
@@ -112,10 +171,10 @@ net_handle_t BaseSocket::connect(std::string server_ip, U16_t port, Callback_t c
 {
     LOG_DEBUG(g_logger) << "BaseSocket::Connect, server_ip:";
 
-    m_remote_ip = server_ip;
     m_remote_port = port;
-    m_callback = callback;
-    m_callback_data = data;
+    m_handler = std::make_shared<SocketHandler>();
+    m_handler->callback = callback;
+    m_handler->data = data;
 
     m_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (m_socket == INVALID_SOCKET)
@@ -129,6 +188,7 @@ net_handle_t BaseSocket::connect(std::string server_ip, U16_t port, Callback_t c
 
     sockaddr_in serv_addr;
     _setAddr(server_ip, port, &serv_addr);
+    m_remote_ip = serv_addr.sin_addr.s_addr;
     int ret = ::connect(m_socket, (sockaddr *)&serv_addr, sizeof(serv_addr));
     if ((ret == SOCKET_ERROR) && (!_isBlock(_getErrorCode())))
     {
@@ -137,7 +197,8 @@ net_handle_t BaseSocket::connect(std::string server_ip, U16_t port, Callback_t c
         return NETLIB_INVALID_HANDLE;
     }
     m_state = SOCKET_State::SOCKET_STATE_CONNECTING;
-    addBaseSocket(BaseSocket::ptr(this));
+    _checkTrace();
+    addBaseSocket(shared_from_this());
     // EventDispatch::getInstance()->addEvent(m_socket, SOCKET_ALL);
 
     return net_handle_t(m_socket);
@@ -161,12 +222,95 @@ int BaseSocket::send(std::string data)
         }
         else
         {
-            LOG_ERROR(g_logger) << "send failed";
+            LOG_ERROR_RATELIMIT(g_logger, 10) << "send failed";
         }
     }
     return ret;
 }
 
+int BaseSocket::send(const BufferSlice &data)
+{
+    if (m_state != SOCKET_State::SOCKET_STATE_CONNECTED)
+        return NETLIB_FAIL;
+
+    // 已有积压时直接排队，保证顺序
+    if (m_cold && !m_cold->out_queue.empty())
+    {
+        if (m_cold->out_bytes + data.size() > SOCKET_MAX_OUT_BYTES)
+        {
+            LOG_ERROR_RATELIMIT(g_logger, 10) << "send queue overflow, handle=" << m_socket
+                                              << " pending=" << m_cold->out_bytes;
+            return NETLIB_FAIL;
+        }
+        m_cold->out_queue.push_back(data);
+        m_cold->out_bytes += data.size();
+        return (int)data.size();
+    }
+
+    int ret = ::send(m_socket, data.data(), data.size(), 0);
+    if (ret == SOCKET_ERROR)
+    {
+        if (!_isBlock(_getErrorCode()))
+        {
+            LOG_ERROR_RATELIMIT(g_logger, 10) << "send failed";
+            return ret;
+        }
+        ret = 0;
+    }
+    if ((size_t)ret < data.size())
+    {
+        SocketColdState &cold = _cold();
+        cold.out_queue.push_back(data.slice(ret, data.size() - ret));
+        cold.out_bytes += data.size() - ret;
+        // EventDispatch::getInstance()->addEvent(m_socket, SOCKET_WRITE);
+    }
+    return (int)data.size();
+}
+
+bool BaseSocket::_flushOutput()
+{
+    if (!m_cold)
+    {
+        return true;
+    }
+    std::deque<BufferSlice> &queue = m_cold->out_queue;
+    while (!queue.empty())
+    {
+        BufferSlice &front = queue.front();
+        int ret = ::send(m_socket, front.data(), front.size(), 0);
+        if (ret == SOCKET_ERROR)
+        {
+            if (_isBlock(_getErrorCode()))
+            {
+                return true;
+            }
+            LOG_ERROR_RATELIMIT(g_logger, 10) << "send failed";
+            return false;
+        }
+        m_cold->out_bytes -= ret;
+        if ((size_t)ret < front.size())
+        {
+            front = front.slice(ret, front.size() - ret);
+            return true;
+        }
+        queue.pop_front();
+    }
+    // EventDispatch::getInstance()->removeEvent(m_socket, SOCKET_WRITE);
+    return true;
+}
+
+BufferSlice BaseSocket::recvSlice()
+{
+    MutableBuffer buf(RECEIVE_BUF_SIZE);
+    int bytesReceived = ::recv(m_socket, buf.data(), buf.capacity(), 0);
+    if (bytesReceived <= 0)
+    {
+        return BufferSlice();
+    }
+    buf.setSize(bytesReceived);
+    return buf.freeze();
+}
+
 // TODO: maybe problem
 std::string BaseSocket::recv()
 {
@@ -185,14 +329,25 @@ std::string BaseSocket::recv()
 
 int BaseSocket::close()
 {
+    // 映射表可能持有最后一个引用，移除后本对象仍要访问m_socket
+    BaseSocket::ptr self = shared_from_this();
     // EventDispatch::getInstance()->removeEvent(m_socket, SOCKET_ALL);
-    removeBaseSocket(BaseSocket::ptr(this));
+    // 句柄会被新连接复用，关闭前必须从会话表中移除；未登录过的连接不在会话表和可靠窗口中，不加全局锁
+    if (getUserId())
+    {
+        SessionMgr::getInstance()->removeHandle((net_handle_t)m_socket);
+        ReliableMgr::getInstance()->onClose((net_handle_t)m_socket);
+    }
+    ConnTraceMgr::getInstance()->onClose((net_handle_t)m_socket);
+    removeBaseSocket((net_handle_t)m_socket);
     closesocket(m_socket);
     return 0;
 }
 
 void BaseSocket::onRead()
 {
+    LogTrace::Scope trace(_checkTrace());
+    m_last_active = Clock::CachedMs();
     if (m_state == SOCKET_State::SOCKET_STATE_LISTENING)
     {
         _acceptNetSocket();
@@ -203,17 +358,19 @@ void BaseSocket::onRead()
         int ret = ioctlsocket(m_socket, FIONREAD, &avail);
         if ((SOCKET_ERROR == ret) || (avail == 0))
         {
-            m_callback(m_callback_data, NETLIB_MSG_CLOSE, (net_handle_t)m_socket, std::any{});
+            _notify(NETLIB_MSG_CLOSE);
         }
         else
         {
-            m_callback(m_callback_data, NETLIB_MSG_READ, (net_handle_t)m_socket, std::any{});
+            _notify(NETLIB_MSG_READ);
         }
     }
 }
 
 void BaseSocket::onWrite()
 {
+    LogTrace::Scope trace(_checkTrace());
+    m_last_active = Clock::CachedMs();
 #if ((defined _WIN32) || (defined __APPLE__))
     // EventDispatch::getInstance()->removeEvent(m_socket, SOCKET_WRITE);
 #endif
@@ -230,24 +387,117 @@ void BaseSocket::onWrite()
 
         if (error)
         {
-            m_callback(m_callback_data, NETLIB_MSG_CLOSE, (net_handle_t)m_socket, std::any{});
+            _notify(NETLIB_MSG_CLOSE);
         }
         else
         {
             m_state = SOCKET_State::SOCKET_STATE_CONNECTED;
-            m_callback(m_callback_data, NETLIB_MSG_CONFIRM, (net_handle_t)m_socket, std::any{});
+            _notify(NETLIB_MSG_CONFIRM);
         }
     }
     else
     {
-        m_callback(m_callback_data, NETLIB_MSG_WRITE, (net_handle_t)m_socket, std::any{});
+        if (!_flushOutput())
+        {
+            _notify(NETLIB_MSG_CLOSE);
+            return;
+        }
+        _notify(NETLIB_MSG_WRITE);
     }
 }
 
 void BaseSocket::onClose()
 {
+    LogTrace::Scope trace(_checkTrace());
     m_state = SOCKET_State::SOCKET_STATE_CLOSING;
-    m_callback(m_callback_data, NETLIB_MSG_CLOSE, (net_handle_t)m_socket, std::any{});
+    _notify(NETLIB_MSG_CLOSE);
+}
+
+void BaseSocket::setCallback(Callback_t callback)
+{
+    _ownHandler().callback = callback;
+}
+
+void BaseSocket::setCallbackData(std::any data)
+{
+    _ownHandler().data = data;
+}
+
+SocketMemoryStats BaseSocket::GetMemoryStats()
+{
+    SocketMemoryStats stats;
+    std::set<const SocketHandler *> handlers;
+    for (auto &shard : g_socket_shards)
+    {
+        RWMutex::ReadLock lock(shard.mutex);
+        for (auto &it : shard.sockets)
+        {
+            const BaseSocket::ptr &pSocket = it.second;
+            if (pSocket->m_cold)
+            {
+                stats.cold_bytes += sizeof(SocketColdState);
+            }
+            // make_shared分配，控制块与对象相邻
+            if (pSocket->m_handler && handlers.insert(pSocket->m_handler.get()).second)
+            {
+                stats.handler_bytes += sizeof(SocketHandler) + 16;
+            }
+        }
+        stats.connections += shard.sockets.size();
+        stats.map_bytes += shard.sockets.memoryUsage();
+    }
+
+    ObjectPoolStats pool = GetPoolStats();
+    stats.object_bytes = pool.in_use * pool.block_size;
+
+    std::ifstream ifs("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    if (ifs >> pages >> resident)
+    {
+        stats.rss_bytes = resident * sysconf(_SC_PAGESIZE);
+    }
+
+    if (stats.connections)
+    {
+        stats.bytes_per_conn = (double)(stats.object_bytes + stats.cold_bytes + stats.handler_bytes + stats.map_bytes) /
+                               stats.connections;
+        stats.rss_per_conn = (double)stats.rss_bytes / stats.connections;
+    }
+    return stats;
+}
+
+void BaseSocket::_notify(U8_t msg)
+{
+    m_handler->callback(m_handler->data, msg, (net_handle_t)m_socket, std::any{});
+}
+
+SocketColdState &BaseSocket::_cold()
+{
+    if (!m_cold)
+    {
+        m_cold.reset(new SocketColdState);
+    }
+    return *m_cold;
+}
+
+SocketHandler &BaseSocket::_ownHandler()
+{
+    if (!m_handler)
+    {
+        m_handler = std::make_shared<SocketHandler>();
+    }
+    else if (m_handler.use_count() > 1)
+    {
+        m_handler = std::make_shared<SocketHandler>(*m_handler);
+    }
+    return *m_handler;
+}
+
+std::string BaseSocket::_ipToString(U32_t ip)
+{
+    char buf[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, &ip, buf, sizeof(buf));
+    return buf;
 }
 
 int BaseSocket::_getErrorCode()
@@ -312,7 +562,7 @@ void BaseSocket::_setAddr(const std::string &ip, const U16_t port, sockaddr_in *
     if (pAddr->sin_addr.s_addr == INADDR_NONE)
     {
         hostent *host = gethostbyname(ip.c_str());
-        if (host = nullptr)
+        if (host == nullptr)
         {
             LOG_ERROR(g_logger) << "ge thost by name failed";
             return;
@@ -327,28 +577,24 @@ void BaseSocket::_acceptNetSocket()
     SOCKET fd = 0;
     sockaddr_in peer_addr;
     socklen_t addr_len = sizeof(sockaddr_in);
-    char ip_str[64];
     while ((fd = accept(m_socket, (sockaddr *)&peer_addr, &addr_len)) != INVALID_SOCKET)
     {
-        BaseSocket::ptr pSocket = std::make_shared<BaseSocket>();
-        U32_t ip = ntohl(peer_addr.sin_addr.s_addr);
-        U16_t port = ntohs(peer_addr.sin_port);
-
-        snprintf(ip_str, sizeof(ip_str), "%d.%d.%d.%d", ip >> 24, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff);
-
-        LOG_DEBUG(g_logger) << "Accept new socket";
+        BaseSocket::ptr pSocket = BaseSocket::Create();
+        LOG_DEBUG_RATELIMIT(g_logger, 100) << "Accept new socket";
 
         pSocket->setSocket(fd);
-        pSocket->setCallback(m_callback);
+        pSocket->m_handler = m_cold ? m_cold->child_handler : m_handler;
         pSocket->setState((int)SOCKET_State::SOCKET_STATE_CONNECTED);
-        pSocket->setRemoteIP(ip_str);
-        pSocket->setRemotePort(port);
+        pSocket->m_remote_ip = peer_addr.sin_addr.s_addr;
+        pSocket->setRemotePort(ntohs(peer_addr.sin_port));
+        pSocket->_checkTrace();
+        pSocket->m_last_active = Clock::CachedMs();
 
         _setNoDelay(fd);
         _setNonBlock(fd);
         addBaseSocket(pSocket);
 
         // EventDispatch::getInstance()->addEvent(fd, SOCKET_READ | SOCKET_EXCEP);
-        m_callback(m_callback_data, NETLIB_MSG_CONNECT, (net_handle_t)fd, std::any{});
+        m_handler->callback(m_handler->data, NETLIB_MSG_CONNECT, (net_handle_t)fd, std::any{});
     }
 }
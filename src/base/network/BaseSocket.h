@@ -1,9 +1,14 @@
 #pragma once
 
 #include "ostype.h"
+#include "objectPool.h"
+#include "bufferPool.h"
+#include "connTrace.h"
+#include <atomic>
 #include <memory>
+#include <deque>
 
-enum class SOCKET_State
+enum class SOCKET_State : U8_t
 {
     SOCKET_STATE_IDLE,
     SOCKET_STATE_LISTENING,
@@ -13,41 +18,137 @@ enum class SOCKET_State
 };
 
 #define RECEIVE_BUF_SIZE 1024
+/// 单个连接输出队列的上限，超过时认为对端消费过慢
+#define SOCKET_MAX_OUT_BYTES (4 * 1024 * 1024)
 
-class BaseSocket
+/**
+ * @brief 连接回调表，监听socket接受的所有连接共享同一份
+ */
+struct SocketHandler
+{
+    typedef std::shared_ptr<SocketHandler> ptr;
+    Callback_t callback;
+    std::any data;
+};
+
+/**
+ * @brief 连接冷数据，只有监听、主动连接以及发送积压的socket需要，按需申请
+ */
+struct SocketColdState
+{
+    U32_t local_ip = 0; // 网络字节序
+    U16_t local_port = 0;
+    SocketHandler::ptr child_handler; // 接受的连接共享的回调表
+    std::deque<BufferSlice> out_queue; // 未发完的数据，与其他连接共享同一个块
+    size_t out_bytes = 0;
+};
+
+/**
+ * @brief 连接内存占用统计
+ */
+struct SocketMemoryStats
+{
+    size_t connections = 0;    // 已注册的连接数
+    size_t object_bytes = 0;   // 对象池中在用槽位(对象+shared_ptr控制块)
+    size_t cold_bytes = 0;     // 冷数据
+    size_t handler_bytes = 0;  // 回调表
+    size_t map_bytes = 0;      // 句柄表(估算)
+    size_t rss_bytes = 0;      // 进程常驻内存
+    double bytes_per_conn = 0; // 以上用户态占用之和 / 连接数
+    double rss_per_conn = 0;   // 常驻内存 / 连接数，包含进程基础开销
+};
+
+class BaseSocket : public std::enable_shared_from_this<BaseSocket>
 {
 public:
     typedef std::shared_ptr<BaseSocket> ptr;
     BaseSocket();
 
+    /**
+     * @brief 从连接对象池创建socket，对象和引用计数共用一个池化槽位
+     * @details listen/connect内部通过shared_from_this注册自身，必须由Create创建的对象调用
+     */
+    static ptr Create();
+
+    /**
+     * @brief 连接对象池统计
+     */
+    static ObjectPoolStats GetPoolStats();
+
+    /**
+     * @brief 预先为count个连接申请对象池槽位
+     */
+    static void ReservePool(size_t count);
+
     virtual ~BaseSocket();
 
     SOCKET getSocket() { return m_socket; }
     void setSocket(SOCKET fd) { m_socket = fd; }
     void setState(U8_t state) { m_state = (SOCKET_State)state; }
 
-    void setCallback(Callback_t callback) { m_callback = callback; }
-    void setCallbackData(std::any data) { m_callback_data = data; }
-    void setRemoteIP(const std::string &ip) { m_remote_ip = ip; }
+    /**
+     * @brief 设置回调，回调表与其他连接共享时先复制一份(写时复制)
+     */
+    void setCallback(Callback_t callback);
+    void setCallbackData(std::any data);
+    void setRemoteIP(const std::string &ip) { m_remote_ip = inet_addr(ip.c_str()); }
     void setRemotePort(U16_t port) { m_remote_port = port; }
     void setSendBufSize(U32_t send_size);
     void setRecvBufSize(U32_t recv_size);
 
-    const std::string getRemoteIP() const { return m_remote_ip; }
+    /**
+     * @brief 连接是否开启调试跟踪，开启后该连接的事件处理期间输出全部级别的日志
+     */
+    bool isTraced() const { return m_trace; }
+
+    /**
+     * @brief 连接登录的用户，未登录为0；登录可能发生在其他线程
+     */
+    U64_t getUserId() const { return m_user_id.load(std::memory_order_relaxed); }
+    void setUserId(U64_t user_id) { m_user_id.store(user_id, std::memory_order_relaxed); }
+
+    /**
+     * @brief 最近一次读写事件的时间(单调时间ms)，用于空闲连接检测
+     */
+    U64_t getLastActive() const { return m_last_active; }
+
+    const std::string getRemoteIP() const { return _ipToString(m_remote_ip); }
     const U16_t getRemotePort() const { return m_remote_port; }
-    const std::string getLocalIP() const { return m_local_ip; }
-    const U16_t getLocalPort() const { return m_local_port; }
+    const std::string getLocalIP() const { return m_cold ? _ipToString(m_cold->local_ip) : std::string(); }
+    const U16_t getLocalPort() const { return m_cold ? m_cold->local_port : 0; }
 
     int listen(std::string server_ip, U16_t port, Callback_t callback, std::any data);
     net_handle_t connect(std::string server_ip, U16_t port, Callback_t callback, std::any data);
     int send(std::string data);
     std::string recv();
+
+    /**
+     * @brief 发送共享缓冲区切片，同一条消息发往多个连接时不复制数据
+     * @details 未能立即发出的部分以切片形式挂到输出队列，可写时继续发送
+     * @return 成功返回data的长度，连接不可用或输出队列超过SOCKET_MAX_OUT_BYTES时返回NETLIB_FAIL
+     */
+    int send(const BufferSlice &data);
+
+    /**
+     * @brief 输出队列中待发送的字节数
+     */
+    size_t getPendingBytes() const { return m_cold ? m_cold->out_bytes : 0; }
+
+    /**
+     * @brief 读取数据到缓冲区池申请的块中，无数据或出错时返回空切片
+     */
+    BufferSlice recvSlice();
     int close();
 
     void onRead();
     void onWrite();
     void onClose();
 
+    /**
+     * @brief 统计已注册连接的内存占用，用于评估单机连接数上限
+     */
+    static SocketMemoryStats GetMemoryStats();
+
 private:
     int _getErrorCode();
     bool _isBlock(int error_code);
@@ -59,16 +160,47 @@ private:
 
     void _acceptNetSocket();
 
+    /**
+     * @brief 尽量发送输出队列中的数据
+     * @return 出错返回false
+     */
+    bool _flushOutput();
+
+    void _notify(U8_t msg);
+
+    /**
+     * @brief 跟踪规则代数变化时重新匹配，只在所属事件循环上调用
+     */
+    bool _checkTrace()
+    {
+        U32_t generation = ConnTraceMgr::getInstance()->getGeneration();
+        if (__builtin_expect(generation != m_trace_gen, 0))
+        {
+            m_trace_gen = generation;
+            m_trace = ConnTraceMgr::getInstance()->match(m_socket, m_remote_ip, getUserId());
+        }
+        return m_trace;
+    }
+    SocketColdState &_cold();
+    SocketHandler &_ownHandler();
+    static std::string _ipToString(U32_t ip);
+
 private:
-    SOCKET m_socket; // sockfd
+    // 热数据，每个连接都有，按大小排列以减少填充
+    U64_t m_last_active = 0; // 最近活跃时间(ms)
+    SOCKET m_socket;         // sockfd
+    U32_t m_remote_ip = 0;   // 网络字节序
+    U16_t m_remote_port = 0;
     SOCKET_State m_state;
+    U8_t m_trace = 0;                 // 调试跟踪标记
+    U32_t m_trace_gen = 0;            // 计算m_trace时的跟踪规则代数
+    std::atomic<U64_t> m_user_id{0}; // 登录的用户
 
-    // bind ip address
-    std::string m_remote_ip;
-    U16_t m_remote_port;
-    std::string m_local_ip;
-    U16_t m_local_port;
+    SocketHandler::ptr m_handler;            // 回调表，可能与同一监听socket的其他连接共享
+    std::unique_ptr<SocketColdState> m_cold; // 冷数据，接受的连接为空
+};
 
-    Callback_t m_callback;
-    std::any m_callback_data;
-};
\ No newline at end of file
+/**
+ * @brief 按句柄查找已注册的socket
+ */
+BaseSocket::ptr findBaseSocket(net_handle_t fd);
@@ -0,0 +1,146 @@
+#include <arpa/inet.h>
+#include "connTrace.h"
+#include "log.h"
+
+static Logger::ptr g_logger = LOG_NAME("system");
+
+void ConnTraceRegistry::addHandle(net_handle_t handle)
+{
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        m_handles.insert(handle);
+        m_empty = false;
+    }
+    refresh();
+}
+
+void ConnTraceRegistry::delHandle(net_handle_t handle)
+{
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        m_handles.erase(handle);
+    }
+    refresh();
+}
+
+bool ConnTraceRegistry::addIP(const std::string &ip)
+{
+    in_addr addr;
+    if (inet_pton(AF_INET, ip.c_str(), &addr) != 1)
+    {
+        LOG_ERROR(g_logger) << "ConnTrace invalid ip: " << ip;
+        return false;
+    }
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        m_ips.insert(addr.s_addr);
+        m_empty = false;
+    }
+    refresh();
+    return true;
+}
+
+bool ConnTraceRegistry::delIP(const std::string &ip)
+{
+    in_addr addr;
+    if (inet_pton(AF_INET, ip.c_str(), &addr) != 1)
+    {
+        return false;
+    }
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        m_ips.erase(addr.s_addr);
+    }
+    refresh();
+    return true;
+}
+
+void ConnTraceRegistry::addUser(uint64_t user_id)
+{
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        m_users.insert(user_id);
+        m_empty = false;
+    }
+    refresh();
+}
+
+void ConnTraceRegistry::delUser(uint64_t user_id)
+{
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        m_users.erase(user_id);
+    }
+    refresh();
+}
+
+void ConnTraceRegistry::clear()
+{
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        m_handles.clear();
+        m_ips.clear();
+        m_users.clear();
+    }
+    refresh();
+}
+
+void ConnTraceRegistry::onLogin(uint64_t user_id)
+{
+    if (isUserTraced(user_id))
+    {
+        m_generation.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void ConnTraceRegistry::onClose(net_handle_t handle)
+{
+    if (empty())
+    {
+        return;
+    }
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        if (!m_handles.erase(handle))
+        {
+            return;
+        }
+    }
+    refresh();
+}
+
+bool ConnTraceRegistry::match(net_handle_t handle, U32_t ip, uint64_t user_id)
+{
+    if (empty())
+    {
+        return false;
+    }
+    RWMutexType::ReadLock lock(m_mutex);
+    return matchLocked(handle, ip, user_id);
+}
+
+bool ConnTraceRegistry::matchLocked(net_handle_t handle, U32_t ip, uint64_t user_id)
+{
+    return m_handles.count(handle) || m_ips.count(ip) || (user_id && m_users.count(user_id));
+}
+
+bool ConnTraceRegistry::isUserTraced(uint64_t user_id)
+{
+    if (empty())
+    {
+        return false;
+    }
+    RWMutexType::ReadLock lock(m_mutex);
+    return m_users.count(user_id) > 0;
+}
+
+void ConnTraceRegistry::refresh()
+{
+    U32_t generation;
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        m_empty = m_handles.empty() && m_ips.empty() && m_users.empty();
+        generation = m_generation.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    LOG_INFO(g_logger) << "ConnTrace rules changed, generation = " << generation;
+}
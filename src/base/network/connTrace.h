@@ -0,0 +1,93 @@
+/**
+ * @file connTrace.h
+ * @brief 按连接/IP/用户动态开启调试日志
+ */
+
+#pragma once
+
+#include <set>
+#include <atomic>
+#include "ostype.h"
+#include "mutex.h"
+#include "singleton.h"
+
+/**
+ * @brief 连接跟踪规则表
+ * @details 规则变化时只递增代数，不遍历连接；连接在自己的事件循环上处理事件时发现代数变化才重新匹配，
+ *          热路径上只比较一次代数。连接的用户id保存在BaseSocket上，登录不修改规则表。
+ *          被跟踪连接的事件处理期间开启LogTrace，所有DEBUG日志都会输出。
+ */
+class ConnTraceRegistry
+{
+public:
+    typedef RWMutex RWMutexType;
+
+    /**
+     * @brief 跟踪指定的连接句柄，连接关闭时规则随之删除
+     */
+    void addHandle(net_handle_t handle);
+    void delHandle(net_handle_t handle);
+
+    /**
+     * @brief 跟踪来自指定IP的连接
+     * @param[in] ip 点分十进制IPv4地址
+     * @return 地址非法返回false
+     */
+    bool addIP(const std::string &ip);
+    bool delIP(const std::string &ip);
+
+    /**
+     * @brief 跟踪指定用户的所有连接
+     */
+    void addUser(uint64_t user_id);
+    void delUser(uint64_t user_id);
+
+    /**
+     * @brief 清除所有规则
+     */
+    void clear();
+
+    /**
+     * @brief 用户登录，用户被跟踪时递增代数，使其连接重新匹配；没有规则时只有一次判断
+     */
+    void onLogin(uint64_t user_id);
+
+    /**
+     * @brief 连接关闭，删除该句柄的规则，句柄被新连接复用后不再跟踪；没有规则时只有一次判断
+     */
+    void onClose(net_handle_t handle);
+
+    /**
+     * @brief 判断连接是否命中规则
+     * @param[in] handle 连接句柄
+     * @param[in] ip 对端地址(网络字节序)
+     * @param[in] user_id 连接已登录的用户，未登录为0
+     */
+    bool match(net_handle_t handle, U32_t ip, uint64_t user_id = 0);
+
+    /**
+     * @brief 规则代数，每次规则变化递增
+     */
+    U32_t getGeneration() const { return m_generation.load(std::memory_order_relaxed); }
+
+    bool isUserTraced(uint64_t user_id);
+
+    /**
+     * @brief 是否没有任何规则，用于accept路径快速跳过
+     */
+    bool empty() const { return m_empty.load(std::memory_order_relaxed); }
+
+private:
+    bool matchLocked(net_handle_t handle, U32_t ip, uint64_t user_id);
+    void refresh();
+
+private:
+    mutable RWMutexType m_mutex;
+    std::atomic<bool> m_empty{true};
+    std::atomic<U32_t> m_generation{1}; // 连接的初始代数为0，第一次事件时匹配
+    std::set<net_handle_t> m_handles;
+    std::set<U32_t> m_ips;
+    std::set<uint64_t> m_users;
+};
+
+typedef Singleton<ConnTraceRegistry> ConnTraceMgr;
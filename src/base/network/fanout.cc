@@ -0,0 +1,209 @@
+#include "fanout.h"
+#include "BaseSocket.h"
+#include "sessionRegistry.h"
+#include "groupIndex.h"
+#include "log.h"
+
+static Logger::ptr g_logger = LOG_NAME("system");
+
+/**
+ * @brief 丢弃队列中未处理的任务
+ */
+static void DropTasks(U32_t loop_id, MpscQueue<FanoutTask *> &queue)
+{
+    FanoutTask *task = nullptr;
+    size_t dropped = 0;
+    while (queue.tryPop(task))
+    {
+        delete task;
+        ++dropped;
+    }
+    if (dropped)
+    {
+        LOG_WARNING(g_logger) << "fanout loop " << loop_id << " dropped " << dropped << " tasks";
+    }
+}
+
+FanoutLoop::~FanoutLoop()
+{
+    DropTasks(m_loop_id, m_queue);
+}
+
+FanoutEngine::FanoutEngine()
+{
+}
+
+FanoutEngine::~FanoutEngine()
+{
+}
+
+FanoutLoop::ptr FanoutEngine::registerLoop(U32_t loop_id)
+{
+    if (loop_id >= FANOUT_MAX_LOOPS)
+    {
+        LOG_ERROR(g_logger) << "fanout loop id " << loop_id << " out of range";
+        return nullptr;
+    }
+    RWMutexType::WriteLock lock(m_mutex);
+    if (!m_loops[loop_id])
+    {
+        m_loops[loop_id] = std::make_shared<FanoutLoop>(loop_id);
+    }
+    return m_loops[loop_id];
+}
+
+void FanoutEngine::unregisterLoop(U32_t loop_id)
+{
+    if (loop_id >= FANOUT_MAX_LOOPS)
+    {
+        return;
+    }
+    FanoutLoop::ptr loop;
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        loop.swap(m_loops[loop_id]);
+    }
+    // 写锁保证之后没有生产者；正在drain()的事件循环持有引用，队列在它释放后才销毁
+}
+
+FanoutLoop::ptr FanoutEngine::getLoop(U32_t loop_id) const
+{
+    if (loop_id >= FANOUT_MAX_LOOPS)
+    {
+        return nullptr;
+    }
+    RWMutexType::ReadLock lock(m_mutex);
+    return m_loops[loop_id];
+}
+
+size_t FanoutEngine::fanout(const BufferSlice &payload, const U64_t *members, size_t count,
+                            net_handle_t exclude_handle)
+{
+    // 按事件循环分组，每个循环一个任务
+    FanoutTask *tasks[FANOUT_MAX_LOOPS] = {nullptr};
+    std::vector<U32_t> touched;
+    std::vector<net_handle_t> local;
+    size_t total = 0;
+    {
+        EpochGuard guard;
+        SessionRegistry *registry = SessionMgr::getInstance();
+        for (size_t i = 0; i < count; ++i)
+        {
+            registry->visit(members[i], [&](const UserSessions &sessions)
+                            {
+                for (auto &dev : sessions.devices)
+                {
+                    if (dev.handle == exclude_handle)
+                    {
+                        continue;
+                    }
+                    ++total;
+                    if (dev.loop_id >= FANOUT_MAX_LOOPS)
+                    {
+                        local.push_back(dev.handle);
+                        continue;
+                    }
+                    FanoutTask *&task = tasks[dev.loop_id];
+                    if (!task)
+                    {
+                        task = new FanoutTask;
+                        task->payload = payload;
+                        touched.push_back(dev.loop_id);
+                    }
+                    task->handles.push_back(dev.handle);
+                } });
+        }
+    }
+
+    size_t queued = 0;
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        for (U32_t loop_id : touched)
+        {
+            FanoutTask *task = tasks[loop_id];
+            FanoutLoop *loop = m_loops[loop_id].get();
+            if (!loop)
+            {
+                local.insert(local.end(), task->handles.begin(), task->handles.end());
+                delete task;
+                continue;
+            }
+            loop->m_queue.push(task);
+            loop->m_waiter.notify();
+            ++queued;
+        }
+    }
+
+    if (!local.empty())
+    {
+        m_inline_sends.add(local.size());
+        deliver(payload, local.data(), local.size());
+    }
+    m_messages.add();
+    m_recipients.add(total);
+    m_tasks.add(queued);
+    return total;
+}
+
+size_t FanoutEngine::fanoutGroup(const BufferSlice &payload, U64_t group_id, net_handle_t exclude_handle)
+{
+    std::vector<U64_t> members;
+    if (!GroupMgr::getInstance()->getOnlineMembers(group_id, members))
+    {
+        return 0;
+    }
+    return fanout(payload, members, exclude_handle);
+}
+
+size_t FanoutEngine::deliver(const BufferSlice &payload, const net_handle_t *handles, size_t count)
+{
+    size_t sent = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        BaseSocket::ptr pSocket = findBaseSocket(handles[i]);
+        if (pSocket && pSocket->send(payload) != NETLIB_FAIL)
+        {
+            ++sent;
+        }
+    }
+    if (sent < count)
+    {
+        m_failures.add(count - sent);
+    }
+    return sent;
+}
+
+size_t FanoutEngine::drain(U32_t loop_id)
+{
+    FanoutLoop::ptr loop = getLoop(loop_id);
+    if (!loop)
+    {
+        return 0;
+    }
+    loop->m_waiter.drain();
+
+    // 每次最多处理一批，剩余的重新唤醒，避免扇出洪峰饿死本循环的socket事件
+    FanoutTask *batch[FANOUT_DRAIN_BATCH];
+    size_t n = loop->m_queue.popBatch(batch, FANOUT_DRAIN_BATCH);
+    for (size_t i = 0; i < n; ++i)
+    {
+        deliver(batch[i]->payload, batch[i]->handles.data(), batch[i]->handles.size());
+        delete batch[i];
+    }
+    if (n == FANOUT_DRAIN_BATCH)
+    {
+        loop->m_waiter.notify();
+    }
+    return n;
+}
+
+FanoutStats FanoutEngine::getStats() const
+{
+    FanoutStats stats;
+    stats.messages = m_messages.read();
+    stats.recipients = m_recipients.read();
+    stats.tasks = m_tasks.read();
+    stats.inline_sends = m_inline_sends.read();
+    stats.failures = m_failures.read();
+    return stats;
+}
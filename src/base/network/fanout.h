@@ -0,0 +1,152 @@
+/**
+ * @file fanout.h
+ * @brief 群消息扇出，按事件循环分批投递共享的消息缓冲区
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include "ostype.h"
+#include "mutex.h"
+#include "bufferPool.h"
+#include "lockFreeQueue.h"
+#include "singleton.h"
+#include "noncopyble.h"
+
+/// 事件循环id的上限
+#define FANOUT_MAX_LOOPS 256
+/// 事件循环每次从队列中取出的任务数
+#define FANOUT_DRAIN_BATCH 64
+
+/**
+ * @brief 投递给一个事件循环的批量任务，同一条消息发往该循环上的一组连接
+ */
+struct FanoutTask
+{
+    BufferSlice payload;
+    std::vector<net_handle_t> handles;
+};
+
+/**
+ * @brief 扇出运行统计
+ */
+struct FanoutStats
+{
+    uint64_t messages = 0;   // 扇出的消息数
+    uint64_t recipients = 0; // 投递的连接数
+    uint64_t tasks = 0;      // 投递给事件循环的批量任务数
+    uint64_t inline_sends = 0; // 没有注册事件循环、在调用线程直接发送的连接数
+    uint64_t failures = 0;   // 连接不存在或发送失败的次数
+};
+
+/**
+ * @brief 事件循环的扇出队列
+ */
+class FanoutLoop : Noncopyble
+{
+public:
+    typedef std::shared_ptr<FanoutLoop> ptr;
+
+    explicit FanoutLoop(U32_t loop_id) : m_loop_id(loop_id) {}
+
+    /**
+     * @brief 丢弃未处理的任务，最后一个引用释放时已没有生产者和消费者
+     */
+    ~FanoutLoop();
+
+    U32_t getLoopId() const { return m_loop_id; }
+
+    /**
+     * @brief 唤醒fd，事件循环注册到自己的epoll中
+     */
+    int getWakeFd() const { return m_waiter.getFd(); }
+
+private:
+    friend class FanoutEngine;
+
+    U32_t m_loop_id;
+    MpscQueue<FanoutTask *> m_queue;
+    EventFdWaiter m_waiter;
+};
+
+/**
+ * @brief 群消息扇出引擎
+ * @details 消息只序列化一次成BufferSlice，在SessionMgr中查出所有在线成员的终端后按所属事件循环分组，
+ *          每个事件循环只投递一个批量任务、只唤醒一次，各连接的输出队列引用同一个块，不复制数据。
+ *          socket只能在所属事件循环线程上访问，事件循环收到唤醒fd可读后调用drain()在本线程发送；
+ *          终端所在的事件循环没有注册时(单线程模式)，在调用线程直接发送。
+ */
+class FanoutEngine : Noncopyble
+{
+public:
+    typedef RWMutex RWMutexType;
+
+    FanoutEngine();
+    ~FanoutEngine();
+
+    /**
+     * @brief 注册事件循环，重复注册返回已有的队列
+     */
+    FanoutLoop::ptr registerLoop(U32_t loop_id);
+
+    /**
+     * @brief 注销事件循环
+     * @details 只从表中摘除，之后的扇出不再投递到该循环；
+     *          事件循环可能正在drain()中消费队列，未处理的任务在最后一个引用释放时由~FanoutLoop()丢弃，
+     *          队列始终只有一个消费者
+     */
+    void unregisterLoop(U32_t loop_id);
+
+    /**
+     * @brief 向一组用户的所有在线终端扇出消息
+     * @param[in] payload 已序列化的消息
+     * @param[in] members 接收者用户id
+     * @param[in] count 接收者数量
+     * @param[in] exclude_handle 不投递的连接，一般是发送者自己的连接
+     * @return 投递的连接数
+     */
+    size_t fanout(const BufferSlice &payload, const U64_t *members, size_t count,
+                  net_handle_t exclude_handle = NETLIB_INVALID_HANDLE);
+
+    size_t fanout(const BufferSlice &payload, const std::vector<U64_t> &members,
+                  net_handle_t exclude_handle = NETLIB_INVALID_HANDLE)
+    {
+        return fanout(payload, members.data(), members.size(), exclude_handle);
+    }
+
+    /**
+     * @brief 向群的在线成员扇出，在线成员由GroupMgr的成员位图与在线位图求交得到
+     */
+    size_t fanoutGroup(const BufferSlice &payload, U64_t group_id,
+                       net_handle_t exclude_handle = NETLIB_INVALID_HANDLE);
+
+    /**
+     * @brief 处理事件循环的扇出任务，只能在该事件循环的线程调用
+     * @return 处理的任务数
+     */
+    size_t drain(U32_t loop_id);
+
+    FanoutStats getStats() const;
+
+private:
+    FanoutLoop::ptr getLoop(U32_t loop_id) const;
+
+    /**
+     * @brief 把消息发往一组连接，返回发送成功的数量
+     */
+    size_t deliver(const BufferSlice &payload, const net_handle_t *handles, size_t count);
+
+private:
+    mutable RWMutexType m_mutex;
+    FanoutLoop::ptr m_loops[FANOUT_MAX_LOOPS];
+
+    PerCpuCounter m_messages;
+    PerCpuCounter m_recipients;
+    PerCpuCounter m_tasks;
+    PerCpuCounter m_inline_sends;
+    PerCpuCounter m_failures;
+};
+
+typedef Singleton<FanoutEngine> FanoutMgr;
@@ -0,0 +1,142 @@
+#include "groupIndex.h"
+#include "sessionRegistry.h"
+
+bool GroupIndex::join(U64_t group_id, U64_t user_id)
+{
+    if (user_id > UINT32_MAX)
+    {
+        return false;
+    }
+    RWMutexType::WriteLock lock(m_mutex);
+    return m_groups[group_id].add((uint32_t)user_id);
+}
+
+bool GroupIndex::leave(U64_t group_id, U64_t user_id)
+{
+    if (user_id > UINT32_MAX)
+    {
+        return false;
+    }
+    RWMutexType::WriteLock lock(m_mutex);
+    auto it = m_groups.find(group_id);
+    if (it == m_groups.end() || !it->second.remove((uint32_t)user_id))
+    {
+        return false;
+    }
+    if (it->second.empty())
+    {
+        m_groups.erase(it);
+    }
+    return true;
+}
+
+bool GroupIndex::isMember(U64_t group_id, U64_t user_id) const
+{
+    if (user_id > UINT32_MAX)
+    {
+        return false;
+    }
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_groups.find(group_id);
+    return it != m_groups.end() && it->second.contains((uint32_t)user_id);
+}
+
+void GroupIndex::removeGroup(U64_t group_id)
+{
+    RWMutexType::WriteLock lock(m_mutex);
+    m_groups.erase(group_id);
+}
+
+size_t GroupIndex::getMemberCount(U64_t group_id) const
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_groups.find(group_id);
+    return it == m_groups.end() ? 0 : it->second.cardinality();
+}
+
+bool GroupIndex::getMembers(U64_t group_id, std::vector<U64_t> &out) const
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_groups.find(group_id);
+    if (it == m_groups.end())
+    {
+        return false;
+    }
+    out.reserve(out.size() + it->second.cardinality());
+    it->second.forEach([&out](uint32_t user_id)
+                       { out.push_back(user_id); });
+    return true;
+}
+
+size_t GroupIndex::getOnlineMembers(U64_t group_id, std::vector<U64_t> &out) const
+{
+    RoaringBitmap online;
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        auto it = m_groups.find(group_id);
+        if (it == m_groups.end())
+        {
+            return 0;
+        }
+        online = SessionMgr::getInstance()->getOnline(it->second);
+    }
+    size_t count = online.cardinality();
+    out.reserve(out.size() + count);
+    online.forEach([&out](uint32_t user_id)
+                   { out.push_back(user_id); });
+    return count;
+}
+
+size_t GroupIndex::getOnlineCount(U64_t group_id) const
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_groups.find(group_id);
+    if (it == m_groups.end())
+    {
+        return 0;
+    }
+    return SessionMgr::getInstance()->countOnline(it->second);
+}
+
+std::string GroupIndex::snapshot(U64_t group_id) const
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_groups.find(group_id);
+    return it == m_groups.end() ? std::string() : it->second.serialize();
+}
+
+bool GroupIndex::restore(U64_t group_id, const std::string &data)
+{
+    RoaringBitmap members;
+    if (!members.deserialize(data))
+    {
+        return false;
+    }
+    RWMutexType::WriteLock lock(m_mutex);
+    if (members.empty())
+    {
+        m_groups.erase(group_id);
+    }
+    else
+    {
+        m_groups[group_id] = std::move(members);
+    }
+    return true;
+}
+
+size_t GroupIndex::getGroupCount() const
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    return m_groups.size();
+}
+
+size_t GroupIndex::memoryUsage() const
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    size_t bytes = m_groups.memoryUsage();
+    for (auto &it : m_groups)
+    {
+        bytes += it.second.memoryUsage();
+    }
+    return bytes;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file groupIndex.h
+ * @brief 群成员索引
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ostype.h"
+#include "mutex.h"
+#include "flatHashMap.h"
+#include "roaringBitmap.h"
+#include "singleton.h"
+#include "noncopyble.h"
+
+/**
+ * @brief 群成员索引
+ * @details 每个群的成员存为一个压缩位图，用户id即稠密下标，只支持不超过32位的用户id。
+ *          加群/退群增量修改位图；扇出时群成员位图与SessionMgr的在线位图求交，
+ *          得到在线成员列表，不需要逐个成员查找会话表。
+ *          快照为RoaringBitmap::serialize()的格式，用于持久化和进程间同步。
+ */
+class GroupIndex : Noncopyble
+{
+public:
+    typedef RWMutex RWMutexType;
+
+    /**
+     * @brief 加群
+     * @return 已是成员或用户id超出32位时返回false
+     */
+    bool join(U64_t group_id, U64_t user_id);
+
+    /**
+     * @brief 退群，最后一个成员退出时删除群
+     */
+    bool leave(U64_t group_id, U64_t user_id);
+
+    bool isMember(U64_t group_id, U64_t user_id) const;
+
+    void removeGroup(U64_t group_id);
+
+    size_t getMemberCount(U64_t group_id) const;
+
+    /**
+     * @brief 群的全部成员，按用户id升序
+     */
+    bool getMembers(U64_t group_id, std::vector<U64_t> &out) const;
+
+    /**
+     * @brief 群的在线成员，按用户id升序
+     * @return 在线成员数
+     */
+    size_t getOnlineMembers(U64_t group_id, std::vector<U64_t> &out) const;
+
+    /**
+     * @brief 群的在线成员数，不生成列表
+     */
+    size_t getOnlineCount(U64_t group_id) const;
+
+    /**
+     * @brief 导出群成员快照，群不存在返回空串
+     */
+    std::string snapshot(U64_t group_id) const;
+
+    /**
+     * @brief 用快照替换群成员
+     */
+    bool restore(U64_t group_id, const std::string &data);
+
+    size_t getGroupCount() const;
+
+    /**
+     * @brief 所有群成员位图占用的内存(字节)
+     */
+    size_t memoryUsage() const;
+
+private:
+    mutable RWMutexType m_mutex;
+    FlatHashMap<U64_t, RoaringBitmap> m_groups;
+};
+
+typedef Singleton<GroupIndex> GroupMgr;
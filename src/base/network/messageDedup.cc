@@ -0,0 +1,205 @@
+#include "messageDedup.h"
+#include "clock.h"
+#include "log.h"
+
+static Logger::ptr g_logger = LOG_NAME("system");
+
+MessageDedup::MessageDedup()
+{
+}
+
+void MessageDedup::setOptions(const DedupOptions &options)
+{
+    // 已有发送者的过滤器大小不变，新配置在其状态释放后生效
+    for (auto &shard : m_shards)
+    {
+        shard.mutex.lock();
+    }
+    m_options = options;
+    if (m_options.exact_entries == 0)
+    {
+        m_options.exact_entries = 1;
+    }
+    for (auto &shard : m_shards)
+    {
+        shard.mutex.unlock();
+    }
+}
+
+U64_t MessageDedup::Hash(U64_t client_msg_id)
+{
+    // splitmix64，客户端id可能是自增的，过滤器需要充分混合的哈希
+    U64_t h = client_msg_id + 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+}
+
+void MessageDedup::Record(SenderState &state, U64_t client_msg_id, U64_t server_msg_id)
+{
+    ExactEntry &entry = state.exact[state.exact_pos];
+    entry.client_msg_id = client_msg_id;
+    entry.server_msg_id = server_msg_id;
+    if (++state.exact_pos == state.exact.size())
+    {
+        state.exact_pos = 0;
+    }
+}
+
+void MessageDedup::initState(SenderState &state, U64_t now_ms) const
+{
+    state.filters[0] = CuckooFilter(m_options.filter_capacity);
+    state.filters[1] = CuckooFilter(m_options.filter_capacity);
+    state.current = 0;
+    state.generation_ms = now_ms;
+    state.active_ms = now_ms;
+    state.exact.assign(m_options.exact_entries, ExactEntry());
+    state.exact_pos = 0;
+}
+
+void MessageDedup::rotate(SenderState &state, U64_t now_ms) const
+{
+    U64_t window_ms = (U64_t)m_options.window_sec * 1000;
+    if (now_ms - state.generation_ms >= 2 * window_ms)
+    {
+        // 当前代最晚的消息也已超出窗口，两代一起丢弃
+        state.filters[0].clear();
+        state.filters[1].clear();
+        state.generation_ms = now_ms;
+        return;
+    }
+    CuckooFilter &current = state.filters[state.current];
+    if (current.isFull() || current.size() >= m_options.filter_capacity ||
+        now_ms - state.generation_ms >= window_ms)
+    {
+        state.current ^= 1;
+        state.filters[state.current].clear();
+        state.generation_ms = now_ms;
+    }
+}
+
+DedupResult MessageDedup::accept(U64_t sender, U64_t client_msg_id, U64_t server_msg_id, U64_t *original)
+{
+    if (!client_msg_id)
+    {
+        return DedupResult::DEDUP_NEW;
+    }
+    U64_t now = Clock::CachedMs();
+    U64_t hash = Hash(client_msg_id);
+    Shard &shard = shardOf(sender);
+    MutexType::Lock lock(shard.mutex);
+    ++shard.checked;
+
+    auto it = shard.senders.find(sender);
+    SenderState *state;
+    if (it == shard.senders.end())
+    {
+        state = &shard.senders[sender];
+        initState(*state, now);
+        shard.memory += state->memoryUsage();
+    }
+    else
+    {
+        state = &it->second;
+        state->active_ms = now;
+        rotate(*state, now);
+        if (state->filters[0].contains(hash) || state->filters[1].contains(hash))
+        {
+            for (const ExactEntry &entry : state->exact)
+            {
+                if (entry.client_msg_id == client_msg_id)
+                {
+                    ++shard.duplicates;
+                    if (original)
+                    {
+                        *original = entry.server_msg_id;
+                    }
+                    return DedupResult::DEDUP_DUPLICATE;
+                }
+            }
+            ++shard.suspects;
+            LOG_DEBUG_RATELIMIT(g_logger, 1) << "dedup suspect sender=" << sender << " client_msg_id=" << client_msg_id;
+            if (!m_options.drop_suspects)
+            {
+                Record(*state, client_msg_id, server_msg_id);
+            }
+            return DedupResult::DEDUP_SUSPECT;
+        }
+    }
+
+    state->filters[state->current].insert(hash);
+    Record(*state, client_msg_id, server_msg_id);
+    return DedupResult::DEDUP_NEW;
+}
+
+bool MessageDedup::forget(U64_t sender, U64_t client_msg_id)
+{
+    if (!client_msg_id)
+    {
+        return false;
+    }
+    U64_t hash = Hash(client_msg_id);
+    Shard &shard = shardOf(sender);
+    MutexType::Lock lock(shard.mutex);
+    auto it = shard.senders.find(sender);
+    if (it == shard.senders.end())
+    {
+        return false;
+    }
+    SenderState &state = it->second;
+    bool found = false;
+    for (ExactEntry &entry : state.exact)
+    {
+        if (entry.client_msg_id == client_msg_id)
+        {
+            entry = ExactEntry();
+            found = true;
+        }
+    }
+    // 只在精确记录中确认过的消息才从过滤器删除，避免误删其他消息的指纹
+    if (found && !state.filters[state.current].remove(hash))
+    {
+        state.filters[state.current ^ 1].remove(hash);
+    }
+    return found;
+}
+
+size_t MessageDedup::expire(U64_t now_ms)
+{
+    U64_t window_ms = (U64_t)m_options.window_sec * 1000;
+    size_t removed = 0;
+    for (auto &shard : m_shards)
+    {
+        MutexType::Lock lock(shard.mutex);
+        auto it = shard.senders.begin();
+        while (it != shard.senders.end())
+        {
+            if (now_ms - it->second.active_ms >= window_ms)
+            {
+                shard.memory -= it->second.memoryUsage();
+                it = shard.senders.erase(it);
+                ++removed;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+    return removed;
+}
+
+DedupStats MessageDedup::getStats() const
+{
+    DedupStats stats;
+    for (auto &shard : m_shards)
+    {
+        MutexType::Lock lock(shard.mutex);
+        stats.checked += shard.checked;
+        stats.duplicates += shard.duplicates;
+        stats.suspects += shard.suspects;
+        stats.senders += shard.senders.size();
+        stats.memory += shard.memory + shard.senders.memoryUsage();
+    }
+    return stats;
+}
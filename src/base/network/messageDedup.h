@@ -0,0 +1,153 @@
+/**
+ * @file messageDedup.h
+ * @brief 按发送者去重客户端重发的消息
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "ostype.h"
+#include "mutex.h"
+#include "cuckooFilter.h"
+#include "flatHashMap.h"
+#include "singleton.h"
+#include "noncopyble.h"
+
+/// 发送者分片数，必须是2的幂
+#define DEDUP_SHARD_COUNT 64
+
+/**
+ * @brief 去重结果
+ */
+enum class DedupResult
+{
+    DEDUP_NEW = 0,   // 新消息，已记录
+    DEDUP_DUPLICATE, // 确认重复，返回第一次分配的服务端消息id
+    DEDUP_SUSPECT,   // 过滤器命中但精确记录中没有：过滤器误判，或重复的是已经淘汰出精确记录的旧消息
+};
+
+/**
+ * @brief 去重配置
+ */
+struct DedupOptions
+{
+    U32_t window_sec = 300;     // 去重时间窗口，客户端重发超过该时间不再识别
+    U32_t filter_capacity = 128; // 每一代过滤器容纳的消息数，窗口内每个发送者最多识别两代
+    U32_t exact_entries = 32;   // 每个发送者精确记录的最近消息数
+    bool drop_suspects = false; // SUSPECT按重复丢弃；默认按新消息放行，宁可重复也不丢消息
+};
+
+/**
+ * @brief 去重运行统计
+ */
+struct DedupStats
+{
+    uint64_t checked = 0;    // 检查的消息数
+    uint64_t duplicates = 0; // 确认重复的消息数
+    uint64_t suspects = 0;   // 过滤器命中但无法确认的消息数
+    uint64_t senders = 0;    // 当前活跃的发送者数
+    uint64_t memory = 0;     // 发送者状态占用的内存
+};
+
+/**
+ * @brief 消息去重
+ * @details 客户端超时后会用同一个客户端消息id重发，消息在写入存储和扇出之前经过accept()去重。
+ *          每个活跃发送者保存两代布谷鸟过滤器和最近exact_entries条消息的精确记录：
+ *          绝大多数消息不是重复的，两代过滤器都不命中即可确定是新消息，不需要查精确记录；
+ *          命中时在精确记录中确认，并返回第一次分配的服务端消息id，客户端收到与首次相同的确认。
+ *          当前代存满或超过一个窗口时轮换，丢弃的旧一代已超出窗口，消息在过滤器中保留一到两个窗口。
+ *          发送者超过一个窗口没有发消息时释放其状态，每个活跃发送者的内存有固定上限。
+ */
+class MessageDedup : Noncopyble
+{
+public:
+    typedef Mutex MutexType;
+
+    MessageDedup();
+
+    void setOptions(const DedupOptions &options);
+
+    /**
+     * @brief 检查并记录消息
+     * @param[in] sender 发送者用户id
+     * @param[in] client_msg_id 客户端消息id
+     * @param[in] server_msg_id 为这条消息分配的服务端消息id，新消息时记录
+     * @param[out] original 重复时第一次分配的服务端消息id
+     */
+    DedupResult accept(U64_t sender, U64_t client_msg_id, U64_t server_msg_id, U64_t *original = nullptr);
+
+    /**
+     * @brief 撤销记录，消息处理失败时调用，客户端重发时不会被当作重复
+     */
+    bool forget(U64_t sender, U64_t client_msg_id);
+
+    /**
+     * @brief 释放超过一个窗口没有活动的发送者
+     * @return 释放的发送者数
+     */
+    size_t expire(U64_t now_ms);
+
+    DedupStats getStats() const;
+
+private:
+    /**
+     * @brief 精确记录
+     */
+    struct ExactEntry
+    {
+        U64_t client_msg_id = 0;
+        U64_t server_msg_id = 0;
+    };
+
+    /**
+     * @brief 发送者的去重状态
+     */
+    struct SenderState
+    {
+        CuckooFilter filters[2]; // 当前代和上一代
+        U8_t current = 0;
+        U64_t generation_ms = 0; // 当前代开始的时间
+        U64_t active_ms = 0;     // 最后一次发消息的时间
+        std::vector<ExactEntry> exact; // 按写入顺序循环覆盖
+        U32_t exact_pos = 0;
+
+        /**
+         * @brief 堆上占用的内存，状态本身计入哈希表
+         */
+        size_t memoryUsage() const
+        {
+            return filters[0].memoryUsage() + filters[1].memoryUsage() + exact.capacity() * sizeof(ExactEntry);
+        }
+    };
+
+    struct alignas(64) Shard
+    {
+        mutable MutexType mutex;
+        FlatHashMap<U64_t, SenderState> senders;
+        size_t memory = 0;
+        // 统计在分片锁内累加，不再额外使用原子操作
+        uint64_t checked = 0;
+        uint64_t duplicates = 0;
+        uint64_t suspects = 0;
+    };
+
+    static U64_t Hash(U64_t client_msg_id);
+
+    static void Record(SenderState &state, U64_t client_msg_id, U64_t server_msg_id);
+
+    Shard &shardOf(U64_t sender) { return m_shards[((sender * 0x9E3779B97F4A7C15ULL) >> 40) & (DEDUP_SHARD_COUNT - 1)]; }
+
+    void initState(SenderState &state, U64_t now_ms) const;
+
+    /**
+     * @brief 当前代存满或过了一个窗口时轮换，只丢弃更旧的一代
+     */
+    void rotate(SenderState &state, U64_t now_ms) const;
+
+private:
+    DedupOptions m_options;
+    Shard m_shards[DEDUP_SHARD_COUNT];
+};
+
+typedef Singleton<MessageDedup> DedupMgr;
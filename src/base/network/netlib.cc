@@ -1,4 +1,5 @@
 #include "netlib.h"
+#include "BaseSocket.h"
 
 NETLIB::ptr NETLIB::getInstance()
 {
@@ -6,4 +7,24 @@ NETLIB::ptr NETLIB::getInstance()
     std::call_once(init_flag, []()
                    { m_netlib = std::make_shared<NETLIB>(); });
     return m_netlib;
-}
\ No newline at end of file
+}
+int NETLIB::netlibSend(net_handle_t handle, const BufferSlice &send_data)
+{
+    BaseSocket::ptr pSocket = findBaseSocket(handle);
+    if (!pSocket)
+    {
+        return NETLIB_FAIL;
+    }
+    return pSocket->send(send_data);
+}
+
+int NETLIB::netlibRecv(net_handle_t handle, BufferSlice &recv_data)
+{
+    BaseSocket::ptr pSocket = findBaseSocket(handle);
+    if (!pSocket)
+    {
+        return NETLIB_FAIL;
+    }
+    recv_data = pSocket->recvSlice();
+    return recv_data.size();
+}
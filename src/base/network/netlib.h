@@ -2,6 +2,7 @@
 
 #include "ostype.h"
 #include "singleton.h"
+#include "bufferPool.h"
 
 enum class NETLIB_OPT
 {
@@ -27,6 +28,12 @@ public:
     net_handle_t netlibConnect(std::string server_ip, U16_t port, Callback_t callback, std::any callback_data);
     int netlibSend(net_handle_t handle, std::string send_data);
     int netlibRecv(net_handle_t handle, std::string recv_data);
+
+    /**
+     * @brief 使用缓冲区池的收发接口，消息路径上不再为每次收发申请std::string
+     */
+    int netlibSend(net_handle_t handle, const BufferSlice &send_data);
+    int netlibRecv(net_handle_t handle, BufferSlice &recv_data);
     int netlibClose(net_handle_t handle);
     int netlibOption(net_handle_t handle);
     int netlibRegisterTimer(Callback_t callback, std::any user_data, U64_t interval);
@@ -0,0 +1,552 @@
+#include <algorithm>
+#include "reliableChannel.h"
+#include "netlib.h"
+#include "clock.h"
+#include "log.h"
+
+static Logger::ptr g_logger = LOG_NAME("system");
+
+static U64_t RoundUpPow2(U64_t n)
+{
+    U64_t size = 1;
+    while (size < n)
+    {
+        size <<= 1;
+    }
+    return size;
+}
+
+static void AddStats(ReliableStats &to, const ReliableStats &from)
+{
+    to.sent += from.sent;
+    to.retransmits += from.retransmits;
+    to.fast_retransmits += from.fast_retransmits;
+    to.acked += from.acked;
+    to.window_full += from.window_full;
+    to.timeouts += from.timeouts;
+    to.resumes += from.resumes;
+}
+
+ReliableChannel::ReliableChannel(U64_t key, U64_t first_seq, const ReliableOptions &options, const TransmitFunc &transmit)
+    : m_key(key),
+      m_options(options),
+      m_transmit(transmit),
+      m_ring(RoundUpPow2(std::max<U32_t>(options.window_size, 1))),
+      m_mask(m_ring.size() - 1),
+      m_base(first_seq ? first_seq : 1),
+      m_next(m_base),
+      m_rto(options.rto_initial_ms)
+{
+}
+
+void ReliableChannel::transmitLocked(U64_t seq, Entry &entry, U64_t now_ms)
+{
+    entry.deadline = now_ms + backoffLocked(entry.retries);
+    if (m_handle != NETLIB_INVALID_HANDLE && m_transmit(m_handle, seq, entry.payload) == NETLIB_FAIL)
+    {
+        // 输出队列溢出或连接已关闭，等待超时重传或重连
+        LOG_DEBUG(g_logger) << "reliable channel " << m_key << " transmit seq " << seq << " failed";
+    }
+}
+
+void ReliableChannel::renew(U64_t now_ms)
+{
+    MutexType::Lock lock(m_mutex);
+    if (m_handle == NETLIB_INVALID_HANDLE && m_detached_ms)
+    {
+        m_detached_ms = std::max<U64_t>(now_ms, 1);
+    }
+}
+
+U64_t ReliableChannel::backoffLocked(U32_t retries) const
+{
+    U64_t rto = (U64_t)m_rto << std::min<U32_t>(retries, 16);
+    return std::min<U64_t>(rto, m_options.rto_max_ms);
+}
+
+void ReliableChannel::sampleRttLocked(U64_t rtt_ms)
+{
+    U32_t rtt = (U32_t)std::min<U64_t>(rtt_ms, m_options.rto_max_ms);
+    if (m_srtt == 0)
+    {
+        m_srtt = std::max<U32_t>(rtt, 1);
+        m_rttvar = rtt / 2;
+    }
+    else
+    {
+        U32_t delta = m_srtt > rtt ? m_srtt - rtt : rtt - m_srtt;
+        m_rttvar = (3 * m_rttvar + delta) / 4;
+        m_srtt = std::max<U32_t>((7 * m_srtt + rtt) / 8, 1);
+    }
+    m_rto = std::min(std::max(m_srtt + std::max<U32_t>(4 * m_rttvar, 1), m_options.rto_min_ms), m_options.rto_max_ms);
+}
+
+void ReliableChannel::ackLocked(Entry &entry, U64_t now_ms, bool sample)
+{
+    // Karn算法：重传过的消息无法区分确认对应哪一次发送，不采样
+    if (sample && entry.retries == 0)
+    {
+        sampleRttLocked(now_ms - entry.sent_ms);
+    }
+    ++m_stats.acked;
+}
+
+void ReliableChannel::releaseLocked(Entry &entry)
+{
+    entry.payload = BufferSlice();
+    entry.sacked = false;
+}
+
+bool ReliableChannel::attach(net_handle_t handle, U64_t client_ack, U64_t now_ms)
+{
+    MutexType::Lock lock(m_mutex);
+    bool complete = client_ack + 1 >= m_base;
+    U64_t ack = std::min(client_ack, m_next - 1);
+    for (; m_base <= ack; ++m_base)
+    {
+        Entry &entry = slot(m_base);
+        if (!entry.sacked)
+        {
+            ackLocked(entry, now_ms, false);
+        }
+        releaseLocked(entry);
+    }
+
+    bool resumed = m_handle != NETLIB_INVALID_HANDLE || m_detached_ms != 0;
+    m_handle = handle;
+    m_detached_ms = 0;
+    m_dead = false;
+    // 网络路径可能已经变化，重新估计RTT
+    m_srtt = 0;
+    m_rttvar = 0;
+    m_rto = m_options.rto_initial_ms;
+    if (resumed)
+    {
+        ++m_stats.resumes;
+    }
+    // 客户端重连后可能丢失了之前的乱序数据，选择确认作废，累计确认之后的全部重传
+    for (U64_t seq = m_base; seq < m_next; ++seq)
+    {
+        Entry &entry = slot(seq);
+        if (entry.sacked)
+        {
+            // 作废的选择确认不计入确认数，累计确认时再计
+            entry.sacked = false;
+            --m_stats.acked;
+        }
+        entry.retries = 0;
+        entry.fast = false;
+        entry.sent_ms = now_ms;
+        transmitLocked(seq, entry, now_ms);
+    }
+    return complete;
+}
+
+void ReliableChannel::detach(U64_t now_ms)
+{
+    MutexType::Lock lock(m_mutex);
+    m_handle = NETLIB_INVALID_HANDLE;
+    m_detached_ms = std::max<U64_t>(now_ms, 1);
+}
+
+U64_t ReliableChannel::send(const BufferSlice &payload, U64_t now_ms)
+{
+    MutexType::Lock lock(m_mutex);
+    if (m_next - m_base > m_mask)
+    {
+        ++m_stats.window_full;
+        return 0;
+    }
+    U64_t seq = m_next++;
+    Entry &entry = slot(seq);
+    entry.payload = payload;
+    entry.sent_ms = now_ms;
+    entry.retries = 0;
+    entry.sacked = false;
+    entry.fast = false;
+    ++m_stats.sent;
+    transmitLocked(seq, entry, now_ms);
+    return seq;
+}
+
+size_t ReliableChannel::onAck(U64_t cum_ack, const SackBlock *blocks, size_t count, U64_t now_ms)
+{
+    MutexType::Lock lock(m_mutex);
+    if (cum_ack >= m_next)
+    {
+        LOG_WARNING_RATELIMIT(g_logger, 1) << "reliable channel " << m_key << " ack " << cum_ack
+                                           << " beyond next seq " << m_next;
+        return 0;
+    }
+    size_t acked = 0;
+    for (; m_base <= cum_ack; ++m_base)
+    {
+        Entry &entry = slot(m_base);
+        if (!entry.sacked)
+        {
+            ackLocked(entry, now_ms, true);
+            ++acked;
+        }
+        releaseLocked(entry);
+    }
+
+    U64_t highest = 0;
+    for (size_t i = 0; i < std::min<size_t>(count, RELIABLE_MAX_SACK_BLOCKS); ++i)
+    {
+        U64_t begin = std::max(blocks[i].begin, m_base);
+        U64_t end = std::min(blocks[i].end, m_next);
+        for (U64_t seq = begin; seq < end; ++seq)
+        {
+            Entry &entry = slot(seq);
+            if (!entry.sacked)
+            {
+                entry.sacked = true;
+                ackLocked(entry, now_ms, true);
+                ++acked;
+            }
+        }
+        if (begin < end)
+        {
+            highest = std::max(highest, end);
+        }
+    }
+
+    // 从最高的选择确认向前数，缺口之后已有足够多条到达时认为缺口上的消息丢失
+    U32_t later = 0;
+    for (U64_t seq = highest; seq > m_base;)
+    {
+        Entry &entry = slot(--seq);
+        if (entry.sacked)
+        {
+            ++later;
+        }
+        else if (later >= RELIABLE_DUP_THRESHOLD && !entry.fast)
+        {
+            entry.fast = true;
+            ++entry.retries;
+            ++m_stats.fast_retransmits;
+            transmitLocked(seq, entry, now_ms);
+        }
+    }
+    // 选择确认过的消息不移动窗口起点，客户端累计确认之前仍可能因重连需要重发
+    return acked;
+}
+
+U64_t ReliableChannel::onTimer(U64_t now_ms)
+{
+    MutexType::Lock lock(m_mutex);
+    if (m_handle == NETLIB_INVALID_HANDLE)
+    {
+        return m_detached_ms ? m_detached_ms + m_options.resume_timeout_ms : 0;
+    }
+    U64_t next = 0;
+    for (U64_t seq = m_base; seq < m_next; ++seq)
+    {
+        Entry &entry = slot(seq);
+        if (entry.sacked)
+        {
+            continue;
+        }
+        if (entry.deadline <= now_ms)
+        {
+            if (entry.retries >= m_options.max_retries)
+            {
+                LOG_WARNING(g_logger) << "reliable channel " << m_key << " seq " << seq << " unacked after "
+                                      << entry.retries << " retries, handle " << m_handle;
+                m_dead = true;
+                ++m_stats.timeouts;
+                return 0;
+            }
+            ++entry.retries;
+            ++m_stats.retransmits;
+            transmitLocked(seq, entry, now_ms);
+        }
+        next = next ? std::min(next, entry.deadline) : entry.deadline;
+    }
+    return next;
+}
+
+net_handle_t ReliableChannel::getHandle() const
+{
+    MutexType::Lock lock(m_mutex);
+    return m_handle;
+}
+
+bool ReliableChannel::isExpired(U64_t now_ms) const
+{
+    MutexType::Lock lock(m_mutex);
+    return m_handle == NETLIB_INVALID_HANDLE && m_detached_ms &&
+           now_ms >= m_detached_ms + m_options.resume_timeout_ms;
+}
+
+bool ReliableChannel::isDead() const
+{
+    MutexType::Lock lock(m_mutex);
+    return m_dead;
+}
+
+size_t ReliableChannel::getInflight() const
+{
+    MutexType::Lock lock(m_mutex);
+    return m_next - m_base;
+}
+
+U64_t ReliableChannel::getNextSeq() const
+{
+    MutexType::Lock lock(m_mutex);
+    return m_next;
+}
+
+U32_t ReliableChannel::getRto() const
+{
+    MutexType::Lock lock(m_mutex);
+    return m_rto;
+}
+
+ReliableStats ReliableChannel::getStats() const
+{
+    MutexType::Lock lock(m_mutex);
+    return m_stats;
+}
+
+///------------------------------------------------------------------
+
+ReliableChannelMgr::ReliableChannelMgr()
+{
+    m_transmit = [](net_handle_t handle, U64_t, const BufferSlice &payload)
+    {
+        return NETLIB::getInstance()->netlibSend(handle, payload);
+    };
+}
+
+void ReliableChannelMgr::setOptions(const ReliableOptions &options)
+{
+    RWMutexType::WriteLock lock(m_mutex);
+    m_options = options;
+}
+
+void ReliableChannelMgr::setTransmit(const ReliableChannel::TransmitFunc &transmit)
+{
+    RWMutexType::WriteLock lock(m_mutex);
+    m_transmit = transmit;
+}
+
+void ReliableChannelMgr::setDeadCallback(const DeadCallback &cb)
+{
+    RWMutexType::WriteLock lock(m_mutex);
+    m_dead_cb = cb;
+}
+
+ReliableChannel::ptr ReliableChannelMgr::open(U64_t key, net_handle_t handle, U64_t client_ack, bool *complete)
+{
+    ReliableChannel::ptr channel;
+    bool discarded = false;
+    U64_t now = Clock::CachedMs();
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        ReliableChannel::ptr &slot = m_channels[key];
+        if (slot)
+        {
+            // 解锁到attach()之间定时器可能认为窗口过期，先推迟过期时间
+            slot->renew(now);
+        }
+        else
+        {
+            U64_t first_seq = client_ack + 1;
+            auto tit = m_tombstones.find(key);
+            if (tit != m_tombstones.end())
+            {
+                // 之前的窗口已过期释放，从释放时的序号继续编号，不复用已经分配过的序号
+                first_seq = std::max(first_seq, tit->second.next_seq);
+                m_tombstones.erase(tit);
+                discarded = true;
+            }
+            slot = std::make_shared<ReliableChannel>(key, first_seq, m_options, m_transmit);
+        }
+        channel = slot;
+        net_handle_t old = channel->getHandle();
+        if (old != NETLIB_INVALID_HANDLE && old != handle)
+        {
+            m_handles.erase(old);
+        }
+        m_handles[handle] = key;
+    }
+    bool ok = channel->attach(handle, client_ack, now);
+    if (complete)
+    {
+        *complete = ok && !discarded;
+    }
+    schedule(channel, channel->onTimer(now));
+    return channel;
+}
+
+ReliableChannel::ptr ReliableChannelMgr::get(U64_t key) const
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_channels.find(key);
+    return it == m_channels.end() ? nullptr : it->second;
+}
+
+U64_t ReliableChannelMgr::send(U64_t key, const BufferSlice &payload)
+{
+    ReliableChannel::ptr channel = get(key);
+    if (!channel)
+    {
+        return 0;
+    }
+    U64_t now = Clock::CachedMs();
+    U64_t seq = channel->send(payload, now);
+    if (seq)
+    {
+        schedule(channel, now + channel->getRto());
+    }
+    return seq;
+}
+
+size_t ReliableChannelMgr::onAck(U64_t key, U64_t cum_ack, const SackBlock *blocks, size_t count)
+{
+    ReliableChannel::ptr channel = get(key);
+    return channel ? channel->onAck(cum_ack, blocks, count, Clock::CachedMs()) : 0;
+}
+
+void ReliableChannelMgr::onClose(net_handle_t handle)
+{
+    ReliableChannel::ptr channel;
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        auto it = m_handles.find(handle);
+        if (it == m_handles.end())
+        {
+            return;
+        }
+        auto ch = m_channels.find(it->second);
+        m_handles.erase(it);
+        if (ch == m_channels.end() || ch->second->getHandle() != handle)
+        {
+            return;
+        }
+        channel = ch->second;
+    }
+    U64_t now = Clock::CachedMs();
+    channel->detach(now);
+    schedule(channel, channel->onTimer(now));
+}
+
+void ReliableChannelMgr::schedule(const ReliableChannel::ptr &channel, U64_t deadline)
+{
+    if (!deadline)
+    {
+        return;
+    }
+    MutexType::Lock lock(m_timer_mutex);
+    // 已有更早的定时时不再入堆，到期处理时会按窗口的实际超时重新安排
+    if (channel->m_scheduled && channel->m_scheduled <= deadline)
+    {
+        return;
+    }
+    channel->m_scheduled = deadline;
+    m_timers.push(TimerItem(deadline, channel->getKey()));
+}
+
+void ReliableChannelMgr::remove(const ReliableChannel::ptr &channel, U64_t now_ms)
+{
+    U64_t key = channel->getKey();
+    RWMutexType::WriteLock lock(m_mutex);
+    auto it = m_channels.find(key);
+    // 定时器取出窗口后open()可能已经重新绑定
+    if (it == m_channels.end() || it->second != channel || !channel->isExpired(now_ms))
+    {
+        return;
+    }
+    AddStats(m_closed_stats, channel->getStats());
+    m_channels.erase(it);
+
+    while (!m_tombstone_order.empty() && m_tombstone_order.front().first <= now_ms)
+    {
+        auto tit = m_tombstones.find(m_tombstone_order.front().second);
+        // 同一会话的墓碑被更新过时以最新的过期时间为准
+        if (tit != m_tombstones.end() && tit->second.expire_ms == m_tombstone_order.front().first)
+        {
+            m_tombstones.erase(tit);
+        }
+        m_tombstone_order.pop_front();
+    }
+    Tombstone &tomb = m_tombstones[key];
+    tomb.next_seq = channel->getNextSeq();
+    tomb.expire_ms = now_ms + m_options.tombstone_ttl_ms;
+    m_tombstone_order.push_back(std::make_pair(tomb.expire_ms, key));
+}
+
+size_t ReliableChannelMgr::onTimer(U64_t now_ms)
+{
+    size_t processed = 0;
+    while (true)
+    {
+        ReliableChannel::ptr channel;
+        {
+            MutexType::Lock lock(m_timer_mutex);
+            if (m_timers.empty() || m_timers.top().first > now_ms)
+            {
+                break;
+            }
+            TimerItem item = m_timers.top();
+            m_timers.pop();
+            channel = get(item.second);
+            if (!channel || channel->m_scheduled != item.first)
+            {
+                continue;
+            }
+            channel->m_scheduled = 0;
+        }
+        ++processed;
+        if (channel->isExpired(now_ms))
+        {
+            remove(channel, now_ms);
+            continue;
+        }
+        U64_t next = channel->onTimer(now_ms);
+        if (channel->isDead())
+        {
+            DeadCallback cb;
+            {
+                RWMutexType::ReadLock lock(m_mutex);
+                cb = m_dead_cb;
+            }
+            net_handle_t handle = channel->getHandle();
+            if (cb)
+            {
+                cb(channel->getKey(), handle);
+            }
+            // 上层关闭连接前先停止重传，窗口保留等待重连
+            onClose(handle);
+            continue;
+        }
+        schedule(channel, next);
+    }
+    return processed;
+}
+
+size_t ReliableChannelMgr::getChannelCount() const
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    return m_channels.size();
+}
+
+ReliableStats ReliableChannelMgr::getStats() const
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    ReliableStats stats = m_closed_stats;
+    for (auto &it : m_channels)
+    {
+        AddStats(stats, it.second->getStats());
+    }
+    return stats;
+}
+
+void ReliableChannelMgr::TimerCallback(const std::any &, U8_t msg, U32_t, const std::any &)
+{
+    if (msg == NETLIB_MSG_TIMER)
+    {
+        ReliableMgr::getInstance()->onTimer(Clock::CachedMs());
+    }
+}
@@ -0,0 +1,305 @@
+/**
+ * @file reliableChannel.h
+ * @brief 服务端到客户端的可靠投递，按会话编号、确认和超时重传
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <queue>
+#include <vector>
+#include "ostype.h"
+#include "mutex.h"
+#include "bufferPool.h"
+#include "flatHashMap.h"
+#include "singleton.h"
+#include "noncopyble.h"
+
+/// 一次确认最多携带的选择确认块数
+#define RELIABLE_MAX_SACK_BLOCKS 8
+/// 之后有这么多条已被选择确认时，立即重传缺口上的消息
+#define RELIABLE_DUP_THRESHOLD 3
+
+/**
+ * @brief 可靠投递配置
+ */
+struct ReliableOptions
+{
+    U32_t window_size = 256;                // 未确认消息上限，向上取整为2的幂
+    U32_t rto_initial_ms = 1000;            // 没有RTT样本时的重传超时
+    U32_t rto_min_ms = 200;                 // 重传超时下限
+    U32_t rto_max_ms = 16000;               // 退避后的重传超时上限
+    U32_t max_retries = 8;                  // 单条消息重传次数上限，超过后认为连接失效
+    U32_t resume_timeout_ms = 5 * 60 * 1000; // 断线后保留窗口等待重连的时间
+    U64_t tombstone_ttl_ms = 24 * 3600 * 1000; // 窗口释放后保留其下一个序号的时间，之后重连从client_ack + 1编号
+};
+
+/**
+ * @brief 选择确认块，客户端已收到[begin, end)
+ */
+struct SackBlock
+{
+    U64_t begin;
+    U64_t end;
+};
+
+/**
+ * @brief 可靠投递运行统计
+ */
+struct ReliableStats
+{
+    uint64_t sent = 0;             // 首次发送的消息数
+    uint64_t retransmits = 0;      // 超时重传次数
+    uint64_t fast_retransmits = 0; // 选择确认触发的快速重传次数
+    uint64_t acked = 0;            // 被确认的消息数
+    uint64_t window_full = 0;      // 窗口满拒绝发送的次数
+    uint64_t timeouts = 0;         // 重传次数用完判定连接失效的次数
+    uint64_t resumes = 0;          // 重连后恢复窗口的次数
+};
+
+/**
+ * @brief 一个会话的发送窗口
+ * @details 每条下行消息分配会话内递增的序号，未确认的消息按序号保存在环形数组中，窗口满时拒绝发送。
+ *          客户端回复累计确认(该序号及之前全部收到)和若干选择确认块，累计确认的消息立即释放；
+ *          选择确认只停止重传，内容保留到被累计确认，客户端重连后丢失了乱序数据时仍可重发。
+ *          每条消息按RTO超时重传，重传后超时时间指数退避；RTT按RFC 6298估计，重传过的消息不采样。
+ *          某条消息之后已有RELIABLE_DUP_THRESHOLD条被选择确认时不等超时，立即重传一次。
+ *          断线后窗口保留，重连时按客户端的最后确认恢复，只重传其后的消息。
+ *          所有接口内部加锁，连接迁移到其他事件循环后仍可安全访问。
+ */
+class ReliableChannel : Noncopyble
+{
+public:
+    typedef std::shared_ptr<ReliableChannel> ptr;
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 发送一条消息，负责把序号编码进消息头，返回NETLIB_FAIL表示发送失败
+     */
+    typedef std::function<int(net_handle_t handle, U64_t seq, const BufferSlice &payload)> TransmitFunc;
+
+    /**
+     * @param[in] key 会话标识
+     * @param[in] first_seq 第一条消息的序号
+     */
+    ReliableChannel(U64_t key, U64_t first_seq, const ReliableOptions &options, const TransmitFunc &transmit);
+
+    U64_t getKey() const { return m_key; }
+
+    /**
+     * @brief 绑定连接，重连时按客户端的最后确认恢复
+     * @param[in] client_ack 客户端已收到的最大连续序号
+     * @return 客户端缺少的消息已经被确认释放、窗口无法补齐时返回false，需要从消息存储同步
+     */
+    bool attach(net_handle_t handle, U64_t client_ack, U64_t now_ms);
+
+    /**
+     * @brief 连接断开，窗口保留等待重连
+     */
+    void detach(U64_t now_ms);
+
+    /**
+     * @brief 发送一条消息
+     * @return 消息序号，窗口满返回0
+     */
+    U64_t send(const BufferSlice &payload, U64_t now_ms);
+
+    /**
+     * @brief 处理客户端确认
+     * @param[in] cum_ack 累计确认
+     * @param[in] blocks 选择确认块，可以为空
+     * @return 新确认的消息数
+     */
+    size_t onAck(U64_t cum_ack, const SackBlock *blocks, size_t count, U64_t now_ms);
+
+    /**
+     * @brief 重传超时的消息
+     * @return 下一次需要处理的时间，0表示没有
+     */
+    U64_t onTimer(U64_t now_ms);
+
+    net_handle_t getHandle() const;
+    bool isAttached() const { return getHandle() != NETLIB_INVALID_HANDLE; }
+
+    /**
+     * @brief 断线超过resume_timeout_ms，可以释放
+     */
+    bool isExpired(U64_t now_ms) const;
+
+    /**
+     * @brief 重传次数用完，连接应当关闭
+     */
+    bool isDead() const;
+
+    size_t getInflight() const;
+    U64_t getNextSeq() const;
+    U32_t getRto() const;
+    ReliableStats getStats() const;
+
+private:
+    /**
+     * @brief 未确认的消息
+     */
+    struct Entry
+    {
+        BufferSlice payload;
+        U64_t sent_ms = 0;   // 首次发送时间
+        U64_t deadline = 0;  // 下一次超时时间
+        U32_t retries = 0;   // 重传次数
+        bool sacked = false; // 已被选择确认
+        bool fast = false;   // 已快速重传过
+    };
+
+    Entry &slot(U64_t seq) { return m_ring[seq & m_mask]; }
+
+    void transmitLocked(U64_t seq, Entry &entry, U64_t now_ms);
+
+    /**
+     * @brief 消息首次被确认(累计或选择)，未被重传过时用于RTT采样
+     */
+    void ackLocked(Entry &entry, U64_t now_ms, bool sample);
+
+    /**
+     * @brief 累计确认后释放消息内容
+     */
+    void releaseLocked(Entry &entry);
+
+    void sampleRttLocked(U64_t rtt_ms);
+
+    U64_t backoffLocked(U32_t retries) const;
+
+    /**
+     * @brief 断线中的窗口重新计算过期时间，open()在管理器锁内调用，避免attach()之前被定时器释放
+     */
+    void renew(U64_t now_ms);
+
+private:
+    friend class ReliableChannelMgr;
+
+    const U64_t m_key;
+    const ReliableOptions m_options;
+    TransmitFunc m_transmit;
+
+    mutable MutexType m_mutex;
+    std::vector<Entry> m_ring;
+    U64_t m_mask;
+    U64_t m_base; // 最小的未确认序号
+    U64_t m_next; // 下一个分配的序号
+    net_handle_t m_handle = NETLIB_INVALID_HANDLE;
+    U64_t m_detached_ms = 0;
+    bool m_dead = false;
+
+    // RTT估计，单位ms
+    U32_t m_srtt = 0;
+    U32_t m_rttvar = 0;
+    U32_t m_rto;
+
+    ReliableStats m_stats;
+
+    U64_t m_scheduled = 0; // 定时堆中的时间，由ReliableChannelMgr的定时锁保护
+};
+
+/**
+ * @brief 可靠投递管理，按会话标识保存窗口，统一驱动重传定时
+ * @details 窗口的下一次超时时间放入最小堆，定时回调只处理到期的窗口；时间变化后旧的堆节点惰性丢弃。
+ *          TimerCallback()的签名与Callback_t一致，注册为NETLIB定时器后每次触发处理一轮重传。
+ */
+class ReliableChannelMgr : Noncopyble
+{
+public:
+    typedef RWMutex RWMutexType;
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 连接失效回调，由上层关闭连接
+     */
+    typedef std::function<void(U64_t key, net_handle_t handle)> DeadCallback;
+
+    ReliableChannelMgr();
+
+    /**
+     * @brief 设置配置和发送函数，只对之后打开的窗口生效
+     * @details 没有设置发送函数时直接发送消息内容，序号需要由调用方事先编码
+     */
+    void setOptions(const ReliableOptions &options);
+    void setTransmit(const ReliableChannel::TransmitFunc &transmit);
+    void setDeadCallback(const DeadCallback &cb);
+
+    /**
+     * @brief 会话登录，已有窗口时按客户端确认恢复，否则从client_ack + 1开始编号
+     * @details 在SessionRegistry::login()成功之后调用，未登录的连接关闭时不通知onClose()。
+     *          窗口在tombstone_ttl_ms内曾经过期释放时从释放时的下一个序号继续编号，complete为false
+     * @param[out] complete 窗口能否补齐客户端缺少的消息，为false时需要从消息存储同步
+     */
+    ReliableChannel::ptr open(U64_t key, net_handle_t handle, U64_t client_ack, bool *complete = nullptr);
+
+    ReliableChannel::ptr get(U64_t key) const;
+
+    /**
+     * @brief 在会话上发送一条消息
+     * @return 消息序号，会话不存在或窗口满返回0
+     */
+    U64_t send(U64_t key, const BufferSlice &payload);
+
+    /**
+     * @brief 处理客户端确认
+     */
+    size_t onAck(U64_t key, U64_t cum_ack, const SackBlock *blocks = nullptr, size_t count = 0);
+
+    /**
+     * @brief 连接关闭，窗口保留resume_timeout_ms
+     */
+    void onClose(net_handle_t handle);
+
+    /**
+     * @brief 处理到期的窗口，释放断线超时的窗口
+     * @return 处理的窗口数
+     */
+    size_t onTimer(U64_t now_ms);
+
+    size_t getChannelCount() const;
+
+    ReliableStats getStats() const;
+
+    /**
+     * @brief NETLIB定时器回调
+     */
+    static void TimerCallback(const std::any &callback_data, U8_t msg, U32_t handle, const std::any &param);
+
+private:
+    void schedule(const ReliableChannel::ptr &channel, U64_t deadline);
+
+    /**
+     * @brief 在管理器锁内确认窗口仍然过期后释放，记录墓碑并清理过期的墓碑
+     */
+    void remove(const ReliableChannel::ptr &channel, U64_t now_ms);
+
+private:
+    mutable RWMutexType m_mutex;
+    FlatHashMap<U64_t, ReliableChannel::ptr> m_channels;
+    FlatHashMap<net_handle_t, U64_t> m_handles;
+    /**
+     * @brief 已释放窗口的下一个序号，tombstone_ttl_ms内重连时不复用序号
+     */
+    struct Tombstone
+    {
+        U64_t next_seq = 0;
+        U64_t expire_ms = 0;
+    };
+    FlatHashMap<U64_t, Tombstone> m_tombstones;
+    std::deque<std::pair<U64_t, U64_t>> m_tombstone_order; // (过期时间, 会话标识)，按时间递增
+    ReliableOptions m_options;
+    ReliableChannel::TransmitFunc m_transmit;
+    DeadCallback m_dead_cb;
+
+    typedef std::pair<U64_t, U64_t> TimerItem; // 时间, 会话标识
+    MutexType m_timer_mutex;
+    std::priority_queue<TimerItem, std::vector<TimerItem>, std::greater<TimerItem>> m_timers;
+
+    ReliableStats m_closed_stats; // 已释放窗口的统计
+};
+
+typedef Singleton<ReliableChannelMgr> ReliableMgr;
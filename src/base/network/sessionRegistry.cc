@@ -0,0 +1,439 @@
+#include "sessionRegistry.h"
+#include "connTrace.h"
+#include "BaseSocket.h"
+#include "clock.h"
+#include "log.h"
+
+static Logger::ptr g_logger = LOG_NAME("system");
+
+SessionRegistry::SessionRegistry()
+{
+    for (int i = 0; i < SESSION_SHARD_COUNT; ++i)
+    {
+        m_shards[i].table.store(new Table(SESSION_SHARD_INIT_CAPACITY));
+    }
+}
+
+SessionRegistry::~SessionRegistry()
+{
+    // 分片表由EpochPtr释放，表不拥有会话快照，这里单独释放
+    for (int i = 0; i < SESSION_SHARD_COUNT; ++i)
+    {
+        Table *table = m_shards[i].table.load();
+        for (size_t j = 0; j < table->capacity; ++j)
+        {
+            delete table->slots[j].value.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+U64_t SessionRegistry::Hash(U64_t user_id)
+{
+    U64_t h = user_id * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 32);
+}
+
+SessionRegistry::Shard &SessionRegistry::shardOf(U64_t hash) const
+{
+    // 分片取高位，槽位取低位，避免同一分片内的用户集中在相邻槽位
+    return m_shards[(hash >> 40) & (SESSION_SHARD_COUNT - 1)];
+}
+
+SessionRegistry::HandleShard &SessionRegistry::handleShardOf(net_handle_t handle)
+{
+    return m_handles[(((U64_t)handle * 0x9E3779B97F4A7C15ULL) >> 40) & (SESSION_SHARD_COUNT - 1)];
+}
+
+void SessionRegistry::unbindHandle(net_handle_t handle, U64_t user_id)
+{
+    HandleShard &hs = handleShardOf(handle);
+    MutexType::Lock lock(hs.mutex);
+    auto it = hs.handles.find(handle);
+    if (it != hs.handles.end() && it->second == user_id)
+    {
+        hs.handles.erase(it);
+    }
+}
+
+const UserSessions *SessionRegistry::find(U64_t user_id) const
+{
+    if (!user_id)
+    {
+        return nullptr;
+    }
+    U64_t hash = Hash(user_id);
+    const Table *table = shardOf(hash).table.load();
+    size_t mask = table->capacity - 1;
+    for (size_t i = hash & mask, n = 0; n < table->capacity; i = (i + 1) & mask, ++n)
+    {
+        U64_t key = table->slots[i].key.load(std::memory_order_acquire);
+        if (key == user_id)
+        {
+            return table->slots[i].value.load(std::memory_order_acquire);
+        }
+        if (!key)
+        {
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+SessionRegistry::Table::Slot *SessionRegistry::findSlotLocked(Table *table, U64_t user_id, U64_t hash)
+{
+    size_t mask = table->capacity - 1;
+    for (size_t i = hash & mask, n = 0; n < table->capacity; i = (i + 1) & mask, ++n)
+    {
+        U64_t key = table->slots[i].key.load(std::memory_order_relaxed);
+        if (key == user_id)
+        {
+            return &table->slots[i];
+        }
+        if (!key)
+        {
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+void SessionRegistry::growLocked(Shard &shard)
+{
+    Table *old = shard.table.load();
+    size_t live = 0;
+    for (size_t i = 0; i < old->capacity; ++i)
+    {
+        live += old->slots[i].value.load(std::memory_order_relaxed) != nullptr;
+    }
+    // 重建后负载不超过1/2，空槽较多时容量不变，只清理下线用户留下的key
+    size_t capacity = old->capacity;
+    while ((live + 1) * 2 > capacity)
+    {
+        capacity <<= 1;
+    }
+
+    Table *table = new Table(capacity);
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < old->capacity; ++i)
+    {
+        const UserSessions *value = old->slots[i].value.load(std::memory_order_relaxed);
+        if (!value)
+        {
+            continue;
+        }
+        U64_t key = old->slots[i].key.load(std::memory_order_relaxed);
+        size_t j = Hash(key) & mask;
+        while (table->slots[j].key.load(std::memory_order_relaxed))
+        {
+            j = (j + 1) & mask;
+        }
+        table->slots[j].value.store(value, std::memory_order_relaxed);
+        table->slots[j].key.store(key, std::memory_order_relaxed);
+    }
+    table->used = live;
+    // 旧表延迟释放，正在遍历旧表的读者仍能看到完整数据
+    shard.table.store(table);
+}
+
+void SessionRegistry::publishLocked(Shard &shard, U64_t user_id, U64_t hash, UserSessions *sessions)
+{
+    Table *table = shard.table.load();
+    Table::Slot *slot = findSlotLocked(table, user_id, hash);
+    if (!slot)
+    {
+        if (!sessions)
+        {
+            return;
+        }
+        if ((table->used + 1) * 4 > table->capacity * 3)
+        {
+            growLocked(shard);
+            table = shard.table.load();
+        }
+        size_t mask = table->capacity - 1;
+        size_t i = hash & mask;
+        while (table->slots[i].key.load(std::memory_order_relaxed))
+        {
+            i = (i + 1) & mask;
+        }
+        slot = &table->slots[i];
+        // 先写value再写key，读者看到key时value已就绪
+        slot->value.store(sessions, std::memory_order_release);
+        slot->key.store(user_id, std::memory_order_release);
+        ++table->used;
+        setOnline(user_id, true);
+        shard.users.fetch_add(1, std::memory_order_relaxed);
+        shard.devices.fetch_add(sessions->devices.size(), std::memory_order_relaxed);
+        return;
+    }
+
+    const UserSessions *old = slot->value.exchange(sessions, std::memory_order_acq_rel);
+    size_t old_devices = old ? old->devices.size() : 0;
+    size_t new_devices = sessions ? sessions->devices.size() : 0;
+    if (!old && sessions)
+    {
+        setOnline(user_id, true);
+        shard.users.fetch_add(1, std::memory_order_relaxed);
+    }
+    else if (old && !sessions)
+    {
+        setOnline(user_id, false);
+        shard.users.fetch_sub(1, std::memory_order_relaxed);
+    }
+    shard.devices.fetch_add(new_devices - old_devices, std::memory_order_relaxed);
+    if (old)
+    {
+        EpochMgr::getInstance()->retire(const_cast<UserSessions *>(old));
+    }
+}
+
+void SessionRegistry::setOnline(U64_t user_id, bool online)
+{
+    if (user_id > UINT32_MAX)
+    {
+        return;
+    }
+    RWMutexType::WriteLock lock(m_online_mutex);
+    if (online)
+    {
+        m_online.add((uint32_t)user_id);
+    }
+    else
+    {
+        m_online.remove((uint32_t)user_id);
+    }
+}
+
+bool SessionRegistry::removeDeviceLocked(Shard &shard, U64_t user_id, U64_t hash, net_handle_t handle)
+{
+    Table::Slot *slot = findSlotLocked(shard.table.load(), user_id, hash);
+    const UserSessions *old = slot ? slot->value.load(std::memory_order_relaxed) : nullptr;
+    if (!old)
+    {
+        return false;
+    }
+
+    UserSessions *next = nullptr;
+    bool found = false;
+    for (auto &dev : old->devices)
+    {
+        if (dev.handle == handle)
+        {
+            found = true;
+            continue;
+        }
+        if (!next)
+        {
+            next = new UserSessions;
+            next->user_id = user_id;
+            next->devices.reserve(old->devices.size() - 1);
+        }
+        next->devices.push_back(dev);
+    }
+    if (!found)
+    {
+        delete next;
+        return false;
+    }
+    publishLocked(shard, user_id, hash, next);
+    return true;
+}
+
+bool SessionRegistry::login(U64_t user_id, const DeviceSession &session,
+                            SessionLoginPolicy policy, std::vector<DeviceSession> *kicked)
+{
+    if (!user_id || session.handle == NETLIB_INVALID_HANDLE)
+    {
+        return false;
+    }
+    {
+        HandleShard &hs = handleShardOf(session.handle);
+        MutexType::Lock lock(hs.mutex);
+        auto it = hs.handles.find(session.handle);
+        if (it != hs.handles.end() && it->second != user_id)
+        {
+            LOG_WARNING(g_logger) << "session login handle=" << session.handle << " user_id=" << user_id
+                                  << " already bound to user_id=" << it->second;
+            return false;
+        }
+        hs.handles[session.handle] = user_id;
+    }
+    // 先记到连接上再发布会话，连接关闭时据此决定是否从注册表移除
+    if (BaseSocket::ptr sock = findBaseSocket(session.handle))
+    {
+        sock->setUserId(user_id);
+    }
+
+    DeviceSession dev = session;
+    if (!dev.login_time)
+    {
+        dev.login_time = Clock::CachedWallMs();
+    }
+
+    std::vector<DeviceSession> evicted;
+    U64_t hash = Hash(user_id);
+    Shard &shard = shardOf(hash);
+    {
+        MutexType::Lock lock(shard.mutex);
+        Table::Slot *slot = findSlotLocked(shard.table.load(), user_id, hash);
+        const UserSessions *old = slot ? slot->value.load(std::memory_order_relaxed) : nullptr;
+
+        UserSessions *next = new UserSessions;
+        next->user_id = user_id;
+        if (old)
+        {
+            next->devices.reserve(old->devices.size() + 1);
+            for (auto &d : old->devices)
+            {
+                // 同一连接重复登录视为更新，不算踢下线
+                if (d.handle == dev.handle)
+                {
+                    continue;
+                }
+                if (policy == SessionLoginPolicy::SESSION_LOGIN_KICK_ALL ||
+                    (policy == SessionLoginPolicy::SESSION_LOGIN_KICK_SAME_PLATFORM && d.platform == dev.platform))
+                {
+                    evicted.push_back(d);
+                    continue;
+                }
+                next->devices.push_back(d);
+            }
+        }
+        next->devices.push_back(dev);
+        publishLocked(shard, user_id, hash, next);
+    }
+
+    for (auto &d : evicted)
+    {
+        unbindHandle(d.handle, user_id);
+    }
+    ConnTraceMgr::getInstance()->onLogin(user_id);
+    if (kicked)
+    {
+        kicked->swap(evicted);
+    }
+    return true;
+}
+
+bool SessionRegistry::logout(U64_t user_id, net_handle_t handle)
+{
+    if (!user_id)
+    {
+        return false;
+    }
+    U64_t hash = Hash(user_id);
+    Shard &shard = shardOf(hash);
+    {
+        MutexType::Lock lock(shard.mutex);
+        if (!removeDeviceLocked(shard, user_id, hash, handle))
+        {
+            return false;
+        }
+    }
+
+    unbindHandle(handle, user_id);
+    return true;
+}
+
+bool SessionRegistry::removeHandle(net_handle_t handle)
+{
+    U64_t user_id = 0;
+    {
+        HandleShard &hs = handleShardOf(handle);
+        MutexType::Lock lock(hs.mutex);
+        auto it = hs.handles.find(handle);
+        if (it == hs.handles.end())
+        {
+            return false;
+        }
+        user_id = it->second;
+        hs.handles.erase(it);
+    }
+
+    U64_t hash = Hash(user_id);
+    Shard &shard = shardOf(hash);
+    MutexType::Lock lock(shard.mutex);
+    return removeDeviceLocked(shard, user_id, hash, handle);
+}
+
+bool SessionRegistry::kick(U64_t user_id, std::vector<DeviceSession> *kicked)
+{
+    if (!user_id)
+    {
+        return false;
+    }
+    std::vector<DeviceSession> evicted;
+    U64_t hash = Hash(user_id);
+    Shard &shard = shardOf(hash);
+    {
+        MutexType::Lock lock(shard.mutex);
+        Table::Slot *slot = findSlotLocked(shard.table.load(), user_id, hash);
+        const UserSessions *old = slot ? slot->value.load(std::memory_order_relaxed) : nullptr;
+        if (!old)
+        {
+            return false;
+        }
+        evicted = old->devices;
+        publishLocked(shard, user_id, hash, nullptr);
+    }
+
+    for (auto &d : evicted)
+    {
+        unbindHandle(d.handle, user_id);
+    }
+    if (kicked)
+    {
+        kicked->swap(evicted);
+    }
+    return true;
+}
+
+bool SessionRegistry::lookup(U64_t user_id, std::vector<DeviceSession> &out) const
+{
+    EpochGuard guard;
+    const UserSessions *sessions = find(user_id);
+    if (!sessions)
+    {
+        return false;
+    }
+    out.assign(sessions->devices.begin(), sessions->devices.end());
+    return true;
+}
+
+bool SessionRegistry::isOnline(U64_t user_id) const
+{
+    EpochGuard guard;
+    return find(user_id) != nullptr;
+}
+
+RoaringBitmap SessionRegistry::getOnline(const RoaringBitmap &members) const
+{
+    RWMutexType::ReadLock lock(m_online_mutex);
+    return RoaringBitmap::And(members, m_online);
+}
+
+uint64_t SessionRegistry::countOnline(const RoaringBitmap &members) const
+{
+    RWMutexType::ReadLock lock(m_online_mutex);
+    return RoaringBitmap::AndCardinality(members, m_online);
+}
+
+size_t SessionRegistry::getUserCount() const
+{
+    size_t count = 0;
+    for (int i = 0; i < SESSION_SHARD_COUNT; ++i)
+    {
+        count += m_shards[i].users.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+size_t SessionRegistry::getDeviceCount() const
+{
+    size_t count = 0;
+    for (int i = 0; i < SESSION_SHARD_COUNT; ++i)
+    {
+        count += m_shards[i].devices.load(std::memory_order_relaxed);
+    }
+    return count;
+}
@@ -0,0 +1,243 @@
+/**
+ * @file sessionRegistry.h
+ * @brief 在线会话注册表，用户id到各端连接的映射
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "ostype.h"
+#include "mutex.h"
+#include "epoch.h"
+#include "flatHashMap.h"
+#include "roaringBitmap.h"
+#include "singleton.h"
+#include "noncopyble.h"
+
+/// 分片数，必须是2的幂
+#define SESSION_SHARD_COUNT 64
+/// 每个分片的初始槽位数
+#define SESSION_SHARD_INIT_CAPACITY 1024
+
+/**
+ * @brief 终端类型
+ */
+enum class SessionPlatform : U8_t
+{
+    SESSION_PLATFORM_UNKNOWN = 0,
+    SESSION_PLATFORM_PC,
+    SESSION_PLATFORM_MOBILE,
+    SESSION_PLATFORM_PAD,
+    SESSION_PLATFORM_WEB
+};
+
+/**
+ * @brief 多端登录策略
+ */
+enum class SessionLoginPolicy : U8_t
+{
+    SESSION_LOGIN_MULTI = 0,          // 允许任意多端同时在线
+    SESSION_LOGIN_KICK_SAME_PLATFORM, // 同类型终端只保留最新登录
+    SESSION_LOGIN_KICK_ALL            // 只保留最新登录
+};
+
+/**
+ * @brief 单个终端的会话
+ */
+struct DeviceSession
+{
+    net_handle_t handle = NETLIB_INVALID_HANDLE; // 连接句柄
+    U32_t loop_id = 0;                           // 连接所在的事件循环
+    SessionPlatform platform = SessionPlatform::SESSION_PLATFORM_UNKNOWN;
+    U64_t login_time = 0; // 登录时间(ms)
+};
+
+/**
+ * @brief 一个用户当前在线的全部终端，发布后只读
+ */
+struct UserSessions
+{
+    U64_t user_id = 0;
+    std::vector<DeviceSession> devices;
+};
+
+/**
+ * @brief 在线会话注册表
+ * @details 按用户id哈希分片，每个分片是一张开放寻址表，槽位的key和value都是原子变量。
+ *          查找在EpochGuard内读取分片表和用户的会话快照，不加锁、不修改引用计数；
+ *          登录/登出/踢下线在分片锁内基于旧快照构造新快照整体替换，旧快照经epoch延迟释放，
+ *          读者看到的始终是某次操作前或操作后的完整终端列表。
+ *          分片表只在扩容时整体替换，删除用户只清空value，扩容时丢弃空槽。
+ *          用户id 0保留为空槽标记，不能登录。
+ */
+class SessionRegistry : Noncopyble
+{
+public:
+    typedef Mutex MutexType;
+    typedef RWMutex RWMutexType;
+
+    SessionRegistry();
+    ~SessionRegistry();
+
+    /**
+     * @brief 终端登录
+     * @param[in] user_id 用户id
+     * @param[in] session 终端会话
+     * @param[in] policy 多端登录策略
+     * @param[out] kicked 按策略被挤下线的终端，由调用方通知并关闭
+     * @return user_id非法或句柄已被其他用户占用时返回false
+     */
+    bool login(U64_t user_id, const DeviceSession &session,
+               SessionLoginPolicy policy = SessionLoginPolicy::SESSION_LOGIN_KICK_SAME_PLATFORM,
+               std::vector<DeviceSession> *kicked = nullptr);
+
+    /**
+     * @brief 终端登出，只移除句柄匹配的终端，避免迟到的登出移除新会话
+     */
+    bool logout(U64_t user_id, net_handle_t handle);
+
+    /**
+     * @brief 按句柄登出，连接关闭时调用
+     * @details 连接上记录了登录的用户id，未登录过的连接由调用方跳过，不进入注册表
+     */
+    bool removeHandle(net_handle_t handle);
+
+    /**
+     * @brief 踢掉用户的所有终端
+     * @param[out] kicked 被踢下线的终端
+     */
+    bool kick(U64_t user_id, std::vector<DeviceSession> *kicked = nullptr);
+
+    /**
+     * @brief 查找用户的在线终端，拷贝到out
+     * @return 用户不在线返回false
+     */
+    bool lookup(U64_t user_id, std::vector<DeviceSession> &out) const;
+
+    /**
+     * @brief 在读临界区内访问用户的会话快照，不拷贝
+     * @details cb中不能保存快照指针，也不能调用本注册表的写接口
+     * @return 用户不在线返回false，cb不会被调用
+     */
+    template <class F>
+    bool visit(U64_t user_id, F cb) const
+    {
+        EpochGuard guard;
+        const UserSessions *sessions = find(user_id);
+        if (!sessions)
+        {
+            return false;
+        }
+        cb(*sessions);
+        return true;
+    }
+
+    bool isOnline(U64_t user_id) const;
+
+    /**
+     * @brief 求members中的在线用户
+     * @details 在线用户同时维护在一个压缩位图中，群成员与其求交不需要逐个查找会话表。
+     *          只收录不超过32位的用户id
+     */
+    RoaringBitmap getOnline(const RoaringBitmap &members) const;
+
+    /**
+     * @brief members中的在线用户数
+     */
+    uint64_t countOnline(const RoaringBitmap &members) const;
+
+    /**
+     * @brief 在线用户数
+     */
+    size_t getUserCount() const;
+
+    /**
+     * @brief 在线终端数
+     */
+    size_t getDeviceCount() const;
+
+private:
+    /**
+     * @brief 分片表
+     */
+    struct Table
+    {
+        struct Slot
+        {
+            std::atomic<U64_t> key{0};
+            std::atomic<const UserSessions *> value{nullptr};
+        };
+
+        explicit Table(size_t cap) : capacity(cap), slots(new Slot[cap]) {}
+
+        size_t capacity; // 2的幂
+        size_t used = 0; // 已写入key的槽位数，包括value为空的
+        std::unique_ptr<Slot[]> slots;
+    };
+
+    struct alignas(64) Shard
+    {
+        MutexType mutex;
+        EpochPtr<Table> table;
+        std::atomic<size_t> users{0};
+        std::atomic<size_t> devices{0};
+    };
+
+    /**
+     * @brief 句柄到用户id的分片，按句柄分片，与用户分片无关
+     */
+    struct alignas(64) HandleShard
+    {
+        MutexType mutex;
+        FlatHashMap<net_handle_t, U64_t> handles;
+    };
+
+    static U64_t Hash(U64_t user_id);
+    Shard &shardOf(U64_t hash) const;
+    HandleShard &handleShardOf(net_handle_t handle);
+
+    /**
+     * @brief 句柄仍绑定user_id时解除绑定
+     */
+    void unbindHandle(net_handle_t handle, U64_t user_id);
+
+    /**
+     * @brief 读者路径，调用方处于EpochGuard内
+     */
+    const UserSessions *find(U64_t user_id) const;
+
+    /**
+     * @brief 在分片锁内替换用户的会话快照，sessions为空表示用户下线
+     */
+    void publishLocked(Shard &shard, U64_t user_id, U64_t hash, UserSessions *sessions);
+
+    /**
+     * @brief 在分片锁内查找用户的槽位，不存在返回nullptr
+     */
+    static Table::Slot *findSlotLocked(Table *table, U64_t user_id, U64_t hash);
+
+    void growLocked(Shard &shard);
+
+    /**
+     * @brief 移除终端并发布新快照，调用方持有分片锁
+     */
+    bool removeDeviceLocked(Shard &shard, U64_t user_id, U64_t hash, net_handle_t handle);
+
+    /**
+     * @brief 用户上线或下线时更新在线位图
+     */
+    void setOnline(U64_t user_id, bool online);
+
+private:
+    mutable Shard m_shards[SESSION_SHARD_COUNT];
+
+    HandleShard m_handles[SESSION_SHARD_COUNT]; // 句柄到用户id，供连接关闭时登出
+
+    mutable RWMutexType m_online_mutex;
+    RoaringBitmap m_online; // 在线用户位图
+};
+
+typedef Singleton<SessionRegistry> SessionMgr;
@@ -0,0 +1,368 @@
+#include <string.h>
+#include <zstd.h>
+#include <algorithm>
+#include "inboxSync.h"
+#include "clock.h"
+#include "log.h"
+
+static Logger::ptr g_logger = LOG_NAME("system");
+
+/**
+ * @brief 页中每个事件的头部，后跟事件内容
+ */
+struct PageEventHeader
+{
+    U64_t seq;
+    U64_t timestamp;
+    U32_t length;
+} __attribute__((packed));
+
+/**
+ * @brief 线程复用的压缩上下文，避免每页创建
+ */
+struct ZstdContext
+{
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+
+    ~ZstdContext()
+    {
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+    }
+};
+
+static thread_local ZstdContext t_zstd;
+
+InboxSync::InboxSync(MessageStore *store, const InboxSyncOptions &options)
+    : m_store(store),
+      m_options(options)
+{
+    m_options.window_events = std::max<U32_t>(m_options.window_events, 1);
+    m_options.page_events = std::max<U32_t>(m_options.page_events, 1);
+    m_options.initial_events = std::max<U32_t>(m_options.initial_events, 1);
+}
+
+InboxSync::UserInbox &InboxSync::loadLocked(Shard &shard, U64_t user_id, U64_t now_ms)
+{
+    auto it = shard.users.find(user_id);
+    if (it != shard.users.end())
+    {
+        it->second.active_ms = now_ms;
+        return it->second;
+    }
+    UserInbox &inbox = shard.users[user_id];
+    inbox.head_seq = m_store ? m_store->getLastSeq(InboxConvId(user_id)) : 0;
+    auto eit = shard.evicted.find(user_id);
+    if (eit != shard.evicted.end())
+    {
+        // 释放前写入的事件可能还在存储的待写缓冲区中，序号不能回退
+        inbox.head_seq = std::max(inbox.head_seq, eit->second);
+        shard.evicted.erase(eit);
+    }
+    inbox.ring_from = inbox.head_seq + 1;
+    inbox.ring.resize(m_options.window_events);
+    inbox.active_ms = now_ms;
+    return inbox;
+}
+
+U64_t InboxSync::push(U64_t user_id, const void *data, size_t len)
+{
+    return push(user_id, BufferSlice::Copy(data, len));
+}
+
+U64_t InboxSync::push(U64_t user_id, const BufferSlice &data)
+{
+    U64_t timestamp = Clock::CachedWallMs();
+    Shard &shard = shardOf(user_id);
+    MutexType::Lock lock(shard.mutex);
+    UserInbox &inbox = loadLocked(shard, user_id, Clock::CachedMs());
+    U64_t seq = inbox.head_seq + 1;
+    // 在分片锁内写入存储，同一用户的序号按顺序到达存储
+    if (m_store && !m_store->append(InboxConvId(user_id), seq, data.data(), data.size(), timestamp))
+    {
+        LOG_ERROR_RATELIMIT(g_logger, 1) << "inbox push user=" << user_id << " seq=" << seq << " store append failed";
+        return 0;
+    }
+    inbox.head_seq = seq;
+    InboxEvent &event = inbox.ring[seq % inbox.ring.size()];
+    event.seq = seq;
+    event.timestamp = timestamp;
+    event.data = data;
+    m_pushes.add();
+    return seq;
+}
+
+U64_t InboxSync::getHeadSeq(U64_t user_id)
+{
+    Shard &shard = shardOf(user_id);
+    MutexType::Lock lock(shard.mutex);
+    return loadLocked(shard, user_id, Clock::CachedMs()).head_seq;
+}
+
+bool InboxSync::sync(U64_t user_id, U64_t after_seq, SyncPage &page)
+{
+    page = SyncPage();
+    m_syncs.add();
+    std::vector<InboxEvent> events;
+    U64_t from;
+    size_t bytes = 0;
+    {
+        Shard &shard = shardOf(user_id);
+        MutexType::Lock lock(shard.mutex);
+        UserInbox &inbox = loadLocked(shard, user_id, Clock::CachedMs());
+        page.head_seq = inbox.head_seq;
+        if (after_seq > inbox.head_seq)
+        {
+            // 终端的游标来自序号重新开始之前，不能当作已经同步完
+            LOG_WARNING_RATELIMIT(g_logger, 1) << "inbox sync user=" << user_id << " after=" << after_seq
+                                               << " head=" << inbox.head_seq << " cursor reset";
+            page.reset = true;
+            after_seq = 0;
+        }
+        if (after_seq >= inbox.head_seq)
+        {
+            return true;
+        }
+        from = after_seq + 1;
+        // 新终端或落后太多时只同步最近的事件
+        if (after_seq == 0 || inbox.head_seq - after_seq > m_options.max_backlog)
+        {
+            U64_t recent = inbox.head_seq > m_options.initial_events ? inbox.head_seq - m_options.initial_events + 1 : 1;
+            if (recent > from)
+            {
+                from = recent;
+                page.skipped = true;
+            }
+        }
+        U64_t window_from = inbox.head_seq >= inbox.ring.size() ? inbox.head_seq - inbox.ring.size() + 1 : 1;
+        window_from = std::max(window_from, inbox.ring_from);
+        if (!m_store && from < window_from)
+        {
+            from = window_from;
+            page.skipped = true;
+        }
+        if (from >= window_from)
+        {
+            for (U64_t seq = from; seq <= inbox.head_seq && events.size() < m_options.page_events; ++seq)
+            {
+                const InboxEvent &event = inbox.ring[seq % inbox.ring.size()];
+                if (!events.empty() && bytes + event.data.size() > m_options.page_bytes)
+                {
+                    break;
+                }
+                bytes += event.data.size();
+                events.push_back(event);
+            }
+        }
+    }
+
+    if (events.empty())
+    {
+        // 超出内存窗口，从消息存储读取
+        m_store_reads.add();
+        std::vector<StoreMessage> messages;
+        m_store->fetch(InboxConvId(user_id), from, m_options.page_events, messages);
+        for (StoreMessage &msg : messages)
+        {
+            if (!events.empty() && bytes + msg.payload.size() > m_options.page_bytes)
+            {
+                break;
+            }
+            bytes += msg.payload.size();
+            InboxEvent event;
+            event.seq = msg.seq;
+            event.timestamp = msg.timestamp;
+            event.data = std::move(msg.payload);
+            events.push_back(std::move(event));
+        }
+        if (events.empty() && m_store->getLastSeq(InboxConvId(user_id)) >= page.head_seq)
+        {
+            // 存储已追上但读不到任何事件，剩余的事件都已过期删除
+            m_skipped.add();
+            page.skipped = true;
+            page.last_seq = page.head_seq;
+            return true;
+        }
+        if (events.empty())
+        {
+            LOG_WARNING_RATELIMIT(g_logger, 1) << "inbox sync user=" << user_id << " from=" << from
+                                               << " head=" << page.head_seq << " not found in store";
+            return false;
+        }
+        if (events.front().seq != from)
+        {
+            // 存储中的事件已过期删除
+            page.skipped = true;
+        }
+    }
+    else
+    {
+        m_memory_hits.add();
+    }
+    if (page.skipped)
+    {
+        m_skipped.add();
+    }
+
+    page.from_seq = events.front().seq;
+    page.last_seq = events.back().seq;
+    page.count = events.size();
+    page.has_more = page.last_seq < page.head_seq;
+    encodePage(events, page);
+    return true;
+}
+
+void InboxSync::encodePage(const std::vector<InboxEvent> &events, SyncPage &page)
+{
+    size_t raw_size = 0;
+    for (const InboxEvent &event : events)
+    {
+        raw_size += sizeof(PageEventHeader) + event.data.size();
+    }
+    std::string raw;
+    raw.resize(raw_size);
+    char *p = &raw[0];
+    for (const InboxEvent &event : events)
+    {
+        PageEventHeader hdr;
+        hdr.seq = event.seq;
+        hdr.timestamp = event.timestamp;
+        hdr.length = event.data.size();
+        memcpy(p, &hdr, sizeof(hdr));
+        p += sizeof(hdr);
+        if (!event.data.empty())
+        {
+            memcpy(p, event.data.data(), event.data.size());
+            p += event.data.size();
+        }
+    }
+    page.raw_size = raw_size;
+    m_raw_bytes.add(raw_size);
+
+    if (raw_size >= m_options.compress_threshold && t_zstd.cctx)
+    {
+        std::string out;
+        out.resize(ZSTD_compressBound(raw_size));
+        size_t n = ZSTD_compressCCtx(t_zstd.cctx, &out[0], out.size(), raw.data(), raw_size, m_options.compress_level);
+        if (!ZSTD_isError(n) && n < raw_size)
+        {
+            out.resize(n);
+            page.data.swap(out);
+            page.compressed = true;
+            m_wire_bytes.add(n);
+            return;
+        }
+    }
+    page.data.swap(raw);
+    m_wire_bytes.add(raw_size);
+}
+
+bool InboxSync::DecodePage(const SyncPage &page, std::vector<InboxEvent> &events)
+{
+    MutableBuffer buffer(std::max<size_t>(page.raw_size, 1));
+    if (page.compressed)
+    {
+        size_t n = ZSTD_decompressDCtx(t_zstd.dctx, buffer.data(), buffer.capacity(), page.data.data(), page.data.size());
+        if (ZSTD_isError(n) || n != page.raw_size)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        if (page.data.size() != page.raw_size)
+        {
+            return false;
+        }
+        memcpy(buffer.data(), page.data.data(), page.raw_size);
+    }
+    buffer.setSize(page.raw_size);
+    // 所有事件共享解码后的一个块
+    BufferSlice raw = buffer.freeze();
+    size_t offset = 0;
+    while (offset < page.raw_size)
+    {
+        PageEventHeader hdr;
+        if (offset + sizeof(hdr) > page.raw_size)
+        {
+            return false;
+        }
+        memcpy(&hdr, raw.data() + offset, sizeof(hdr));
+        offset += sizeof(hdr);
+        if (offset + hdr.length > page.raw_size)
+        {
+            return false;
+        }
+        InboxEvent event;
+        event.seq = hdr.seq;
+        event.timestamp = hdr.timestamp;
+        event.data = raw.slice(offset, hdr.length);
+        events.push_back(std::move(event));
+        offset += hdr.length;
+    }
+    return true;
+}
+
+size_t InboxSync::expire(U64_t now_ms)
+{
+    U64_t idle_ms = (U64_t)m_options.idle_sec * 1000;
+    size_t removed = 0;
+    for (auto &shard : m_shards)
+    {
+        MutexType::Lock lock(shard.mutex);
+        // 存储已经索引到释放时的序号，之后从存储恢复即可
+        if (m_store)
+        {
+            auto eit = shard.evicted.begin();
+            while (eit != shard.evicted.end())
+            {
+                if (m_store->getLastSeq(InboxConvId(eit->first)) >= eit->second)
+                {
+                    eit = shard.evicted.erase(eit);
+                }
+                else
+                {
+                    ++eit;
+                }
+            }
+        }
+        auto it = shard.users.begin();
+        while (it != shard.users.end())
+        {
+            if (now_ms - it->second.active_ms >= idle_ms)
+            {
+                U64_t head = it->second.head_seq;
+                if (head && (!m_store || m_store->getLastSeq(InboxConvId(it->first)) < head))
+                {
+                    shard.evicted[it->first] = head;
+                }
+                it = shard.users.erase(it);
+                ++removed;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+    return removed;
+}
+
+InboxSyncStats InboxSync::getStats() const
+{
+    InboxSyncStats stats;
+    stats.pushes = m_pushes.read();
+    stats.syncs = m_syncs.read();
+    stats.memory_hits = m_memory_hits.read();
+    stats.store_reads = m_store_reads.read();
+    stats.skipped = m_skipped.read();
+    stats.raw_bytes = m_raw_bytes.read();
+    stats.wire_bytes = m_wire_bytes.read();
+    for (auto &shard : m_shards)
+    {
+        MutexType::Lock lock(shard.mutex);
+        stats.users += shard.users.size();
+    }
+    return stats;
+}
@@ -0,0 +1,177 @@
+/**
+ * @file inboxSync.h
+ * @brief 按用户收件箱序号的多终端增量同步
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ostype.h"
+#include "mutex.h"
+#include "flatHashMap.h"
+#include "bufferPool.h"
+#include "messageStore.h"
+#include "noncopyble.h"
+
+/// 用户分片数，必须是2的幂
+#define INBOX_SHARD_COUNT 64
+/// 收件箱在消息存储中的会话id，最高位置1与普通会话区分
+#define INBOX_CONV_FLAG (1ull << 63)
+
+/**
+ * @brief 收件箱事件
+ */
+struct InboxEvent
+{
+    U64_t seq = 0;       // 用户收件箱序号，从1开始连续递增
+    U64_t timestamp = 0; // 写入时间(ms)
+    BufferSlice data;    // 已序列化的事件，一般是一条消息或通知
+};
+
+/**
+ * @brief 同步配置
+ */
+struct InboxSyncOptions
+{
+    U32_t window_events = 256;          // 每个用户在内存中保留的最近事件数
+    U32_t page_events = 200;            // 每页最多事件数
+    U32_t page_bytes = 256 * 1024;      // 每页最多字节数(压缩前)，至少返回一条
+    U32_t initial_events = 100;         // 新终端(after_seq为0)或落后过多时只同步最近的事件数
+    U64_t max_backlog = 10000;          // 落后超过该数量时跳到最近initial_events条，更早的历史按需翻页
+    U32_t compress_threshold = 1024;    // 页大小达到该值时zstd压缩
+    int compress_level = 1;             // zstd压缩级别
+    U32_t idle_sec = 3600;              // 用户超过该时间没有新事件或同步时释放内存窗口
+};
+
+/**
+ * @brief 一页同步结果
+ */
+struct SyncPage
+{
+    U64_t from_seq = 0;      // 本页第一条事件的序号，没有事件时为0
+    U64_t last_seq = 0;      // 本页最后一条事件的序号，下次同步作为after_seq
+    U64_t head_seq = 0;      // 用户收件箱当前最大序号
+    U32_t count = 0;         // 事件数
+    bool has_more = false;   // 还有更多事件，立即继续同步
+    bool skipped = false;    // 落后过多，跳过了(after_seq, from_seq)之间的事件
+    bool reset = false;      // after_seq超过了head_seq，服务端序号已重新开始，终端丢弃本地游标后按新终端同步
+    bool compressed = false; // data经过zstd压缩
+    U32_t raw_size = 0;      // 压缩前的大小
+    std::string data;        // 编码后的事件，见DecodePage()
+};
+
+/**
+ * @brief 同步运行统计
+ */
+struct InboxSyncStats
+{
+    uint64_t pushes = 0;       // 写入的事件数
+    uint64_t syncs = 0;        // 同步请求数
+    uint64_t memory_hits = 0;  // 完全由内存窗口返回的同步数
+    uint64_t store_reads = 0;  // 回退到消息存储的同步数
+    uint64_t skipped = 0;      // 跳过历史的同步数
+    uint64_t raw_bytes = 0;    // 返回的页大小(压缩前)
+    uint64_t wire_bytes = 0;   // 返回的页大小(压缩后)
+    uint64_t users = 0;        // 内存中的用户数
+};
+
+/**
+ * @brief 收件箱增量同步
+ * @details 发给用户的每个事件分配用户级单调递增的收件箱序号，写入消息存储(会话id为INBOX_CONV_FLAG | user_id)，
+ *          同时保留在用户的内存窗口中。终端记录已同步到的序号，登录后调用sync()只拉取之后的事件：
+ *          请求的范围在内存窗口内时直接返回窗口中的缓冲区引用，否则从消息存储读取。
+ *          新终端或者落后超过max_backlog的终端只同步最近initial_events条，更早的历史由客户端按需翻页，
+ *          登录时不会回放全部历史。每页按事件数和字节数分页，超过阈值时整页zstd压缩。
+ *          用户首次访问时从消息存储恢复最大序号，重启后序号继续递增。
+ */
+class InboxSync : Noncopyble
+{
+public:
+    typedef Mutex MutexType;
+
+    /**
+     * @param[in] store 持久化事件的消息存储，为nullptr时只在内存窗口中保存
+     */
+    explicit InboxSync(MessageStore *store = nullptr, const InboxSyncOptions &options = InboxSyncOptions());
+
+    /**
+     * @brief 向用户收件箱写入一个事件
+     * @return 收件箱序号，写入存储失败返回0
+     */
+    U64_t push(U64_t user_id, const BufferSlice &data);
+    U64_t push(U64_t user_id, const void *data, size_t len);
+
+    /**
+     * @brief 用户收件箱当前最大序号
+     */
+    U64_t getHeadSeq(U64_t user_id);
+
+    /**
+     * @brief 同步序号大于after_seq的事件
+     * @details after_seq大于收件箱最大序号时视为游标失效，按新终端同步并设置page.reset
+     * @return 用户没有任何事件时page.count为0，仍返回true；读取存储失败返回false
+     */
+    bool sync(U64_t user_id, U64_t after_seq, SyncPage &page);
+
+    /**
+     * @brief 解码一页事件
+     */
+    static bool DecodePage(const SyncPage &page, std::vector<InboxEvent> &events);
+
+    /**
+     * @brief 释放空闲用户的内存窗口，只保留最大序号直到存储的索引追上
+     * @return 释放的用户数
+     */
+    size_t expire(U64_t now_ms);
+
+    InboxSyncStats getStats() const;
+
+    static U64_t InboxConvId(U64_t user_id) { return INBOX_CONV_FLAG | user_id; }
+
+private:
+    /**
+     * @brief 用户收件箱的内存窗口
+     */
+    struct UserInbox
+    {
+        U64_t head_seq = 0;
+        U64_t ring_from = 1;          // 窗口中最早可能存在的序号，加载前的事件只在存储中
+        std::vector<InboxEvent> ring; // 按序号取模存放最近window_events条
+        U64_t active_ms = 0;
+    };
+
+    struct alignas(64) Shard
+    {
+        mutable MutexType mutex;
+        FlatHashMap<U64_t, UserInbox> users;
+        // 已释放窗口的用户的最大序号，存储的索引可能还没追上，重新加载时不能只看getLastSeq()
+        FlatHashMap<U64_t, U64_t> evicted;
+    };
+
+    Shard &shardOf(U64_t user_id) { return m_shards[((user_id * 0x9E3779B97F4A7C15ULL) >> 40) & (INBOX_SHARD_COUNT - 1)]; }
+
+    /**
+     * @brief 取用户窗口，不存在时创建并从存储恢复最大序号，调用方持有分片锁
+     */
+    UserInbox &loadLocked(Shard &shard, U64_t user_id, U64_t now_ms);
+
+    /**
+     * @brief 编码并按需压缩
+     */
+    void encodePage(const std::vector<InboxEvent> &events, SyncPage &page);
+
+private:
+    MessageStore *m_store;
+    InboxSyncOptions m_options;
+    Shard m_shards[INBOX_SHARD_COUNT];
+
+    PerCpuCounter m_pushes;
+    PerCpuCounter m_syncs;
+    PerCpuCounter m_memory_hits;
+    PerCpuCounter m_store_reads;
+    PerCpuCounter m_skipped;
+    PerCpuCounter m_raw_bytes;
+    PerCpuCounter m_wire_bytes;
+};
@@ -0,0 +1,705 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include "messageStore.h"
+#include "crc32.h"
+#include "fileUtil.h"
+#include "clock.h"
+#include "log.h"
+
+static Logger::ptr g_logger = LOG_NAME("system");
+
+/**
+ * @brief 记录头加内容按STORE_RECORD_ALIGN对齐后的长度
+ */
+static size_t RecordSize(size_t len)
+{
+    return AlignedRecordSize<StoreRecordHeader>(len, STORE_RECORD_ALIGN);
+}
+
+static uint32_t RecordCrc(const StoreRecordHeader *rec)
+{
+    return Crc32c(reinterpret_cast<const char *>(rec) + sizeof(rec->crc),
+                  sizeof(StoreRecordHeader) - sizeof(rec->crc) + rec->length);
+}
+
+MessageStore::Segment::~Segment()
+{
+    if (map)
+    {
+        munmap(map, capacity);
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+    if (removed)
+    {
+        unlink(path.c_str());
+    }
+}
+
+MessageStore::MessageStore(const MessageStoreOptions &options)
+    : m_options(options)
+{
+    if (m_options.index_interval == 0)
+    {
+        m_options.index_interval = 1;
+    }
+}
+
+MessageStore::~MessageStore()
+{
+    close();
+}
+
+std::string MessageStore::segmentPath(U32_t id) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%010u.seg", id);
+    return m_options.dir + name;
+}
+
+MessageStore::Segment::ptr MessageStore::openSegment(U32_t id, bool create)
+{
+    Segment::ptr seg = std::make_shared<Segment>();
+    seg->id = id;
+    seg->path = segmentPath(id);
+    seg->fd = ::open(seg->path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+    if (seg->fd < 0)
+    {
+        LOG_ERROR(g_logger) << "open segment " << seg->path << " failed: " << strerror(errno);
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(seg->fd, &st) != 0)
+    {
+        return nullptr;
+    }
+    seg->capacity = st.st_size;
+    if (seg->capacity < m_options.segment_size)
+    {
+        // 预先扩展成稀疏文件，整段映射后写入不会越过文件末尾
+        if (ftruncate(seg->fd, m_options.segment_size) != 0)
+        {
+            LOG_ERROR(g_logger) << "extend segment " << seg->path << " failed: " << strerror(errno);
+            return nullptr;
+        }
+        seg->capacity = m_options.segment_size;
+    }
+    void *map = mmap(nullptr, seg->capacity, PROT_READ, MAP_SHARED, seg->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG_ERROR(g_logger) << "mmap segment " << seg->path << " failed: " << strerror(errno);
+        return nullptr;
+    }
+    seg->map = static_cast<char *>(map);
+    return seg;
+}
+
+bool MessageStore::open()
+{
+    if (m_thread)
+    {
+        return true;
+    }
+    if (m_options.dir.empty() || !MakeDirs(m_options.dir))
+    {
+        LOG_ERROR(g_logger) << "message store dir " << m_options.dir << " unavailable";
+        return false;
+    }
+
+    std::vector<U32_t> ids;
+    DIR *dir = opendir(m_options.dir.c_str());
+    if (!dir)
+    {
+        return false;
+    }
+    while (dirent *ent = readdir(dir))
+    {
+        unsigned id = 0;
+        char tail[8] = {0};
+        if (sscanf(ent->d_name, "%10u.%4s", &id, tail) == 2 && id && strcmp(tail, "seg") == 0)
+        {
+            ids.push_back(id);
+        }
+    }
+    closedir(dir);
+    std::sort(ids.begin(), ids.end());
+
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        Segment::ptr seg = openSegment(ids[i], false);
+        if (!seg)
+        {
+            return false;
+        }
+        seg->size = recoverSegment(*seg);
+        if (i + 1 == ids.size() && seg->size < seg->capacity)
+        {
+            // 截断再扩展，清零崩溃时写了一半的尾部，避免之后的恢复把残留记录当作有效数据
+            if (ftruncate(seg->fd, seg->size) != 0 || ftruncate(seg->fd, seg->capacity) != 0)
+            {
+                LOG_ERROR(g_logger) << "reset segment tail " << seg->path << " failed: " << strerror(errno);
+                return false;
+            }
+        }
+        m_segments[seg->id] = seg;
+    }
+    if (m_segments.empty())
+    {
+        Segment::ptr seg = openSegment(1, true);
+        if (!seg)
+        {
+            return false;
+        }
+        m_segments[seg->id] = seg;
+    }
+    m_active = m_segments.rbegin()->second;
+    LOG_INFO(g_logger) << "message store " << m_options.dir << " opened, segments=" << m_segments.size()
+                       << " conversations=" << m_convs.size();
+
+    m_stopping = false;
+    m_last_compact = Clock::NowMs();
+    m_thread = std::make_shared<Thread>([this]()
+                                        { run(); },
+                                        "msg_store");
+    return true;
+}
+
+void MessageStore::close()
+{
+    if (!m_thread)
+    {
+        return;
+    }
+    m_stopping = true;
+    m_pending_waiter.notify();
+    m_commit_waiter.notifyAll();
+    m_thread->join();
+    m_thread.reset();
+}
+
+U64_t MessageStore::recoverSegment(Segment &segment)
+{
+    U64_t offset = 0;
+    while (offset + sizeof(StoreRecordHeader) <= segment.capacity)
+    {
+        const StoreRecordHeader *rec = reinterpret_cast<const StoreRecordHeader *>(segment.map + offset);
+        size_t rec_len = RecordSize(rec->length);
+        if (rec->length > STORE_MAX_MESSAGE_SIZE || offset + rec_len > segment.capacity ||
+            rec->crc != RecordCrc(rec))
+        {
+            break;
+        }
+        ConvIndex &index = m_convs[rec->conv_id];
+        if (!index.count || rec->seq > index.last.seq)
+        {
+            Location loc;
+            loc.seq = rec->seq;
+            loc.segment = segment.id;
+            loc.offset = offset;
+            indexRecord(index, loc);
+        }
+        segment.max_timestamp = std::max(segment.max_timestamp, rec->timestamp);
+        offset += rec_len;
+    }
+    return offset;
+}
+
+void MessageStore::indexRecord(ConvIndex &index, const Location &loc)
+{
+    if (index.count % m_options.index_interval == 0)
+    {
+        index.sparse.push_back(loc);
+    }
+    index.last = loc;
+    ++index.count;
+}
+
+U64_t MessageStore::append(U64_t conv_id, U64_t seq, const void *data, size_t len, U64_t timestamp)
+{
+    size_t rec_len = RecordSize(len);
+    if (!conv_id || len > STORE_MAX_MESSAGE_SIZE || rec_len > m_options.segment_size ||
+        m_failed.load(std::memory_order_acquire))
+    {
+        return 0;
+    }
+    // 写线程跟不上时阻塞生产者
+    if (m_pending_bytes.load(std::memory_order_relaxed) >= m_options.max_pending_bytes)
+    {
+        m_commit_waiter.wait([this]()
+                             { return m_pending_bytes.load(std::memory_order_acquire) < m_options.max_pending_bytes ||
+                                      m_stopping.load(std::memory_order_relaxed); });
+    }
+
+    StoreRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.length = len;
+    header.conv_id = conv_id;
+    header.seq = seq;
+    header.timestamp = timestamp ? timestamp : Clock::WallMs();
+
+    U64_t ticket = 0;
+    {
+        MutexType::Lock lock(m_pending_mutex);
+        // 在待写锁内判断，写线程只有在同一把锁内看到缓冲区为空且正在停止时才退出，不会留下无人提交的记录
+        if (m_stopping.load(std::memory_order_relaxed))
+        {
+            return 0;
+        }
+        U64_t last = 0;
+        auto it = m_pending_seqs.find(conv_id);
+        if (it != m_pending_seqs.end())
+        {
+            last = it->second;
+        }
+        else
+        {
+            auto fit = m_inflight_seqs.find(conv_id);
+            last = fit != m_inflight_seqs.end() ? fit->second : getLastSeq(conv_id);
+        }
+        if (seq <= last)
+        {
+            m_rejected.fetch_add(1, std::memory_order_relaxed);
+            LOG_WARNING_RATELIMIT(g_logger, 10) << "message store reject conv_id=" << conv_id
+                                                << " seq=" << seq << " last_seq=" << last;
+            return 0;
+        }
+        m_pending_seqs[conv_id] = seq;
+        size_t pos = m_pending.size();
+        m_pending.resize(pos + rec_len);
+        char *p = &m_pending[pos];
+        memcpy(p, &header, sizeof(header));
+        memcpy(p + sizeof(header), data, len);
+        memset(p + sizeof(header) + len, 0, rec_len - sizeof(header) - len);
+        ticket = ++m_next_ticket;
+        m_pending_bytes.fetch_add(rec_len, std::memory_order_relaxed);
+    }
+    m_pending_waiter.notify();
+    return ticket;
+}
+
+bool MessageStore::waitCommitted(U64_t ticket, int timeout_ms)
+{
+    if (!m_commit_waiter.wait([this, ticket]()
+                              { return m_committed.load(std::memory_order_acquire) >= ticket; },
+                              timeout_ms))
+    {
+        return false;
+    }
+    return ticket < m_failed_ticket.load(std::memory_order_acquire);
+}
+
+void MessageStore::flush()
+{
+    U64_t ticket = 0;
+    {
+        MutexType::Lock lock(m_pending_mutex);
+        ticket = m_next_ticket;
+    }
+    waitCommitted(ticket);
+}
+
+void MessageStore::run()
+{
+    std::string batch;
+    int interval_ms = m_options.compact_interval_sec ? m_options.compact_interval_sec * 1000 : 60000;
+    while (true)
+    {
+        m_pending_waiter.wait([this]()
+                              { return m_pending_bytes.load(std::memory_order_acquire) > 0 ||
+                                       m_stopping.load(std::memory_order_relaxed); },
+                              interval_ms);
+        U64_t ticket = 0;
+        bool stop = false;
+        {
+            MutexType::Lock lock(m_pending_mutex);
+            batch.swap(m_pending);
+            ticket = m_next_ticket;
+            m_inflight_seqs.swap(m_pending_seqs);
+            m_pending_seqs.clear();
+            stop = batch.empty() && m_stopping.load(std::memory_order_relaxed);
+        }
+        if (stop)
+        {
+            break;
+        }
+        if (!batch.empty())
+        {
+            size_t bytes = batch.size();
+            U64_t first = m_committed.load(std::memory_order_relaxed) + 1;
+            U64_t failed_ticket = first;
+            // 失败后不再写入，之后的批次直接标记失败
+            if (!m_failed.load(std::memory_order_relaxed) && !commitBatch(batch, first, failed_ticket))
+            {
+                LOG_ERROR(g_logger) << "message store " << m_options.dir << " failed, tickets from "
+                                    << failed_ticket << " are lost";
+                m_failed_ticket.store(failed_ticket, std::memory_order_release);
+                m_failed.store(true, std::memory_order_release);
+            }
+            batch.clear();
+            {
+                // 批次已经进入索引
+                MutexType::Lock lock(m_pending_mutex);
+                m_inflight_seqs.clear();
+            }
+            m_pending_bytes.fetch_sub(bytes, std::memory_order_release);
+            m_committed.store(ticket, std::memory_order_release);
+            m_commit_waiter.notifyAll();
+        }
+
+        U64_t now = Clock::NowMs();
+        if (m_options.ttl_sec && now - m_last_compact >= (U64_t)interval_ms)
+        {
+            m_last_compact = now;
+            compact();
+        }
+    }
+}
+
+bool MessageStore::writeActive(const char *data, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t ret = pwrite(m_active->fd, data + done, len - done, m_active->size + done);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LOG_ERROR(g_logger) << "write segment " << m_active->path << " failed: " << strerror(errno);
+            return false;
+        }
+        done += ret;
+    }
+    m_active->size += len;
+    return true;
+}
+
+bool MessageStore::rollSegment()
+{
+    if (m_options.sync)
+    {
+        fdatasync(m_active->fd);
+    }
+    Segment::ptr seg = openSegment(m_active->id + 1, true);
+    if (!seg)
+    {
+        return false;
+    }
+    RWMutexType::WriteLock lock(m_mutex);
+    m_segments[seg->id] = seg;
+    m_active = seg;
+    return true;
+}
+
+bool MessageStore::commitBatch(std::string &batch, U64_t first_ticket, U64_t &failed_ticket)
+{
+    struct Added
+    {
+        U64_t conv_id;
+        Location loc;
+        Segment *segment;
+        U64_t timestamp;
+        U64_t ticket;
+    };
+    std::vector<Added> added;
+    size_t written = 0; // added中已写入分段的条数
+    MutexType::Lock writer_lock(m_writer_mutex);
+    // 本批次内各会话的最后位置，用于链接同一批次中的多条记录
+    FlatHashMap<U64_t, Location> tails;
+
+    char *base = &batch[0];
+    size_t rp = 0;
+    size_t wp = 0;
+    size_t start = 0; // 尚未写入分段的起点
+    U64_t ticket = first_ticket;
+    bool ok = true;
+    for (; rp < batch.size(); ++ticket)
+    {
+        StoreRecordHeader *rec = reinterpret_cast<StoreRecordHeader *>(base + rp);
+        size_t rec_len = RecordSize(rec->length);
+
+        // 写线程是索引唯一的修改者，这里不加锁读取
+        const Location *tail = nullptr;
+        auto tit = tails.find(rec->conv_id);
+        if (tit != tails.end())
+        {
+            tail = &tit->second;
+        }
+        else
+        {
+            auto cit = m_convs.find(rec->conv_id);
+            if (cit != m_convs.end())
+            {
+                tail = &cit->second.last;
+            }
+        }
+        // append()已经保证序号递增，这里只防止索引回退
+        if (tail && rec->seq <= tail->seq)
+        {
+            m_rejected.fetch_add(1, std::memory_order_relaxed);
+            LOG_ERROR_RATELIMIT(g_logger, 10) << "message store unexpected seq conv_id=" << rec->conv_id
+                                              << " seq=" << rec->seq << " last_seq=" << tail->seq;
+            rp += rec_len;
+            continue;
+        }
+
+        if (m_active->size + (wp - start) + rec_len > m_active->capacity)
+        {
+            if (!writeActive(base + start, wp - start))
+            {
+                ok = false;
+                break;
+            }
+            written = added.size();
+            start = wp;
+            if (!rollSegment())
+            {
+                ok = false;
+                break;
+            }
+        }
+
+        if (rp != wp)
+        {
+            memmove(base + wp, base + rp, rec_len);
+            rec = reinterpret_cast<StoreRecordHeader *>(base + wp);
+        }
+        rec->prev_segment = tail ? tail->segment : 0;
+        rec->prev_offset = tail ? tail->offset : 0;
+        rec->crc = RecordCrc(rec);
+
+        Added item;
+        item.conv_id = rec->conv_id;
+        item.loc.seq = rec->seq;
+        item.loc.segment = m_active->id;
+        item.loc.offset = m_active->size + (wp - start);
+        item.segment = m_active.get();
+        item.timestamp = rec->timestamp;
+        item.ticket = ticket;
+        tails[item.conv_id] = item.loc;
+        added.push_back(item);
+
+        rp += rec_len;
+        wp += rec_len;
+    }
+    if (ok)
+    {
+        ok = writeActive(base + start, wp - start);
+        if (ok)
+        {
+            written = added.size();
+            if (m_options.sync)
+            {
+                fdatasync(m_active->fd);
+            }
+        }
+    }
+    if (!ok)
+    {
+        // 中途切换分段失败时前面的记录已经在旧分段中，照常索引，否则重启恢复后会重新出现
+        failed_ticket = written < added.size() ? added[written].ticket : ticket;
+        added.resize(written);
+    }
+
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        for (auto &item : added)
+        {
+            indexRecord(m_convs[item.conv_id], item.loc);
+            item.segment->max_timestamp = std::max(item.segment->max_timestamp, item.timestamp);
+        }
+    }
+    m_appends.add(added.size());
+    m_batches.fetch_add(1, std::memory_order_relaxed);
+    m_bytes.fetch_add(ok ? wp : start, std::memory_order_relaxed);
+    return ok;
+}
+
+const StoreRecordHeader *MessageStore::recordAt(U32_t segment, U32_t offset) const
+{
+    auto it = m_segments.find(segment);
+    if (it == m_segments.end() || offset + sizeof(StoreRecordHeader) > it->second->capacity)
+    {
+        return nullptr;
+    }
+    return reinterpret_cast<const StoreRecordHeader *>(it->second->map + offset);
+}
+
+void MessageStore::walkBack(Location anchor, U64_t lower, U64_t upper, size_t limit,
+                            std::vector<const StoreRecordHeader *> &out) const
+{
+    U32_t segment = anchor.segment;
+    U32_t offset = anchor.offset;
+    while (segment && out.size() < limit)
+    {
+        // 前一条所在分段已过期删除时链表在此结束
+        const StoreRecordHeader *rec = recordAt(segment, offset);
+        if (!rec || rec->seq < lower)
+        {
+            break;
+        }
+        if (rec->seq < upper)
+        {
+            out.push_back(rec);
+        }
+        segment = rec->prev_segment;
+        offset = rec->prev_offset;
+    }
+}
+
+void MessageStore::ToMessage(const StoreRecordHeader *rec, StoreMessage &msg)
+{
+    msg.conv_id = rec->conv_id;
+    msg.seq = rec->seq;
+    msg.timestamp = rec->timestamp;
+    msg.payload = BufferSlice::Copy(rec + 1, rec->length);
+}
+
+size_t MessageStore::fetch(U64_t conv_id, U64_t from_seq, size_t limit, std::vector<StoreMessage> &out) const
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_convs.find(conv_id);
+    if (it == m_convs.end() || !it->second.count || it->second.last.seq < from_seq)
+    {
+        return 0;
+    }
+    const ConvIndex &index = it->second;
+    auto idx = std::lower_bound(index.sparse.begin(), index.sparse.end(), from_seq,
+                                [](const Location &loc, U64_t seq)
+                                { return loc.seq < seq; });
+
+    // 依次以各索引点为锚，向前收集上一个索引点之后的记录
+    std::vector<const StoreRecordHeader *> chunk;
+    U64_t lower = from_seq;
+    size_t got = 0;
+    while (got < limit)
+    {
+        bool is_last = idx == index.sparse.end();
+        const Location &anchor = is_last ? index.last : *idx;
+        chunk.clear();
+        walkBack(anchor, lower, UINT64_MAX, SIZE_MAX, chunk);
+        for (auto rit = chunk.rbegin(); rit != chunk.rend() && got < limit; ++rit, ++got)
+        {
+            out.emplace_back();
+            ToMessage(*rit, out.back());
+        }
+        if (is_last)
+        {
+            break;
+        }
+        lower = anchor.seq + 1;
+        ++idx;
+    }
+    return got;
+}
+
+size_t MessageStore::fetchBefore(U64_t conv_id, U64_t before_seq, size_t limit, std::vector<StoreMessage> &out) const
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_convs.find(conv_id);
+    if (it == m_convs.end() || !it->second.count || !limit)
+    {
+        return 0;
+    }
+    const ConvIndex &index = it->second;
+    auto idx = std::lower_bound(index.sparse.begin(), index.sparse.end(), before_seq,
+                                [](const Location &loc, U64_t seq)
+                                { return loc.seq < seq; });
+    const Location &anchor = idx == index.sparse.end() ? index.last : *idx;
+
+    std::vector<const StoreRecordHeader *> chunk;
+    walkBack(anchor, 0, before_seq, limit, chunk);
+    for (auto rit = chunk.rbegin(); rit != chunk.rend(); ++rit)
+    {
+        out.emplace_back();
+        ToMessage(*rit, out.back());
+    }
+    return chunk.size();
+}
+
+U64_t MessageStore::getLastSeq(U64_t conv_id) const
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_convs.find(conv_id);
+    return it == m_convs.end() ? 0 : it->second.last.seq;
+}
+
+size_t MessageStore::compact()
+{
+    if (!m_options.ttl_sec)
+    {
+        return 0;
+    }
+    U64_t now = Clock::WallMs();
+    U64_t ttl_ms = m_options.ttl_sec * 1000;
+    U64_t deadline = now > ttl_ms ? now - ttl_ms : 0;
+
+    std::vector<Segment::ptr> expired;
+    {
+        MutexType::Lock writer_lock(m_writer_mutex);
+        RWMutexType::WriteLock lock(m_mutex);
+        // 分段按时间递增，只删除最旧的连续若干段，当前写入的分段不删除
+        for (auto it = m_segments.begin(); it != m_segments.end();)
+        {
+            Segment::ptr &seg = it->second;
+            if (seg == m_active || seg->max_timestamp >= deadline)
+            {
+                break;
+            }
+            seg->removed = true;
+            expired.push_back(seg);
+            it = m_segments.erase(it);
+        }
+        if (expired.empty())
+        {
+            return 0;
+        }
+
+        U32_t min_live = m_segments.begin()->first;
+        for (auto it = m_convs.begin(); it != m_convs.end();)
+        {
+            ConvIndex &index = it->second;
+            if (index.last.segment < min_live)
+            {
+                // 记录全部过期时保留最后的序号，新消息的序号不会从头开始
+                index.count = 0;
+                std::vector<Location>().swap(index.sparse);
+                ++it;
+                continue;
+            }
+            auto keep = std::find_if(index.sparse.begin(), index.sparse.end(), [min_live](const Location &loc)
+                                     { return loc.segment >= min_live; });
+            index.sparse.erase(index.sparse.begin(), keep);
+            ++it;
+        }
+    }
+    m_expired.fetch_add(expired.size(), std::memory_order_relaxed);
+    LOG_INFO(g_logger) << "message store expired " << expired.size() << " segments";
+    return expired.size();
+}
+
+MessageStoreStats MessageStore::getStats() const
+{
+    MessageStoreStats stats;
+    stats.appends = m_appends.read();
+    stats.rejected = m_rejected.load(std::memory_order_relaxed);
+    stats.batches = m_batches.load(std::memory_order_relaxed);
+    stats.bytes = m_bytes.load(std::memory_order_relaxed);
+    stats.expired_segments = m_expired.load(std::memory_order_relaxed);
+    RWMutexType::ReadLock lock(m_mutex);
+    stats.segments = m_segments.size();
+    stats.conversations = m_convs.size();
+    return stats;
+}
@@ -0,0 +1,286 @@
+/**
+ * @file messageStore.h
+ * @brief 本地消息存储，追加写分段文件及会话稀疏索引
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ostype.h"
+#include "mutex.h"
+#include "thread.h"
+#include "flatHashMap.h"
+#include "bufferPool.h"
+#include "lockFreeQueue.h"
+#include "noncopyble.h"
+
+/// 单条消息的最大长度
+#define STORE_MAX_MESSAGE_SIZE (1024 * 1024)
+/// 记录按8字节对齐，保证mmap中的记录头对齐访问
+#define STORE_RECORD_ALIGN 8
+
+/**
+ * @brief 分段文件中的记录头，后跟消息内容
+ */
+struct StoreRecordHeader
+{
+    U32_t crc;          // CRC32C，覆盖crc之后的头部和消息内容
+    U32_t length;       // 消息内容长度
+    U64_t conv_id;      // 会话id
+    U64_t seq;          // 会话内序号，严格递增
+    U64_t timestamp;    // 写入时间(ms)
+    U32_t prev_segment; // 同一会话上一条记录所在分段，0表示没有
+    U32_t prev_offset;  // 同一会话上一条记录在分段中的偏移
+};
+
+/**
+ * @brief 消息存储配置
+ */
+struct MessageStoreOptions
+{
+    std::string dir;                             // 分段文件目录
+    U64_t segment_size = 64 * 1024 * 1024;       // 单个分段的大小
+    U32_t index_interval = 16;                   // 每个会话每隔多少条记录一个索引点
+    U64_t ttl_sec = 7 * 24 * 3600;               // 消息保留时间，0表示永久保留
+    U32_t compact_interval_sec = 60;             // 后台过期检查间隔
+    bool sync = false;                           // 每批写入后是否fdatasync
+    U64_t max_pending_bytes = 64 * 1024 * 1024;  // 未落盘数据上限，超过时append阻塞
+};
+
+/**
+ * @brief 读取到的消息
+ */
+struct StoreMessage
+{
+    U64_t conv_id = 0;
+    U64_t seq = 0;
+    U64_t timestamp = 0;
+    BufferSlice payload;
+};
+
+/**
+ * @brief 消息存储运行统计
+ */
+struct MessageStoreStats
+{
+    uint64_t appends = 0;          // 写入的消息数
+    uint64_t rejected = 0;         // 序号不递增被丢弃的消息数
+    uint64_t batches = 0;          // 组提交的批次数
+    uint64_t bytes = 0;            // 写入的字节数
+    uint64_t segments = 0;         // 当前分段数
+    uint64_t conversations = 0;    // 会话数，含记录已全部过期的会话
+    uint64_t expired_segments = 0; // 过期删除的分段数
+};
+
+/**
+ * @brief 追加写的消息存储
+ * @details 消息按到达顺序追加到分段文件(<dir>/<id>.seg)，分段预先扩展到segment_size并整体只读mmap，
+ *          历史读取直接访问映射内存，不经过read系统调用。
+ *          append()只把记录序列化到待写缓冲区，由写线程组提交：一次pwrite写入一批记录，
+ *          可选一次fdatasync，然后更新索引并唤醒waitCommitted()的调用方。
+ *          每条记录保存同一会话上一条记录的位置，会话索引只记录每index_interval条一个索引点和最后一条的位置，
+ *          读取时从索引点沿链表向前遍历，单次读取最多多访问index_interval条记录。
+ *          后台按TTL整段删除过期分段，并清理指向已删除分段的索引。
+ *          打开时逐段扫描并校验记录重建索引，最后一段从第一条校验失败的位置继续写入。
+ *          写入分段失败后存储进入失败状态(与WriteAheadLog相同，不可恢复)：已写入的记录照常建立索引，
+ *          之后的提交号全部视为失败，append()返回0，需要重新打开存储。
+ */
+class MessageStore : Noncopyble
+{
+public:
+    typedef std::shared_ptr<MessageStore> ptr;
+    typedef Mutex MutexType;
+    typedef RWMutex RWMutexType;
+
+    explicit MessageStore(const MessageStoreOptions &options);
+    ~MessageStore();
+
+    /**
+     * @brief 恢复已有分段并启动写线程
+     */
+    bool open();
+
+    /**
+     * @brief 写入所有待写数据后停止写线程
+     */
+    void close();
+
+    /**
+     * @brief 追加一条消息
+     * @param[in] conv_id 会话id
+     * @param[in] seq 会话内序号，必须大于该会话已追加的序号，否则返回0
+     * @param[in] data 消息内容
+     * @param[in] len 消息长度
+     * @param[in] timestamp 时间(ms)，0表示当前时间
+     * @return 提交号，用于waitCommitted()，序号不递增、存储已停止或已失败返回0
+     */
+    U64_t append(U64_t conv_id, U64_t seq, const void *data, size_t len, U64_t timestamp = 0);
+
+    /**
+     * @brief 等待提交号之前的消息全部处理完
+     * @return 超时或该消息写入失败时返回false
+     */
+    bool waitCommitted(U64_t ticket, int timeout_ms = -1);
+
+    /**
+     * @brief 等待已提交的所有消息写入
+     */
+    void flush();
+
+    /**
+     * @brief 读取序号不小于from_seq的消息，按序号升序
+     * @return 读取到的条数
+     */
+    size_t fetch(U64_t conv_id, U64_t from_seq, size_t limit, std::vector<StoreMessage> &out) const;
+
+    /**
+     * @brief 读取序号小于before_seq的最近limit条消息，按序号升序，用于向上翻历史
+     * @return 读取到的条数
+     */
+    size_t fetchBefore(U64_t conv_id, U64_t before_seq, size_t limit, std::vector<StoreMessage> &out) const;
+
+    /**
+     * @brief 会话已写入的最大序号，会话不存在返回0
+     */
+    U64_t getLastSeq(U64_t conv_id) const;
+
+    /**
+     * @brief 删除所有消息都已过期的分段
+     * @return 删除的分段数
+     */
+    size_t compact();
+
+    /**
+     * @brief 写入分段失败后为true
+     */
+    bool isFailed() const { return m_failed.load(std::memory_order_acquire); }
+
+    MessageStoreStats getStats() const;
+
+    const MessageStoreOptions &getOptions() const { return m_options; }
+
+private:
+    /**
+     * @brief 记录位置
+     */
+    struct Location
+    {
+        U64_t seq = 0;
+        U32_t segment = 0;
+        U32_t offset = 0;
+    };
+
+    /**
+     * @brief 会话索引
+     */
+    struct ConvIndex
+    {
+        std::vector<Location> sparse; // 索引点，按序号升序
+        Location last;                // 最后一条记录，记录全部过期后仍保留其序号
+        U64_t count = 0;              // 写入的记录数，记录全部过期后清零
+    };
+
+    /**
+     * @brief 分段文件
+     */
+    struct Segment
+    {
+        typedef std::shared_ptr<Segment> ptr;
+
+        ~Segment();
+
+        U32_t id = 0;
+        int fd = -1;
+        char *map = nullptr;
+        U64_t capacity = 0;      // 文件及映射大小
+        U64_t size = 0;          // 已写入的字节数
+        U64_t max_timestamp = 0; // 最新记录的时间
+        std::string path;
+        bool removed = false; // 析构时删除文件
+    };
+
+    std::string segmentPath(U32_t id) const;
+    Segment::ptr openSegment(U32_t id, bool create);
+
+    /**
+     * @brief 返回位置上的记录，分段不存在返回nullptr，调用方持有读锁
+     */
+    const StoreRecordHeader *recordAt(U32_t segment, U32_t offset) const;
+
+    /**
+     * @brief 扫描分段重建索引，返回有效数据的长度
+     */
+    U64_t recoverSegment(Segment &segment);
+
+    /**
+     * @brief 把记录加入会话索引
+     */
+    void indexRecord(ConvIndex &index, const Location &loc);
+
+    /**
+     * @brief 从anchor沿链表向前收集序号在[lower, upper)的记录，最多limit条，结果为降序
+     */
+    void walkBack(Location anchor, U64_t lower, U64_t upper, size_t limit, std::vector<const StoreRecordHeader *> &out) const;
+
+    static void ToMessage(const StoreRecordHeader *rec, StoreMessage &msg);
+
+    void run();
+
+    /**
+     * @brief 写入一批待写记录，first_ticket为第一条记录的提交号
+     * @param[out] failed_ticket 写入失败时第一条未写入记录的提交号，之前的记录已写入并建立索引
+     * @return 写入失败返回false
+     */
+    bool commitBatch(std::string &batch, U64_t first_ticket, U64_t &failed_ticket);
+
+    /**
+     * @brief 把data写入当前分段末尾，调用方保证空间足够
+     */
+    bool writeActive(const char *data, size_t len);
+
+    /**
+     * @brief 切换到新分段
+     */
+    bool rollSegment();
+
+private:
+    MessageStoreOptions m_options;
+
+    // 待写缓冲区
+    MutexType m_pending_mutex;
+    std::string m_pending;
+    // append()时校验序号递增：待写缓冲区和正在写入的批次中各会话的最大序号，之前的由索引给出
+    FlatHashMap<U64_t, U64_t> m_pending_seqs;
+    FlatHashMap<U64_t, U64_t> m_inflight_seqs;
+    U64_t m_next_ticket = 0;
+    std::atomic<U64_t> m_pending_bytes{0};
+    FutexWaiter m_pending_waiter;
+
+    // 已提交
+    std::atomic<U64_t> m_committed{0};
+    FutexWaiter m_commit_waiter;
+    std::atomic<bool> m_failed{false};
+    std::atomic<U64_t> m_failed_ticket{UINT64_MAX}; // 不小于该值的提交号都写入失败
+
+    // 分段和索引，写线程修改时持有写锁
+    mutable RWMutexType m_mutex;
+    std::map<U32_t, Segment::ptr> m_segments;
+    FlatHashMap<U64_t, ConvIndex> m_convs;
+    Segment::ptr m_active; // 当前写入的分段，只由写线程访问
+    MutexType m_writer_mutex; // 组提交与过期清理互斥，组提交时不加读锁访问索引
+
+    Thread::ptr m_thread;
+    std::atomic<bool> m_stopping{true}; // 未打开或正在关闭，append()在待写锁内检查
+    U64_t m_last_compact = 0;
+
+    PerCpuCounter m_appends;
+    std::atomic<uint64_t> m_rejected{0};
+    std::atomic<uint64_t> m_batches{0};
+    std::atomic<uint64_t> m_bytes{0};
+    std::atomic<uint64_t> m_expired{0};
+};
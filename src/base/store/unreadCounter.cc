@@ -0,0 +1,526 @@
+#include <algorithm>
+#include "unreadCounter.h"
+
+static std::atomic<U64_t> s_unread_ids{0};
+
+/**
+ * @brief 线程持有的增量缓冲，线程退出时归还
+ */
+struct LocalUnreadDelta
+{
+    U64_t owner = 0;
+    std::shared_ptr<UnreadCounter::ThreadDelta> rec;
+
+    void release()
+    {
+        if (rec)
+        {
+            rec->in_use.store(false, std::memory_order_release);
+            rec.reset();
+        }
+        owner = 0;
+    }
+
+    ~LocalUnreadDelta()
+    {
+        release();
+    }
+};
+
+static thread_local LocalUnreadDelta t_unread;
+
+UnreadCounter::UnreadCounter(const UnreadOptions &options)
+    : m_options(options),
+      m_id(++s_unread_ids)
+{
+    m_options.flush_entries = std::max<U32_t>(m_options.flush_entries, 1);
+    m_options.flush_interval_ms = std::max<U32_t>(m_options.flush_interval_ms, 1);
+}
+
+UnreadCounter::~UnreadCounter()
+{
+    stop();
+}
+
+void UnreadCounter::start()
+{
+    if (m_thread)
+    {
+        return;
+    }
+    m_stopping = false;
+    m_thread = std::make_shared<Thread>([this]()
+                                        { run(); },
+                                        "unread");
+}
+
+void UnreadCounter::stop()
+{
+    if (!m_thread)
+    {
+        return;
+    }
+    m_stopping = true;
+    m_waiter.notify();
+    m_thread->join();
+    m_thread.reset();
+    flush();
+}
+
+void UnreadCounter::run()
+{
+    while (!m_stopping.load(std::memory_order_relaxed))
+    {
+        m_waiter.wait([this]()
+                      { return m_stopping.load(std::memory_order_relaxed); },
+                      m_options.flush_interval_ms);
+        flush();
+    }
+}
+
+UnreadCounter::ThreadDelta *UnreadCounter::local()
+{
+    if (t_unread.owner == m_id)
+    {
+        return t_unread.rec.get();
+    }
+    t_unread.release();
+
+    MutexType::Lock lock(m_deltas_mutex);
+    // 优先复用已退出线程的缓冲，其中未合并的增量继续保留
+    for (auto &rec : m_deltas)
+    {
+        bool expected = false;
+        if (!rec->in_use.load(std::memory_order_relaxed) &&
+            rec->in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+        {
+            t_unread.owner = m_id;
+            t_unread.rec = rec;
+            return rec.get();
+        }
+    }
+    auto rec = std::make_shared<ThreadDelta>();
+    rec->in_use.store(true, std::memory_order_relaxed);
+    rec->next = m_delta_head.load(std::memory_order_relaxed);
+    m_deltas.push_back(rec);
+    m_delta_head.store(rec.get(), std::memory_order_release);
+    t_unread.owner = m_id;
+    t_unread.rec = rec;
+    return rec.get();
+}
+
+void UnreadCounter::add(U64_t user_id, U64_t conv_id, int32_t delta)
+{
+    if (!delta)
+    {
+        return;
+    }
+    ThreadDelta *rec = local();
+    m_adds.add();
+    {
+        DeltaSlot &slot = rec->slots[ShardOf(user_id)];
+        MutexType::Lock lock(slot.mutex);
+        UnreadKey key{user_id, conv_id};
+        auto it = slot.users.find(key);
+        if (it != slot.users.end())
+        {
+            it->second += delta;
+            return;
+        }
+        slot.users[key] = delta;
+    }
+    if (rec->keys.fetch_add(1, std::memory_order_relaxed) + 1 >= m_options.flush_entries)
+    {
+        for (size_t s = 0; s < UNREAD_SHARD_COUNT; ++s)
+        {
+            flushShard(s, rec);
+        }
+    }
+}
+
+void UnreadCounter::addGroup(U64_t conv_id, int32_t delta, U64_t sender)
+{
+    if (delta)
+    {
+        ThreadDelta *rec = local();
+        m_group_adds.add();
+        DeltaSlot &slot = rec->slots[ShardOf(conv_id)];
+        MutexType::Lock lock(slot.mutex);
+        auto it = slot.groups.find(conv_id);
+        if (it != slot.groups.end())
+        {
+            it->second += delta;
+        }
+        else
+        {
+            slot.groups[conv_id] = delta;
+            // 群增量的键数很少，不触发写入线程合并
+        }
+    }
+    if (sender)
+    {
+        markRead(sender, conv_id);
+    }
+}
+
+int64_t UnreadCounter::pendingLocked(size_t s, const UnreadKey &key) const
+{
+    int64_t pending = 0;
+    for (ThreadDelta *rec = m_delta_head.load(std::memory_order_acquire); rec; rec = rec->next)
+    {
+        DeltaSlot &slot = rec->slots[s];
+        MutexType::Lock lock(slot.mutex);
+        if (slot.users.empty())
+        {
+            continue;
+        }
+        auto it = slot.users.find(key);
+        if (it != slot.users.end())
+        {
+            pending += it->second;
+        }
+    }
+    return pending;
+}
+
+U64_t UnreadCounter::groupTotalLocked(size_t s, U64_t conv_id) const
+{
+    const GroupShard &shard = m_groups[s];
+    auto it = shard.totals.find(conv_id);
+    int64_t total = it != shard.totals.end() ? (int64_t)it->second : 0;
+    for (ThreadDelta *rec = m_delta_head.load(std::memory_order_acquire); rec; rec = rec->next)
+    {
+        DeltaSlot &slot = rec->slots[s];
+        MutexType::Lock lock(slot.mutex);
+        if (slot.groups.empty())
+        {
+            continue;
+        }
+        auto git = slot.groups.find(conv_id);
+        if (git != slot.groups.end())
+        {
+            total += git->second;
+        }
+    }
+    return total > 0 ? total : 0;
+}
+
+UnreadCounter::Entry *UnreadCounter::FindEntry(EntryList &list, U64_t conv_id)
+{
+    auto it = std::lower_bound(list.begin(), list.end(), conv_id, [](const Entry &e, U64_t id)
+                               { return e.conv_id < id; });
+    return it != list.end() && it->conv_id == conv_id ? &*it : nullptr;
+}
+
+void UnreadCounter::applyLocked(UserShard &shard, U64_t user_id, U64_t conv_id, int64_t delta)
+{
+    EntryList &list = shard.users[user_id];
+    auto it = std::lower_bound(list.begin(), list.end(), conv_id, [](const Entry &e, U64_t id)
+                               { return e.conv_id < id; });
+    if (it != list.end() && it->conv_id == conv_id)
+    {
+        it->count += delta;
+        if (it->count || it->group)
+        {
+            return;
+        }
+        // 单聊未读数回到0时删除条目，用户数组只保留有计数的会话
+        list.erase(it);
+        --shard.entries;
+    }
+    else if (delta)
+    {
+        Entry entry;
+        entry.conv_id = conv_id;
+        entry.count = delta;
+        list.insert(it, entry);
+        ++shard.entries;
+    }
+    if (list.empty())
+    {
+        shard.users.erase(user_id);
+    }
+}
+
+void UnreadCounter::flushShard(size_t s, ThreadDelta *only)
+{
+    size_t applied = 0;
+    {
+        UserShard &shard = m_users[s];
+        MutexType::Lock lock(shard.mutex);
+        for (ThreadDelta *rec = m_delta_head.load(std::memory_order_acquire); rec; rec = rec->next)
+        {
+            if (only && rec != only)
+            {
+                continue;
+            }
+            DeltaSlot &slot = rec->slots[s];
+            MutexType::Lock slot_lock(slot.mutex);
+            if (slot.users.empty())
+            {
+                continue;
+            }
+            for (auto &i : slot.users)
+            {
+                applyLocked(shard, i.first.user_id, i.first.conv_id, i.second);
+            }
+            applied += slot.users.size();
+            rec->keys.fetch_sub(slot.users.size(), std::memory_order_relaxed);
+            slot.users.clear();
+        }
+    }
+    {
+        GroupShard &shard = m_groups[s];
+        MutexType::Lock lock(shard.mutex);
+        for (ThreadDelta *rec = m_delta_head.load(std::memory_order_acquire); rec; rec = rec->next)
+        {
+            if (only && rec != only)
+            {
+                continue;
+            }
+            DeltaSlot &slot = rec->slots[s];
+            MutexType::Lock slot_lock(slot.mutex);
+            if (slot.groups.empty())
+            {
+                continue;
+            }
+            for (auto &i : slot.groups)
+            {
+                U64_t &total = shard.totals[i.first];
+                total = (int64_t)total + i.second > 0 ? total + i.second : 0;
+            }
+            applied += slot.groups.size();
+            slot.groups.clear();
+        }
+    }
+    if (applied)
+    {
+        m_applied.add(applied);
+    }
+}
+
+void UnreadCounter::flush()
+{
+    for (size_t s = 0; s < UNREAD_SHARD_COUNT; ++s)
+    {
+        flushShard(s);
+    }
+    m_flushes.add();
+}
+
+void UnreadCounter::joinGroup(U64_t user_id, U64_t conv_id)
+{
+    size_t s = ShardOf(user_id);
+    UserShard &shard = m_users[s];
+    MutexType::Lock lock(shard.mutex);
+    U64_t total;
+    {
+        size_t gs = ShardOf(conv_id);
+        MutexType::Lock group_lock(m_groups[gs].mutex);
+        total = groupTotalLocked(gs, conv_id);
+    }
+    UnreadKey key{user_id, conv_id};
+    int64_t pending = pendingLocked(s, key);
+    EntryList &list = shard.users[user_id];
+    Entry *entry = FindEntry(list, conv_id);
+    if (!entry)
+    {
+        Entry e;
+        e.conv_id = conv_id;
+        auto it = std::lower_bound(list.begin(), list.end(), conv_id, [](const Entry &e, U64_t id)
+                                   { return e.conv_id < id; });
+        entry = &*list.insert(it, e);
+        ++shard.entries;
+    }
+    entry->group = true;
+    entry->mark = total;
+    // 抵消尚未合并的增量，合并后计数为0
+    entry->count = -pending;
+}
+
+void UnreadCounter::markRead(U64_t user_id, U64_t conv_id)
+{
+    size_t s = ShardOf(user_id);
+    UserShard &shard = m_users[s];
+    MutexType::Lock lock(shard.mutex);
+    UnreadKey key{user_id, conv_id};
+    int64_t pending = pendingLocked(s, key);
+    auto it = shard.users.find(user_id);
+    Entry *entry = it != shard.users.end() ? FindEntry(it->second, conv_id) : nullptr;
+    if (entry && entry->group)
+    {
+        size_t gs = ShardOf(conv_id);
+        MutexType::Lock group_lock(m_groups[gs].mutex);
+        entry->mark = groupTotalLocked(gs, conv_id);
+        entry->count = -pending;
+        return;
+    }
+    if (entry || pending)
+    {
+        applyLocked(shard, user_id, conv_id, -(int64_t)(entry ? entry->count : 0) - pending);
+    }
+}
+
+void UnreadCounter::remove(U64_t user_id, U64_t conv_id)
+{
+    size_t s = ShardOf(user_id);
+    UserShard &shard = m_users[s];
+    MutexType::Lock lock(shard.mutex);
+    UnreadKey key{user_id, conv_id};
+    for (ThreadDelta *rec = m_delta_head.load(std::memory_order_acquire); rec; rec = rec->next)
+    {
+        DeltaSlot &slot = rec->slots[s];
+        MutexType::Lock slot_lock(slot.mutex);
+        if (slot.users.erase(key))
+        {
+            rec->keys.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+    auto it = shard.users.find(user_id);
+    if (it == shard.users.end())
+    {
+        return;
+    }
+    EntryList &list = it->second;
+    Entry *entry = FindEntry(list, conv_id);
+    if (!entry)
+    {
+        return;
+    }
+    list.erase(list.begin() + (entry - list.data()));
+    --shard.entries;
+    if (list.empty())
+    {
+        shard.users.erase(it);
+    }
+}
+
+U32_t UnreadCounter::get(U64_t user_id, U64_t conv_id)
+{
+    size_t s = ShardOf(user_id);
+    UserShard &shard = m_users[s];
+    MutexType::Lock lock(shard.mutex);
+    int64_t count = pendingLocked(s, UnreadKey{user_id, conv_id});
+    auto it = shard.users.find(user_id);
+    Entry *entry = it != shard.users.end() ? FindEntry(it->second, conv_id) : nullptr;
+    if (entry)
+    {
+        count += entry->count;
+        if (entry->group)
+        {
+            size_t gs = ShardOf(conv_id);
+            MutexType::Lock group_lock(m_groups[gs].mutex);
+            count += (int64_t)groupTotalLocked(gs, conv_id) - (int64_t)entry->mark;
+        }
+    }
+    return count > 0 ? (U32_t)std::min<int64_t>(count, UINT32_MAX) : 0;
+}
+
+U64_t UnreadCounter::getAll(U64_t user_id, std::vector<UnreadCount> &out)
+{
+    out.clear();
+    size_t s = ShardOf(user_id);
+    UserShard &shard = m_users[s];
+    MutexType::Lock lock(shard.mutex);
+
+    // 未合并的增量按会话汇总，缓冲中每个分片的键数有上限，逐个扫描
+    std::vector<std::pair<U64_t, int64_t>> pending;
+    for (ThreadDelta *rec = m_delta_head.load(std::memory_order_acquire); rec; rec = rec->next)
+    {
+        DeltaSlot &slot = rec->slots[s];
+        MutexType::Lock slot_lock(slot.mutex);
+        for (auto &i : slot.users)
+        {
+            if (i.first.user_id == user_id)
+            {
+                pending.emplace_back(i.first.conv_id, i.second);
+            }
+        }
+    }
+    std::sort(pending.begin(), pending.end());
+    size_t n = 0;
+    for (size_t i = 0; i < pending.size(); ++i)
+    {
+        if (n && pending[n - 1].first == pending[i].first)
+        {
+            pending[n - 1].second += pending[i].second;
+        }
+        else
+        {
+            pending[n++] = pending[i];
+        }
+    }
+    pending.resize(n);
+
+    static const EntryList s_empty;
+    auto it = shard.users.find(user_id);
+    const EntryList &list = it != shard.users.end() ? it->second : s_empty;
+    U64_t total = 0;
+    auto emit = [&out, &total](U64_t conv_id, int64_t count)
+    {
+        if (count > 0)
+        {
+            UnreadCount uc;
+            uc.conv_id = conv_id;
+            uc.count = (U32_t)std::min<int64_t>(count, UINT32_MAX);
+            out.push_back(uc);
+            total += uc.count;
+        }
+    };
+    // 条目和增量都按会话id有序，归并
+    size_t p = 0;
+    for (const Entry &entry : list)
+    {
+        for (; p < pending.size() && pending[p].first < entry.conv_id; ++p)
+        {
+            emit(pending[p].first, pending[p].second);
+        }
+        int64_t count = entry.count;
+        if (p < pending.size() && pending[p].first == entry.conv_id)
+        {
+            count += pending[p++].second;
+        }
+        if (entry.group)
+        {
+            size_t gs = ShardOf(entry.conv_id);
+            MutexType::Lock group_lock(m_groups[gs].mutex);
+            count += (int64_t)groupTotalLocked(gs, entry.conv_id) - (int64_t)entry.mark;
+        }
+        emit(entry.conv_id, count);
+    }
+    for (; p < pending.size(); ++p)
+    {
+        emit(pending[p].first, pending[p].second);
+    }
+    return total;
+}
+
+UnreadStats UnreadCounter::getStats() const
+{
+    UnreadStats stats;
+    stats.adds = m_adds.read();
+    stats.group_adds = m_group_adds.read();
+    stats.applied = m_applied.read();
+    stats.flushes = m_flushes.read();
+    for (size_t s = 0; s < UNREAD_SHARD_COUNT; ++s)
+    {
+        {
+            const UserShard &shard = m_users[s];
+            MutexType::Lock lock(shard.mutex);
+            stats.users += shard.users.size();
+            stats.entries += shard.entries;
+            stats.memory += shard.users.memoryUsage();
+            for (auto &i : shard.users)
+            {
+                stats.memory += i.second.capacity() * sizeof(Entry);
+            }
+        }
+        {
+            const GroupShard &shard = m_groups[s];
+            MutexType::Lock lock(shard.mutex);
+            stats.groups += shard.totals.size();
+            stats.memory += shard.totals.memoryUsage();
+        }
+    }
+    return stats;
+}
@@ -0,0 +1,248 @@
+/**
+ * @file unreadCounter.h
+ * @brief 批量聚合的未读计数
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "ostype.h"
+#include "mutex.h"
+#include "thread.h"
+#include "flatHashMap.h"
+#include "lockFreeQueue.h"
+#include "singleton.h"
+#include "noncopyble.h"
+
+/// 用户和群会话分片数，必须是2的幂
+#define UNREAD_SHARD_COUNT 64
+
+/**
+ * @brief 未读计数配置
+ */
+struct UnreadOptions
+{
+    U32_t flush_entries = 4096;   // 线程缓冲的不同键数达到该值时由写入线程立即合并
+    U32_t flush_interval_ms = 50; // 后台合并所有线程缓冲的间隔
+};
+
+/**
+ * @brief 一个会话的未读数
+ */
+struct UnreadCount
+{
+    U64_t conv_id = 0;
+    U32_t count = 0;
+};
+
+/**
+ * @brief 未读计数运行统计
+ */
+struct UnreadStats
+{
+    uint64_t adds = 0;        // 单聊计数增量次数
+    uint64_t group_adds = 0;  // 群消息计数次数，每条群消息只计一次
+    uint64_t applied = 0;     // 合并到基础值的增量条目数，与adds + group_adds之比即缓冲的聚合效果
+    uint64_t flushes = 0;     // 合并次数
+    uint64_t users = 0;       // 有计数的用户数
+    uint64_t entries = 0;     // (用户, 会话)条目数
+    uint64_t groups = 0;      // 有消息计数的群会话数
+    uint64_t memory = 0;      // 基础值占用的内存
+};
+
+/**
+ * @brief (用户, 会话)键
+ */
+struct UnreadKey
+{
+    U64_t user_id;
+    U64_t conv_id;
+
+    bool operator==(const UnreadKey &other) const { return user_id == other.user_id && conv_id == other.conv_id; }
+};
+
+struct UnreadKeyHash
+{
+    size_t operator()(const UnreadKey &key) const { return key.user_id * 0x9E3779B97F4A7C15ULL ^ key.conv_id; }
+};
+
+/**
+ * @brief 未读计数服务
+ * @details 基础值按用户分片，每个用户一个按会话id排序的紧凑数组(每个会话24字节)，
+ *          会话列表一次取出一个用户的全部计数。
+ *          写入不直接修改基础值：每个线程有自己的增量缓冲，同一(用户, 会话)的多次增量在缓冲中合并，
+ *          后台线程每flush_interval_ms、或缓冲中的键数达到flush_entries时，按分片批量合并到基础值，
+ *          每个分片加锁一次。读取在用户分片锁内合并基础值和所有线程缓冲中尚未合并的增量，结果总是最新的。
+ *          群消息不为每个成员写计数：群会话只维护一个消息总数，成员条目记录上次已读时的总数，
+ *          未读数 = 条目计数 + 群总数 - 已读时的总数，一条群消息只产生一次群总数的增量。
+ *          成员入群时调用joinGroup()建立条目，之前的群消息不计入未读。
+ *          锁顺序：用户分片 -> 群分片 -> 线程缓冲分片，合并时不会反向加锁。
+ */
+class UnreadCounter : Noncopyble
+{
+public:
+    typedef Mutex MutexType;
+
+    explicit UnreadCounter(const UnreadOptions &options = UnreadOptions());
+    ~UnreadCounter();
+
+    /**
+     * @brief 启动后台合并线程
+     */
+    void start();
+
+    /**
+     * @brief 停止后台线程并合并剩余的增量
+     */
+    void stop();
+
+    /**
+     * @brief 单聊或系统会话的未读数增加delta，可以为负
+     */
+    void add(U64_t user_id, U64_t conv_id, int32_t delta = 1);
+
+    /**
+     * @brief 群会话收到消息，所有成员的未读数增加delta
+     * @param[in] sender 发送者，发送消息视为已读，传0不处理
+     */
+    void addGroup(U64_t conv_id, int32_t delta = 1, U64_t sender = 0);
+
+    /**
+     * @brief 成员入群，从当前群消息总数开始计数
+     */
+    void joinGroup(U64_t user_id, U64_t conv_id);
+
+    /**
+     * @brief 会话已读，未读数清零
+     */
+    void markRead(U64_t user_id, U64_t conv_id);
+
+    /**
+     * @brief 删除条目，退群或删除会话时调用
+     */
+    void remove(U64_t user_id, U64_t conv_id);
+
+    /**
+     * @brief 一个会话的未读数
+     */
+    U32_t get(U64_t user_id, U64_t conv_id);
+
+    /**
+     * @brief 用户所有未读数大于0的会话，按会话id排序
+     * @return 未读总数
+     */
+    U64_t getAll(U64_t user_id, std::vector<UnreadCount> &out);
+
+    /**
+     * @brief 把所有线程缓冲合并到基础值
+     */
+    void flush();
+
+    UnreadStats getStats() const;
+
+private:
+    /**
+     * @brief 用户的一个会话条目
+     */
+    struct Entry
+    {
+        U64_t conv_id = 0;
+        U64_t mark = 0;    // 群会话：上次已读时的群消息总数
+        int32_t count = 0; // 单聊未读数，群会话为附加的调整量
+        bool group = false;
+    };
+
+    typedef std::vector<Entry> EntryList;
+
+    struct alignas(64) UserShard
+    {
+        mutable MutexType mutex;
+        FlatHashMap<U64_t, EntryList> users;
+        size_t entries = 0;
+    };
+
+    struct alignas(64) GroupShard
+    {
+        mutable MutexType mutex;
+        FlatHashMap<U64_t, U64_t> totals;
+    };
+
+    /**
+     * @brief 线程增量缓冲的一个分片，与基础值分片一一对应
+     */
+    struct alignas(64) DeltaSlot
+    {
+        MutexType mutex;
+        FlatHashMap<UnreadKey, int64_t, UnreadKeyHash> users;
+        FlatHashMap<U64_t, int64_t> groups;
+    };
+
+    /**
+     * @brief 一个线程的增量缓冲，线程退出后由下一个线程复用，未合并的增量仍由后台线程合并
+     */
+    struct ThreadDelta
+    {
+        DeltaSlot slots[UNREAD_SHARD_COUNT];
+        std::atomic<U32_t> keys{0};
+        std::atomic<bool> in_use{false};
+        ThreadDelta *next = nullptr; // 只增不删的链表，读取时无锁遍历
+    };
+
+    friend struct LocalUnreadDelta;
+
+    static size_t ShardOf(U64_t id) { return ((id * 0x9E3779B97F4A7C15ULL) >> 40) & (UNREAD_SHARD_COUNT - 1); }
+
+    /**
+     * @brief 当前线程的增量缓冲
+     */
+    ThreadDelta *local();
+
+    /**
+     * @brief 合并分片s的增量
+     * @param[in] only 只合并这个线程的缓冲，为nullptr时合并所有线程
+     */
+    void flushShard(size_t s, ThreadDelta *only = nullptr);
+
+    /**
+     * @brief 合并一个增量到用户条目，调用方持有用户分片锁
+     */
+    void applyLocked(UserShard &shard, U64_t user_id, U64_t conv_id, int64_t delta);
+
+    /**
+     * @brief 群消息总数(含未合并的增量)，调用方持有群分片锁
+     */
+    U64_t groupTotalLocked(size_t s, U64_t conv_id) const;
+
+    /**
+     * @brief 用户条目未合并的增量，调用方持有用户分片锁
+     */
+    int64_t pendingLocked(size_t s, const UnreadKey &key) const;
+
+    static Entry *FindEntry(EntryList &list, U64_t conv_id);
+
+    void run();
+
+private:
+    UnreadOptions m_options;
+    U64_t m_id;
+    UserShard m_users[UNREAD_SHARD_COUNT];
+    GroupShard m_groups[UNREAD_SHARD_COUNT];
+
+    std::atomic<ThreadDelta *> m_delta_head{nullptr};
+    MutexType m_deltas_mutex;
+    std::vector<std::shared_ptr<ThreadDelta>> m_deltas; // 持有缓冲的生命周期，线程局部变量也持有一份
+
+    Thread::ptr m_thread;
+    std::atomic<bool> m_stopping{false};
+    FutexWaiter m_waiter;
+
+    PerCpuCounter m_adds;
+    PerCpuCounter m_group_adds;
+    PerCpuCounter m_applied;
+    PerCpuCounter m_flushes;
+};
+
+typedef Singleton<UnreadCounter> UnreadMgr;
@@ -0,0 +1,509 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include "wal.h"
+#include "crc32.h"
+#include "fileUtil.h"
+#include "log.h"
+
+static Logger::ptr g_logger = LOG_NAME("system");
+
+/**
+ * @brief 记录头加内容按WAL_RECORD_ALIGN对齐后的长度
+ */
+static size_t RecordSize(size_t len)
+{
+    return AlignedRecordSize<WalRecordHeader>(len, WAL_RECORD_ALIGN);
+}
+
+/**
+ * @brief 先算记录内容再接上头部，内容部分可以在锁外计算
+ */
+static uint32_t HeaderCrc(const WalRecordHeader *hdr, uint32_t payload_crc)
+{
+    return Crc32c(&hdr->length, sizeof(WalRecordHeader) - sizeof(hdr->crc), payload_crc);
+}
+
+/**
+ * @brief fsync目录，保证新建或删除的文件项落盘
+ */
+static bool SyncDir(const std::string &dir)
+{
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+/**
+ * @brief 列出目录中的日志文件，首条lsn -> 路径
+ */
+static std::map<U64_t, std::string> ListFiles(const std::string &dir)
+{
+    std::map<U64_t, std::string> files;
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+    {
+        return files;
+    }
+    while (dirent *ent = readdir(d))
+    {
+        unsigned long long lsn = 0;
+        char tail[8] = {0};
+        if (sscanf(ent->d_name, "%20llu.%4s", &lsn, tail) == 2 && lsn && strcmp(tail, "wal") == 0)
+        {
+            files[lsn] = dir + "/" + ent->d_name;
+        }
+    }
+    closedir(d);
+    return files;
+}
+
+/**
+ * @brief 逐条校验日志文件
+ * @param[in,out] next_lsn 期望的下一条lsn，校验后为最后一条有效记录的lsn加1
+ * @param[in] cb 对每条有效记录调用，可以为空
+ * @param[out] size 文件大小
+ * @param[out] stopped 回调要求停止
+ * @return 有效数据的长度，打开失败返回-1
+ */
+static int64_t ScanFile(const std::string &path, U64_t &next_lsn, const WriteAheadLog::ReplayCallback &cb,
+                        U64_t &size, bool &stopped)
+{
+    stopped = false;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        LOG_ERROR(g_logger) << "open wal " << path << " failed: " << strerror(errno);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+    size = st.st_size;
+    if (size == 0)
+    {
+        ::close(fd);
+        return 0;
+    }
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        LOG_ERROR(g_logger) << "mmap wal " << path << " failed: " << strerror(errno);
+        return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    const char *base = static_cast<const char *>(map);
+    U64_t offset = 0;
+    while (offset + sizeof(WalRecordHeader) <= size)
+    {
+        const WalRecordHeader *hdr = reinterpret_cast<const WalRecordHeader *>(base + offset);
+        if (hdr->length > WAL_MAX_RECORD_SIZE || offset + RecordSize(hdr->length) > size || hdr->lsn != next_lsn)
+        {
+            break;
+        }
+        const char *payload = reinterpret_cast<const char *>(hdr + 1);
+        if (HeaderCrc(hdr, Crc32c(payload, hdr->length)) != hdr->crc)
+        {
+            break;
+        }
+        offset += RecordSize(hdr->length);
+        ++next_lsn;
+        if (cb && !cb(hdr->lsn, payload, hdr->length))
+        {
+            stopped = true;
+            break;
+        }
+    }
+    munmap(map, size);
+    return offset;
+}
+
+WriteAheadLog::WriteAheadLog(const WalOptions &options)
+    : m_options(options)
+{
+    if (m_options.max_batch_bytes == 0)
+    {
+        m_options.max_batch_bytes = 1;
+    }
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    close();
+}
+
+std::string WriteAheadLog::filePath(U64_t first_lsn) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%020llu.wal", (unsigned long long)first_lsn);
+    return m_options.dir + name;
+}
+
+bool WriteAheadLog::open()
+{
+    if (m_opened)
+    {
+        return true;
+    }
+    if (m_options.dir.empty() || !MakeDirs(m_options.dir))
+    {
+        LOG_ERROR(g_logger) << "wal dir " << m_options.dir << " unavailable";
+        return false;
+    }
+
+    std::map<U64_t, std::string> files = ListFiles(m_options.dir);
+    U64_t next_lsn = files.empty() ? 1 : files.begin()->first;
+    U64_t valid = 0;
+    for (auto it = files.begin(); it != files.end(); ++it)
+    {
+        if (it->first != next_lsn)
+        {
+            LOG_ERROR(g_logger) << "wal " << it->second << " starts at " << it->first
+                                << ", expect " << next_lsn;
+            return false;
+        }
+        U64_t size = 0;
+        bool stopped = false;
+        int64_t len = ScanFile(it->second, next_lsn, nullptr, size, stopped);
+        if (len < 0)
+        {
+            return false;
+        }
+        valid = len;
+        if (valid == size)
+        {
+            continue;
+        }
+        if (std::next(it) != files.end())
+        {
+            LOG_ERROR(g_logger) << "wal " << it->second << " corrupted at offset " << valid;
+            return false;
+        }
+        // 只有最后一个文件的尾部允许残缺，是崩溃时未完成的一批
+        LOG_WARNING(g_logger) << "wal " << it->second << " truncated from " << size << " to " << valid;
+        if (truncate(it->second.c_str(), valid) != 0)
+        {
+            LOG_ERROR(g_logger) << "truncate wal " << it->second << " failed: " << strerror(errno);
+            return false;
+        }
+    }
+
+    if (!files.empty())
+    {
+        const std::string &path = files.rbegin()->second;
+        m_fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (m_fd < 0)
+        {
+            LOG_ERROR(g_logger) << "open wal " << path << " failed: " << strerror(errno);
+            return false;
+        }
+        m_file_bytes = valid;
+    }
+    {
+        MutexType::Lock lock(m_files_mutex);
+        m_files.swap(files);
+    }
+    {
+        MutexType::Lock lock(m_mutex);
+        m_next_lsn = next_lsn;
+        m_buffer.clear();
+        m_buffer_records = 0;
+    }
+    m_durable = next_lsn - 1;
+    m_failed = false;
+    m_opened = true;
+    LOG_INFO(g_logger) << "wal " << m_options.dir << " opened, files=" << m_files.size()
+                       << " next_lsn=" << next_lsn;
+    return true;
+}
+
+void WriteAheadLog::close()
+{
+    if (!m_opened)
+    {
+        return;
+    }
+    sync();
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_opened = false;
+}
+
+U64_t WriteAheadLog::append(const void *data, size_t len)
+{
+    if (len > WAL_MAX_RECORD_SIZE || m_failed.load(std::memory_order_relaxed))
+    {
+        return 0;
+    }
+    uint32_t payload_crc = Crc32c(data, len);
+    size_t record_size = RecordSize(len);
+    U64_t lsn;
+    size_t pending;
+    {
+        MutexType::Lock lock(m_mutex);
+        lsn = m_next_lsn++;
+        size_t offset = m_buffer.size();
+        m_buffer.resize(offset + record_size);
+        WalRecordHeader *hdr = reinterpret_cast<WalRecordHeader *>(&m_buffer[offset]);
+        hdr->length = len;
+        hdr->lsn = lsn;
+        hdr->crc = HeaderCrc(hdr, payload_crc);
+        memcpy(hdr + 1, data, len);
+        ++m_buffer_records;
+        pending = m_buffer.size();
+        m_pending_bytes.store(pending, std::memory_order_relaxed);
+    }
+    m_appends.fetch_add(1, std::memory_order_relaxed);
+
+    if (pending >= m_options.max_batch_bytes)
+    {
+        // 领导者可能在等待凑批；缓冲区过大时由生产者自己刷盘，限制内存占用
+        m_batch_waiter.notify();
+        if (!sync(lsn))
+        {
+            return 0;
+        }
+    }
+    return lsn;
+}
+
+U64_t WriteAheadLog::getNextLsn() const
+{
+    MutexType::Lock lock(m_mutex);
+    return m_next_lsn;
+}
+
+bool WriteAheadLog::sync(U64_t lsn)
+{
+    U64_t last = getNextLsn() - 1;
+    if (lsn == 0 || lsn > last)
+    {
+        lsn = last;
+    }
+    while (m_durable.load(std::memory_order_acquire) < lsn)
+    {
+        if (m_failed.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        bool expected = false;
+        if (m_leader.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+            bool ok = m_durable.load(std::memory_order_acquire) >= lsn || lead();
+            m_leader.store(false, std::memory_order_release);
+            m_durable_waiter.notifyAll();
+            if (!ok)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            // 领导者写完后，自己的记录仍未落盘则重新竞争领导者
+            m_durable_waiter.wait([this, lsn]()
+                                  { return m_durable.load(std::memory_order_acquire) >= lsn ||
+                                           !m_leader.load(std::memory_order_acquire); });
+        }
+    }
+    return true;
+}
+
+bool WriteAheadLog::lead()
+{
+    if (m_options.max_batch_delay_us &&
+        m_pending_bytes.load(std::memory_order_relaxed) < m_options.max_batch_bytes)
+    {
+        m_batch_waiter.waitUs([this]()
+                              { return m_pending_bytes.load(std::memory_order_relaxed) >= m_options.max_batch_bytes; },
+                              m_options.max_batch_delay_us);
+    }
+
+    U64_t last_lsn;
+    U32_t records;
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_buffer.empty())
+        {
+            return true;
+        }
+        // 交换出整个缓冲区，写盘期间生产者继续写入新的缓冲区
+        m_flushing.swap(m_buffer);
+        last_lsn = m_next_lsn - 1;
+        records = m_buffer_records;
+        m_buffer_records = 0;
+        m_pending_bytes.store(0, std::memory_order_relaxed);
+    }
+
+    bool ok = writeBatch(m_flushing, last_lsn - records + 1);
+    U64_t bytes = m_flushing.size();
+    m_flushing.clear();
+    if (!ok)
+    {
+        m_failed.store(true, std::memory_order_release);
+        return false;
+    }
+    m_batches.fetch_add(1, std::memory_order_relaxed);
+    m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    if (records > m_max_batch.load(std::memory_order_relaxed))
+    {
+        m_max_batch.store(records, std::memory_order_relaxed);
+    }
+    m_durable.store(last_lsn, std::memory_order_release);
+    return true;
+}
+
+bool WriteAheadLog::writeBatch(const std::string &data, U64_t first_lsn)
+{
+    if (m_fd >= 0 && m_file_bytes >= m_options.file_size)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    if (m_fd < 0)
+    {
+        std::string path = filePath(first_lsn);
+        m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+        {
+            LOG_ERROR(g_logger) << "create wal " << path << " failed: " << strerror(errno);
+            return false;
+        }
+        m_file_bytes = 0;
+        if (m_options.sync && !SyncDir(m_options.dir))
+        {
+            LOG_ERROR(g_logger) << "sync wal dir " << m_options.dir << " failed: " << strerror(errno);
+            return false;
+        }
+        MutexType::Lock lock(m_files_mutex);
+        m_files[first_lsn] = path;
+    }
+
+    const char *p = data.data();
+    size_t left = data.size();
+    while (left > 0)
+    {
+        ssize_t n = ::write(m_fd, p, left);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LOG_ERROR(g_logger) << "write wal failed: " << strerror(errno);
+            return false;
+        }
+        p += n;
+        left -= n;
+    }
+    m_file_bytes += data.size();
+    if (m_options.sync && fdatasync(m_fd) != 0)
+    {
+        LOG_ERROR(g_logger) << "fdatasync wal failed: " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+size_t WriteAheadLog::truncateBefore(U64_t lsn)
+{
+    size_t removed = 0;
+    MutexType::Lock lock(m_files_mutex);
+    auto it = m_files.begin();
+    while (it != m_files.end())
+    {
+        // 下一个文件的首条lsn不大于lsn时，本文件的记录全部小于lsn；最后一个文件正在写入，不删除
+        auto next = std::next(it);
+        if (next == m_files.end() || next->first > lsn)
+        {
+            break;
+        }
+        if (unlink(it->second.c_str()) != 0)
+        {
+            LOG_WARNING(g_logger) << "remove wal " << it->second << " failed: " << strerror(errno);
+            break;
+        }
+        it = m_files.erase(it);
+        ++removed;
+    }
+    return removed;
+}
+
+WalStats WriteAheadLog::getStats() const
+{
+    WalStats stats;
+    stats.appends = m_appends.load(std::memory_order_relaxed);
+    stats.batches = m_batches.load(std::memory_order_relaxed);
+    stats.bytes = m_bytes.load(std::memory_order_relaxed);
+    stats.max_batch = m_max_batch.load(std::memory_order_relaxed);
+    stats.durable_lsn = m_durable.load(std::memory_order_acquire);
+    {
+        MutexType::Lock lock(m_files_mutex);
+        stats.files = m_files.size();
+    }
+    return stats;
+}
+
+U64_t WriteAheadLog::Replay(const std::string &dir, U64_t from_lsn, const ReplayCallback &cb)
+{
+    std::map<U64_t, std::string> files = ListFiles(dir);
+    if (files.empty())
+    {
+        return 0;
+    }
+    // 跳过所有记录都小于from_lsn的文件
+    auto it = files.upper_bound(from_lsn);
+    if (it != files.begin())
+    {
+        --it;
+    }
+    U64_t next_lsn = it->first;
+    U64_t last = 0;
+    for (; it != files.end(); ++it)
+    {
+        if (it->first != next_lsn)
+        {
+            LOG_ERROR(g_logger) << "wal " << it->second << " starts at " << it->first << ", expect " << next_lsn;
+            break;
+        }
+        U64_t size = 0;
+        bool stopped = false;
+        int64_t len = ScanFile(it->second, next_lsn, [&](U64_t lsn, const char *data, size_t n)
+                               {
+                                   if (lsn < from_lsn)
+                                   {
+                                       return true;
+                                   }
+                                   last = lsn;
+                                   return cb(lsn, data, n); },
+                               size, stopped);
+        if (len < 0 || stopped)
+        {
+            break;
+        }
+        if ((U64_t)len != size)
+        {
+            LOG_WARNING(g_logger) << "wal " << it->second << " invalid from offset " << len;
+            break;
+        }
+    }
+    return last;
+}
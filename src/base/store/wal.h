@@ -0,0 +1,188 @@
+/**
+ * @file wal.h
+ * @brief 预写日志，多个生产者共享写缓冲区，由一个领导者线程组提交
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include "ostype.h"
+#include "mutex.h"
+#include "lockFreeQueue.h"
+#include "noncopyble.h"
+
+/// 单条记录的最大长度
+#define WAL_MAX_RECORD_SIZE (4 * 1024 * 1024)
+/// 记录按8字节对齐
+#define WAL_RECORD_ALIGN 8
+
+/**
+ * @brief 日志记录头，后跟记录内容
+ */
+struct WalRecordHeader
+{
+    U32_t crc;    // CRC32C，覆盖记录内容和crc之后的头部
+    U32_t length; // 记录内容长度
+    U64_t lsn;    // 日志序号，从1开始连续递增
+};
+
+/**
+ * @brief 预写日志配置
+ */
+struct WalOptions
+{
+    std::string dir;                      // 日志文件目录
+    U64_t file_size = 64 * 1024 * 1024;   // 单个日志文件超过该大小后切换新文件
+    U32_t max_batch_bytes = 256 * 1024;   // 一批的目标大小，待写数据达到该大小时不再等待，超过时append同步刷盘
+    U32_t max_batch_delay_us = 0;         // 领导者凑批的最长等待时间(us)，0表示不等待，只依靠刷盘期间自然积累
+    bool sync = true;                     // 每批写入后是否fdatasync
+};
+
+/**
+ * @brief 预写日志运行统计
+ */
+struct WalStats
+{
+    uint64_t appends = 0;   // 写入的记录数
+    uint64_t batches = 0;   // 写入批次数，即write+fdatasync的次数
+    uint64_t bytes = 0;     // 写入的字节数
+    uint64_t max_batch = 0; // 单批最多的记录数
+    uint64_t files = 0;     // 当前日志文件数
+    U64_t durable_lsn = 0;  // 已落盘的最大日志序号
+};
+
+/**
+ * @brief 预写日志
+ * @details 消息确认前先写入日志，保证确认过的消息在崩溃后可以重放。
+ *          append()在互斥锁内分配连续的lsn并把记录序列化到共享缓冲区，不做IO；
+ *          sync()等待lsn落盘：第一个到达的调用方成为领导者，交换出整个缓冲区，
+ *          一次write加一次fdatasync写入这一批，然后唤醒所有等待者，其余调用方等待领导者完成，
+ *          若领导者写完后自己的记录仍未落盘，再竞争成为下一批的领导者。
+ *          日志文件(<dir>/<首条lsn>.wal)写满file_size后切换，checkpoint之后由truncateBefore()删除旧文件。
+ *          打开时按lsn校验所有文件，最后一个文件从第一条校验失败的位置截断。
+ *          写入失败后日志进入错误状态，之后的append和sync都返回失败，不会确认未落盘的记录。
+ */
+class WriteAheadLog : Noncopyble
+{
+public:
+    typedef std::shared_ptr<WriteAheadLog> ptr;
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 重放回调
+     * @param[in] lsn 日志序号
+     * @param[in] data 记录内容
+     * @param[in] len 记录长度
+     * @return 返回false停止重放
+     */
+    typedef std::function<bool(U64_t lsn, const char *data, size_t len)> ReplayCallback;
+
+    explicit WriteAheadLog(const WalOptions &options);
+    ~WriteAheadLog();
+
+    /**
+     * @brief 校验已有日志文件并截断残缺的尾部
+     */
+    bool open();
+
+    /**
+     * @brief 写入所有待写记录后关闭
+     */
+    void close();
+
+    /**
+     * @brief 追加一条记录，只写入共享缓冲区
+     * @return 日志序号，失败返回0
+     */
+    U64_t append(const void *data, size_t len);
+
+    /**
+     * @brief 等待lsn及之前的记录落盘
+     * @param[in] lsn 日志序号，0表示当前已追加的所有记录
+     * @return 写入失败返回false
+     */
+    bool sync(U64_t lsn = 0);
+
+    /**
+     * @brief 追加一条记录并等待落盘
+     * @return 日志序号，失败返回0
+     */
+    U64_t appendSync(const void *data, size_t len)
+    {
+        U64_t lsn = append(data, len);
+        return lsn && sync(lsn) ? lsn : 0;
+    }
+
+    /**
+     * @brief 删除所有记录都小于lsn的日志文件，lsn之前的数据已经持久化到别处
+     * @return 删除的文件数
+     */
+    size_t truncateBefore(U64_t lsn);
+
+    U64_t getDurableLsn() const { return m_durable.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 下一条记录的lsn
+     */
+    U64_t getNextLsn() const;
+
+    bool isFailed() const { return m_failed.load(std::memory_order_acquire); }
+
+    WalStats getStats() const;
+
+    const WalOptions &getOptions() const { return m_options; }
+
+    /**
+     * @brief 重放目录中lsn不小于from_lsn的记录，只读不修改文件，用于崩溃恢复和离线检查
+     * @return 重放的最后一条lsn，没有记录返回0
+     */
+    static U64_t Replay(const std::string &dir, U64_t from_lsn, const ReplayCallback &cb);
+
+private:
+    /**
+     * @brief 领导者写入一批记录
+     */
+    bool lead();
+
+    /**
+     * @brief 把data写入当前文件，需要时切换文件
+     */
+    bool writeBatch(const std::string &data, U64_t first_lsn);
+
+    std::string filePath(U64_t first_lsn) const;
+
+private:
+    WalOptions m_options;
+
+    // 共享写缓冲区
+    mutable MutexType m_mutex;
+    std::string m_buffer;
+    U64_t m_next_lsn = 1;
+    U32_t m_buffer_records = 0;
+    std::atomic<U64_t> m_pending_bytes{0};
+    FutexWaiter m_batch_waiter;
+
+    // 领导者
+    std::atomic<bool> m_leader{false};
+    std::atomic<U64_t> m_durable{0};
+    std::atomic<bool> m_failed{false};
+    FutexWaiter m_durable_waiter;
+    std::string m_flushing; // 只由领导者访问，交换缓冲区时复用内存
+
+    // 日志文件，fd和当前文件大小只由领导者访问
+    mutable MutexType m_files_mutex;
+    std::map<U64_t, std::string> m_files; // 首条lsn -> 路径
+    int m_fd = -1;
+    U64_t m_file_bytes = 0;
+    bool m_opened = false;
+
+    std::atomic<uint64_t> m_appends{0};
+    std::atomic<uint64_t> m_batches{0};
+    std::atomic<uint64_t> m_bytes{0};
+    std::atomic<uint64_t> m_max_batch{0};
+};
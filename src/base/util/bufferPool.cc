@@ -0,0 +1,347 @@
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <new>
+#include "bufferPool.h"
+
+/// 线程缓存每个分级最多保留的块数，超过时归还一半
+static const uint32_t s_cache_limit[BUFFER_CLASS_COUNT] = {
+    256, 256, 256, 128, 128, 64, 64, 32, 16, 8, 4};
+
+/**
+ * @brief 线程本地的空闲块缓存
+ */
+struct BufferThreadCache
+{
+    BufferPool::FreeNode *head[BUFFER_CLASS_COUNT] = {nullptr};
+    uint32_t count[BUFFER_CLASS_COUNT] = {0};
+    BufferPool *pool = nullptr;
+
+    ~BufferThreadCache()
+    {
+        if (!pool)
+        {
+            return;
+        }
+        for (int i = 0; i < BUFFER_CLASS_COUNT; ++i)
+        {
+            flush(i, count[i]);
+        }
+    }
+
+    /**
+     * @brief 把链表头部的n个块归还全局链表
+     */
+    void flush(int cls, uint32_t n)
+    {
+        if (n == 0 || !head[cls])
+        {
+            return;
+        }
+        BufferPool::FreeNode *first = head[cls];
+        BufferPool::FreeNode *last = first;
+        for (uint32_t i = 1; i < n; ++i)
+        {
+            last = last->next;
+        }
+        head[cls] = last->next;
+        count[cls] -= n;
+        pool->pushBatch(cls, first, last, n);
+    }
+};
+
+static thread_local BufferThreadCache t_buffer_cache;
+
+BufferPool::BufferPool()
+{
+}
+
+int BufferPool::ClassOf(size_t size)
+{
+    size_t total = size + sizeof(BufferBlock);
+    for (int i = 0; i < BUFFER_CLASS_COUNT; ++i)
+    {
+        if (total <= ClassSize(i))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+BufferBlock *BufferPool::allocate(size_t size)
+{
+    int cls = ClassOf(size);
+    void *mem = nullptr;
+    if (cls < 0)
+    {
+        m_large_allocs.add();
+        mem = ::operator new(size + sizeof(BufferBlock));
+        BufferBlock *block = new (mem) BufferBlock;
+        block->ref.store(1, std::memory_order_relaxed);
+        block->capacity = size;
+        block->cls = -1;
+        return block;
+    }
+
+    BufferThreadCache &cache = t_buffer_cache;
+    cache.pool = this;
+    if (!cache.head[cls])
+    {
+        uint32_t got = 0;
+        cache.head[cls] = popBatch(cls, s_cache_limit[cls] / 2, got);
+        cache.count[cls] = got;
+    }
+    FreeNode *node = cache.head[cls];
+    cache.head[cls] = node->next;
+    --cache.count[cls];
+    m_class_allocs[cls].add();
+
+    BufferBlock *block = new (node) BufferBlock;
+    block->ref.store(1, std::memory_order_relaxed);
+    block->capacity = ClassSize(cls) - sizeof(BufferBlock);
+    block->cls = cls;
+    return block;
+}
+
+void BufferPool::deallocate(BufferBlock *block)
+{
+    if (!block)
+    {
+        return;
+    }
+    int cls = block->cls;
+    block->~BufferBlock();
+    if (cls < 0)
+    {
+        ::operator delete(block);
+        return;
+    }
+
+    BufferThreadCache &cache = t_buffer_cache;
+    cache.pool = this;
+    FreeNode *node = reinterpret_cast<FreeNode *>(block);
+    node->next = cache.head[cls];
+    cache.head[cls] = node;
+    if (++cache.count[cls] > s_cache_limit[cls])
+    {
+        cache.flush(cls, cache.count[cls] / 2);
+    }
+}
+
+BufferPool::FreeNode *BufferPool::popBatch(int cls, uint32_t count, uint32_t &got)
+{
+    MutexType::Lock lock(m_mutex);
+    if (!m_free[cls])
+    {
+        growLocked(cls);
+    }
+    FreeNode *head = m_free[cls];
+    FreeNode *tail = head;
+    got = 1;
+    while (got < count && tail->next)
+    {
+        tail = tail->next;
+        ++got;
+    }
+    m_free[cls] = tail->next;
+    m_free_count[cls] -= got;
+    tail->next = nullptr;
+    return head;
+}
+
+void BufferPool::pushBatch(int cls, FreeNode *head, FreeNode *tail, uint32_t count)
+{
+    MutexType::Lock lock(m_mutex);
+    tail->next = m_free[cls];
+    m_free[cls] = head;
+    m_free_count[cls] += count;
+}
+
+void *BufferPool::mapChunk()
+{
+    void *mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (m_huge_page)
+    {
+        mem = mmap(nullptr, BUFFER_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED)
+        {
+            ++m_huge_chunks;
+            return mem;
+        }
+    }
+#endif
+    mem = mmap(nullptr, BUFFER_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    // 未预留大页时尝试透明大页
+    if (m_huge_page)
+    {
+        madvise(mem, BUFFER_CHUNK_SIZE, MADV_HUGEPAGE);
+    }
+#endif
+    return mem;
+}
+
+void BufferPool::growLocked(int cls)
+{
+    char *chunk = static_cast<char *>(mapChunk());
+    m_chunks.push_back(chunk);
+    size_t block_size = ClassSize(cls);
+    size_t n = BUFFER_CHUNK_SIZE / block_size;
+    for (size_t i = n; i > 0; --i)
+    {
+        FreeNode *node = reinterpret_cast<FreeNode *>(chunk + (i - 1) * block_size);
+        node->next = m_free[cls];
+        m_free[cls] = node;
+    }
+    m_free_count[cls] += n;
+}
+
+BufferPoolStats BufferPool::getStats()
+{
+    BufferPoolStats stats;
+    MutexType::Lock lock(m_mutex);
+    stats.chunks = m_chunks.size();
+    stats.huge_chunks = m_huge_chunks;
+    for (int i = 0; i < BUFFER_CLASS_COUNT; ++i)
+    {
+        stats.global_free += m_free_count[i];
+        stats.class_allocs[i] = m_class_allocs[i].read();
+    }
+    stats.large_allocs = m_large_allocs.read();
+    return stats;
+}
+
+///------------------------------------------------------------------
+
+MutableBuffer::MutableBuffer(size_t capacity)
+    : m_block(BufferPoolMgr::getInstance()->allocate(capacity))
+{
+}
+
+MutableBuffer::MutableBuffer(MutableBuffer &&other) noexcept
+    : m_block(other.m_block),
+      m_size(other.m_size)
+{
+    other.m_block = nullptr;
+    other.m_size = 0;
+}
+
+MutableBuffer::~MutableBuffer()
+{
+    if (m_block)
+    {
+        BufferPoolMgr::getInstance()->deallocate(m_block);
+    }
+}
+
+BufferSlice MutableBuffer::freeze()
+{
+    BufferSlice slice(m_block, 0, m_size);
+    m_block = nullptr;
+    m_size = 0;
+    return slice;
+}
+
+///------------------------------------------------------------------
+
+BufferSlice::BufferSlice(const BufferSlice &other)
+    : m_block(other.m_block),
+      m_offset(other.m_offset),
+      m_size(other.m_size)
+{
+    if (m_block)
+    {
+        m_block->ref.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+BufferSlice::BufferSlice(BufferSlice &&other) noexcept
+    : m_block(other.m_block),
+      m_offset(other.m_offset),
+      m_size(other.m_size)
+{
+    other.m_block = nullptr;
+    other.m_offset = 0;
+    other.m_size = 0;
+}
+
+BufferSlice &BufferSlice::operator=(const BufferSlice &other)
+{
+    if (this != &other)
+    {
+        if (other.m_block)
+        {
+            other.m_block->ref.fetch_add(1, std::memory_order_relaxed);
+        }
+        release();
+        m_block = other.m_block;
+        m_offset = other.m_offset;
+        m_size = other.m_size;
+    }
+    return *this;
+}
+
+BufferSlice &BufferSlice::operator=(BufferSlice &&other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        m_block = other.m_block;
+        m_offset = other.m_offset;
+        m_size = other.m_size;
+        other.m_block = nullptr;
+        other.m_offset = 0;
+        other.m_size = 0;
+    }
+    return *this;
+}
+
+BufferSlice::~BufferSlice()
+{
+    release();
+}
+
+void BufferSlice::release()
+{
+    if (m_block && m_block->ref.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        BufferPoolMgr::getInstance()->deallocate(m_block);
+    }
+    m_block = nullptr;
+    m_offset = 0;
+    m_size = 0;
+}
+
+BufferSlice BufferSlice::Copy(const void *data, size_t len)
+{
+    MutableBuffer buf(len);
+    if (len)
+    {
+        memcpy(buf.data(), data, len);
+    }
+    buf.setSize(len);
+    return buf.freeze();
+}
+
+BufferSlice BufferSlice::slice(size_t offset, size_t len) const
+{
+    if (offset >= m_size)
+    {
+        return BufferSlice();
+    }
+    if (len > m_size - offset)
+    {
+        len = m_size - offset;
+    }
+    if (m_block)
+    {
+        m_block->ref.fetch_add(1, std::memory_order_relaxed);
+    }
+    return BufferSlice(m_block, m_offset + offset, len);
+}
@@ -0,0 +1,213 @@
+/**
+ * @file bufferPool.h
+ * @brief 分级缓冲区池及引用计数缓冲区切片
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "mutex.h"
+#include "noncopyble.h"
+#include "singleton.h"
+
+/// 最小的分级大小 64B
+#define BUFFER_MIN_CLASS_SHIFT 6
+/// 分级数量，64B ~ 64KB 共11级，更大的缓冲区直接向系统申请
+#define BUFFER_CLASS_COUNT 11
+/// 每个chunk的大小，与2MB大页对齐
+#define BUFFER_CHUNK_SIZE (2 * 1024 * 1024)
+
+/**
+ * @brief 缓冲区块头，紧挨着数据区存放
+ */
+struct BufferBlock
+{
+    std::atomic<uint32_t> ref; // 引用计数
+    uint32_t capacity;         // 数据区容量
+    int32_t cls;               // 分级下标，-1表示直接申请的大块
+    uint32_t reserved;
+
+    char *data() { return reinterpret_cast<char *>(this + 1); }
+};
+
+/**
+ * @brief 缓冲区池运行统计
+ */
+struct BufferPoolStats
+{
+    uint64_t chunks = 0;         // 已申请的chunk数
+    uint64_t huge_chunks = 0;    // 其中使用大页的chunk数
+    uint64_t global_free = 0;    // 全局空闲链表中的块数
+    uint64_t large_allocs = 0;   // 超过最大分级、直接申请的次数
+    uint64_t class_allocs[BUFFER_CLASS_COUNT] = {0}; // 每个分级的分配次数
+};
+
+/**
+ * @brief 分级缓冲区池
+ * @details 按2的幂分级(64B ~ 64KB，包含块头)，每个分级从2MB的chunk中切分。
+ *          每个线程为每个分级保留一个本地空闲链表，分配和释放只访问本线程缓存；
+ *          本地缓存为空时从全局链表批量取一批，超过上限时批量归还一半，线程退出时全部归还。
+ *          chunk可选使用大页(MAP_HUGETLB，失败时退回madvise透明大页)，降低大量连接缓冲区的TLB压力。
+ *          chunk在进程生命周期内不归还系统，稳态下收发路径不再进入malloc。
+ */
+class BufferPool : Noncopyble
+{
+public:
+    typedef CASLock MutexType;
+
+    BufferPool();
+
+    /**
+     * @brief 申请一个数据区至少为size字节的块，引用计数为1
+     */
+    BufferBlock *allocate(size_t size);
+
+    /**
+     * @brief 归还一个块，由引用计数降到0的持有者调用
+     */
+    void deallocate(BufferBlock *block);
+
+    /**
+     * @brief 设置新申请的chunk是否使用大页，只影响之后申请的chunk
+     */
+    void setHugePage(bool val) { m_huge_page = val; }
+    bool isHugePage() const { return m_huge_page; }
+
+    BufferPoolStats getStats();
+
+    /**
+     * @brief 数据区大小对应的分级下标，超出最大分级返回-1
+     */
+    static int ClassOf(size_t size);
+
+    /**
+     * @brief 分级下标对应的块大小(包含块头)
+     */
+    static size_t ClassSize(int cls) { return (size_t)1 << (cls + BUFFER_MIN_CLASS_SHIFT); }
+
+private:
+    friend struct BufferThreadCache;
+
+    struct FreeNode
+    {
+        FreeNode *next;
+    };
+
+    /**
+     * @brief 从全局链表取最多count个块，返回链表头，取到的数量写入got
+     */
+    FreeNode *popBatch(int cls, uint32_t count, uint32_t &got);
+
+    /**
+     * @brief 把一条链表归还全局链表
+     */
+    void pushBatch(int cls, FreeNode *head, FreeNode *tail, uint32_t count);
+
+    /**
+     * @brief 为某个分级申请一个新chunk并切分，调用方持有锁
+     */
+    void growLocked(int cls);
+
+    void *mapChunk();
+
+private:
+    MutexType m_mutex;
+    FreeNode *m_free[BUFFER_CLASS_COUNT] = {nullptr};
+    uint64_t m_free_count[BUFFER_CLASS_COUNT] = {0};
+    std::vector<void *> m_chunks;
+    uint64_t m_huge_chunks = 0;
+    PerCpuCounter m_large_allocs;
+    PerCpuCounter m_class_allocs[BUFFER_CLASS_COUNT];
+    bool m_huge_page = false;
+};
+
+typedef Singleton<BufferPool> BufferPoolMgr;
+
+class BufferSlice;
+
+/**
+ * @brief 可写缓冲区，唯一持有一个块，写完后freeze成只读切片共享
+ */
+class MutableBuffer : Noncopyble
+{
+public:
+    /**
+     * @brief 从缓冲区池申请至少capacity字节
+     */
+    explicit MutableBuffer(size_t capacity);
+    MutableBuffer(MutableBuffer &&other) noexcept;
+    ~MutableBuffer();
+
+    char *data() { return m_block->data(); }
+    size_t capacity() const { return m_block->capacity; }
+    size_t size() const { return m_size; }
+
+    /**
+     * @brief 设置已写入的数据长度
+     */
+    void setSize(size_t size) { m_size = size < capacity() ? size : capacity(); }
+
+    /**
+     * @brief 转为只读切片，之后本对象不再持有数据
+     */
+    BufferSlice freeze();
+
+private:
+    BufferBlock *m_block;
+    size_t m_size = 0;
+};
+
+/**
+ * @brief 引用计数的只读缓冲区切片
+ * @details 拷贝只增加引用计数，同一份消息投递给多个连接时不复制数据；
+ *          slice()在同一个块上截取子区间，最后一个持有者析构时块归还缓冲区池。
+ */
+class BufferSlice
+{
+public:
+    BufferSlice() = default;
+    BufferSlice(const BufferSlice &other);
+    BufferSlice(BufferSlice &&other) noexcept;
+    BufferSlice &operator=(const BufferSlice &other);
+    BufferSlice &operator=(BufferSlice &&other) noexcept;
+    ~BufferSlice();
+
+    /**
+     * @brief 从缓冲区池申请块并拷贝数据
+     */
+    static BufferSlice Copy(const void *data, size_t len);
+    static BufferSlice Copy(const std::string &str) { return Copy(str.data(), str.size()); }
+
+    const char *data() const { return m_block ? m_block->data() + m_offset : nullptr; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    /**
+     * @brief 截取子区间，与原切片共享同一个块
+     */
+    BufferSlice slice(size_t offset, size_t len) const;
+
+    std::string toString() const { return std::string(data() ? data() : "", m_size); }
+
+    /**
+     * @brief 块的当前引用计数，调试用
+     */
+    uint32_t useCount() const { return m_block ? m_block->ref.load(std::memory_order_relaxed) : 0; }
+
+private:
+    friend class MutableBuffer;
+    BufferSlice(BufferBlock *block, uint32_t offset, uint32_t size)
+        : m_block(block), m_offset(offset), m_size(size) {}
+
+    void release();
+
+private:
+    BufferBlock *m_block = nullptr;
+    uint32_t m_offset = 0;
+    uint32_t m_size = 0;
+};
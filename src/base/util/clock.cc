@@ -0,0 +1,220 @@
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <algorithm>
+#include "clock.h"
+#include "mutex.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define CLOCK_HAS_TSC 1
+#endif
+
+/**
+ * @brief TSC换算参数
+ */
+struct TscParams
+{
+    uint64_t tsc_base = 0;     // 锚点TSC
+    uint64_t mono_base_us = 0; // 锚点单调时间
+    uint64_t mult = 0;         // 每个TSC周期的微秒数，32.32定点
+};
+
+static bool s_inited = false;
+static bool s_tsc = false;
+static uint64_t s_tsc_init = 0;     // 首次校准时的TSC
+static uint64_t s_mono_init_us = 0; // 首次校准时的单调时间
+// 重新校准时整体替换，读者无锁读取一致的快照
+static SeqLock<TscParams> s_tsc_params;
+static uint64_t s_start_us = 0; // 进程启动时的单调时间
+static std::atomic<int64_t> s_wall_offset_us{0};  // 墙上时间 - 单调时间
+static std::atomic<uint64_t> s_next_sync_us{0};   // 下一次校正墙上时间偏移的时刻
+
+/**
+ * @brief 线程缓存的时间
+ */
+struct ClockCache
+{
+    uint64_t mono_us = 0;
+    uint64_t wall_us = 0;
+};
+
+static thread_local ClockCache t_clock;
+
+static uint64_t ReadClockUs(clockid_t id)
+{
+    timespec ts;
+    clock_gettime(id, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+#ifdef CLOCK_HAS_TSC
+/**
+ * @brief 以首次校准点为起点重新计算TSC频率并移动锚点，基线越长误差越小
+ */
+static void RecalibrateTsc()
+{
+    uint64_t tsc = __rdtsc();
+    uint64_t mono = ReadClockUs(CLOCK_MONOTONIC);
+    if (tsc <= s_tsc_init || mono <= s_mono_init_us)
+    {
+        return;
+    }
+    TscParams old = s_tsc_params.read();
+    TscParams params;
+    params.tsc_base = tsc;
+    params.mono_base_us = mono;
+    params.mult = (uint64_t)((((unsigned __int128)(mono - s_mono_init_us)) << 32) / (tsc - s_tsc_init));
+    // 旧频率换算的当前时间可能已超过mono，锚点不回退，NowUs()不会因校准倒退
+    if (tsc > old.tsc_base)
+    {
+        uint64_t cur = old.mono_base_us + (uint64_t)(((unsigned __int128)(tsc - old.tsc_base) * old.mult) >> 32);
+        params.mono_base_us = std::max(mono, cur);
+    }
+    s_tsc_params.store(params);
+}
+#endif
+
+static void SyncWallOffset(uint64_t mono_us)
+{
+#ifdef CLOCK_HAS_TSC
+    if (s_tsc)
+    {
+        RecalibrateTsc();
+    }
+#endif
+    s_wall_offset_us.store((int64_t)ReadClockUs(CLOCK_REALTIME) - (int64_t)mono_us, std::memory_order_relaxed);
+    s_next_sync_us.store(mono_us + 1000000, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 距上次校正超过1秒时由一个线程校正，其余线程不等待
+ */
+static inline void MaybeSync(uint64_t mono_us)
+{
+    uint64_t next = s_next_sync_us.load(std::memory_order_relaxed);
+    if (__builtin_expect(mono_us >= next, 0) && s_inited &&
+        s_next_sync_us.compare_exchange_strong(next, mono_us + 1000000, std::memory_order_relaxed))
+    {
+        SyncWallOffset(mono_us);
+    }
+}
+
+void Clock::Init()
+{
+    if (s_inited)
+    {
+        return;
+    }
+#ifdef CLOCK_HAS_TSC
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    // CPUID.80000007H:EDX[8] 不变TSC，频率不受变频和C-state影响
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1 << 8)))
+    {
+        uint64_t mono0 = ReadClockUs(CLOCK_MONOTONIC);
+        uint64_t tsc0 = __rdtsc();
+        usleep(10000);
+        uint64_t mono1 = ReadClockUs(CLOCK_MONOTONIC);
+        uint64_t tsc1 = __rdtsc();
+        if (tsc1 > tsc0 && mono1 > mono0)
+        {
+            TscParams params;
+            params.mult = (uint64_t)((((unsigned __int128)(mono1 - mono0)) << 32) / (tsc1 - tsc0));
+            params.tsc_base = tsc1;
+            params.mono_base_us = mono1;
+            s_tsc_init = tsc0;
+            s_mono_init_us = mono0;
+            s_tsc_params.store(params);
+            s_tsc = params.mult != 0;
+        }
+    }
+#endif
+    s_inited = true;
+    s_start_us = NowUs();
+    SyncWallOffset(s_start_us);
+}
+
+bool Clock::IsTscEnabled()
+{
+    return s_tsc;
+}
+
+uint64_t Clock::NowUs()
+{
+    uint64_t now;
+#ifdef CLOCK_HAS_TSC
+    if (s_tsc)
+    {
+        TscParams params = s_tsc_params.read();
+        uint64_t tsc = __rdtsc();
+        // 其他线程刚切换锚点时本线程读到的TSC可能略早于锚点
+        if (tsc < params.tsc_base)
+        {
+            now = params.mono_base_us;
+        }
+        else
+        {
+            now = params.mono_base_us + (uint64_t)(((unsigned __int128)(tsc - params.tsc_base) * params.mult) >> 32);
+        }
+    }
+    else
+#endif
+    {
+        now = ReadClockUs(CLOCK_MONOTONIC);
+    }
+    MaybeSync(now);
+    return now;
+}
+
+uint64_t Clock::WallUs()
+{
+    if (!s_inited)
+    {
+        return ReadClockUs(CLOCK_REALTIME);
+    }
+    return NowUs() + s_wall_offset_us.load(std::memory_order_relaxed);
+}
+
+void Clock::Tick()
+{
+    uint64_t now = NowUs();
+    // 重新校准可能让换算结果回退几微秒，缓存时间保持单调
+    if (now > t_clock.mono_us)
+    {
+        t_clock.mono_us = now;
+    }
+    t_clock.wall_us = t_clock.mono_us + s_wall_offset_us.load(std::memory_order_relaxed);
+}
+
+uint64_t Clock::CachedUs()
+{
+    return t_clock.mono_us ? t_clock.mono_us : NowUs();
+}
+
+uint64_t Clock::CachedWallUs()
+{
+    return t_clock.wall_us ? t_clock.wall_us : WallUs();
+}
+
+uint64_t Clock::ElapsedMs()
+{
+    if (!s_inited)
+    {
+        return 0;
+    }
+    return (CachedUs() - s_start_us) / 1000;
+}
+
+/**
+ * @brief 静态初始化时完成校准
+ */
+struct ClockIniter
+{
+    ClockIniter()
+    {
+        Clock::Init();
+    }
+};
+
+static ClockIniter s_clock_init;
@@ -0,0 +1,68 @@
+/**
+ * @file clock.h
+ * @brief 低开销时钟服务
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief 时钟服务
+ * @details 精确接口(Now/Wall系列)在支持不变TSC的x86_64上读取rdtsc并按启动时的校准结果换算，
+ *          不进入内核，否则退化为clock_gettime。
+ *          缓存接口(Cached系列)返回本线程最近一次Tick()时的时间，事件循环每轮调用一次Tick()，
+ *          同一轮内的日志、定时器、连接活跃时间共享同一个时间戳；
+ *          从未调用过Tick()的线程读取缓存接口时直接返回精确值。
+ *          墙上时间由单调时间加偏移得到，NowUs()发现距上次校正超过1秒时用CLOCK_REALTIME校正一次偏移，
+ *          同时重新校准TSC频率，不依赖Tick()的调用方。
+ */
+class Clock
+{
+public:
+    /**
+     * @brief 校准TSC并记录进程启动时间，静态初始化时自动调用
+     */
+    static void Init();
+
+    /**
+     * @brief 是否使用TSC快速路径
+     */
+    static bool IsTscEnabled();
+
+    /**
+     * @brief 精确单调时间
+     */
+    static uint64_t NowUs();
+    static uint64_t NowMs() { return NowUs() / 1000; }
+
+    /**
+     * @brief 精确墙上时间(unix时间)
+     */
+    static uint64_t WallUs();
+    static uint64_t WallMs() { return WallUs() / 1000; }
+    static uint64_t WallSec() { return WallUs() / 1000000; }
+
+    /**
+     * @brief 刷新本线程的缓存时间，事件循环每轮开始时调用
+     */
+    static void Tick();
+
+    /**
+     * @brief 本线程缓存的单调时间
+     */
+    static uint64_t CachedUs();
+    static uint64_t CachedMs() { return CachedUs() / 1000; }
+
+    /**
+     * @brief 本线程缓存的墙上时间
+     */
+    static uint64_t CachedWallUs();
+    static uint64_t CachedWallMs() { return CachedWallUs() / 1000; }
+    static uint64_t CachedWallSec() { return CachedWallUs() / 1000000; }
+
+    /**
+     * @brief 进程启动以来经过的毫秒数(基于缓存时间)
+     */
+    static uint64_t ElapsedMs();
+};
@@ -17,6 +17,7 @@
 
 #include "log/log.h"
 #include "mutex.h"
+#include "flatHashMap.h"
 // #include "util.h"
 
 /**
@@ -375,7 +376,7 @@ private:
 class Config
 {
 public:
-    typedef std::map<std::string, ConfigVarBase::ptr> ConfigVarMap;
+    typedef FlatHashMap<std::string, ConfigVarBase::ptr> ConfigVarMap;
     typedef RWMutex RWMutexType;
 
     /**
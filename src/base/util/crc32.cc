@@ -0,0 +1,81 @@
+#include "crc32.h"
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#include <string.h>
+#endif
+
+#ifdef __SSE4_2__
+
+uint32_t Crc32c(const void *data, size_t len, uint32_t crc)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    uint64_t c = ~crc;
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        c = _mm_crc32_u64(c, word);
+        p += 8;
+        len -= 8;
+    }
+    uint32_t c32 = (uint32_t)c;
+    while (len--)
+    {
+        c32 = _mm_crc32_u8(c32, *p++);
+    }
+    return ~c32;
+}
+
+#else
+
+/**
+ * @brief slicing-by-8查找表，首次使用时生成
+ */
+struct Crc32cTable
+{
+    uint32_t t[8][256];
+
+    Crc32cTable()
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+            {
+                c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+            }
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            for (int k = 1; k < 8; ++k)
+            {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+uint32_t Crc32c(const void *data, size_t len, uint32_t crc)
+{
+    static const Crc32cTable s_table;
+    const uint32_t(*t)[256] = s_table.t;
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    uint32_t c = ~crc;
+    while (len >= 8)
+    {
+        uint32_t lo = c ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+            t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+    {
+        c = t[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+    }
+    return ~c;
+}
+
+#endif
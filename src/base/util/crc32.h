@@ -0,0 +1,18 @@
+/**
+ * @file crc32.h
+ * @brief CRC32C校验，用于消息存储和WAL的记录校验
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief 计算CRC32C(Castagnoli)
+ * @details 编译时开启SSE4.2使用crc32指令，否则查表(slicing-by-8)
+ * @param[in] data 数据
+ * @param[in] len 长度
+ * @param[in] crc 上一段数据的校验值，分段计算时传入
+ */
+uint32_t Crc32c(const void *data, size_t len, uint32_t crc = 0);
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <initializer_list>
+#include "cuckooFilter.h"
+
+#define CUCKOO_LANE_LOW 0x0001000100010001ull
+#define CUCKOO_LANE_HIGH 0x8000800080008000ull
+
+CuckooFilter::CuckooFilter(size_t capacity)
+{
+    // 4路桶在95%负载内基本都能插入成功
+    size_t need = (capacity * 100 / 95 + CUCKOO_BUCKET_SLOTS - 1) / CUCKOO_BUCKET_SLOTS;
+    size_t buckets = 1;
+    while (buckets < need)
+    {
+        buckets <<= 1;
+    }
+    m_buckets.assign(buckets, 0);
+    m_mask = buckets - 1;
+}
+
+bool CuckooFilter::BucketHas(uint64_t bucket, uint16_t fp)
+{
+    // 与指纹异或后，相等的16位槽变为0，用经典的"含零字节"技巧一次判断4个槽
+    uint64_t x = bucket ^ (fp * CUCKOO_LANE_LOW);
+    return ((x - CUCKOO_LANE_LOW) & ~x & CUCKOO_LANE_HIGH) != 0;
+}
+
+bool CuckooFilter::tryInsert(size_t index, uint16_t fp)
+{
+    uint64_t &bucket = m_buckets[index];
+    for (int slot = 0; slot < CUCKOO_BUCKET_SLOTS; ++slot)
+    {
+        if (((bucket >> (slot * 16)) & 0xffff) == 0)
+        {
+            bucket |= (uint64_t)fp << (slot * 16);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CuckooFilter::insert(uint64_t hash)
+{
+    if (m_victim_used)
+    {
+        return false;
+    }
+    uint16_t fp = Fingerprint(hash);
+    size_t i1 = indexOf(hash);
+    size_t i2 = altIndex(i1, fp);
+    if (tryInsert(i1, fp) || tryInsert(i2, fp))
+    {
+        ++m_count;
+        return true;
+    }
+
+    size_t index = (m_rng & 1) ? i1 : i2;
+    for (int kick = 0; kick < CUCKOO_MAX_KICKS; ++kick)
+    {
+        m_rng ^= m_rng << 13;
+        m_rng ^= m_rng >> 17;
+        m_rng ^= m_rng << 5;
+        int slot = m_rng % CUCKOO_BUCKET_SLOTS;
+        uint64_t &bucket = m_buckets[index];
+        uint16_t victim = (uint16_t)(bucket >> (slot * 16));
+        bucket = (bucket & ~(0xffffull << (slot * 16))) | ((uint64_t)fp << (slot * 16));
+        fp = victim;
+        index = altIndex(index, fp);
+        if (tryInsert(index, fp))
+        {
+            ++m_count;
+            return true;
+        }
+    }
+    // 被踢出的指纹放入备用槽，保证已插入的元素都能查到
+    m_victim_used = true;
+    m_victim_index = index;
+    m_victim_fp = fp;
+    ++m_count;
+    return true;
+}
+
+bool CuckooFilter::contains(uint64_t hash) const
+{
+    uint16_t fp = Fingerprint(hash);
+    size_t i1 = indexOf(hash);
+    size_t i2 = altIndex(i1, fp);
+    if (BucketHas(m_buckets[i1], fp) || BucketHas(m_buckets[i2], fp))
+    {
+        return true;
+    }
+    return m_victim_used && m_victim_fp == fp && (m_victim_index == i1 || m_victim_index == i2);
+}
+
+bool CuckooFilter::remove(uint64_t hash)
+{
+    uint16_t fp = Fingerprint(hash);
+    size_t i1 = indexOf(hash);
+    size_t i2 = altIndex(i1, fp);
+    for (size_t index : {i1, i2})
+    {
+        uint64_t &bucket = m_buckets[index];
+        for (int slot = 0; slot < CUCKOO_BUCKET_SLOTS; ++slot)
+        {
+            if ((uint16_t)(bucket >> (slot * 16)) != fp)
+            {
+                continue;
+            }
+            bucket &= ~(0xffffull << (slot * 16));
+            --m_count;
+            if (m_victim_used && (tryInsert(m_victim_index, m_victim_fp) ||
+                                  tryInsert(altIndex(m_victim_index, m_victim_fp), m_victim_fp)))
+            {
+                m_victim_used = false;
+            }
+            return true;
+        }
+    }
+    if (m_victim_used && m_victim_fp == fp && (m_victim_index == i1 || m_victim_index == i2))
+    {
+        m_victim_used = false;
+        --m_count;
+        return true;
+    }
+    return false;
+}
+
+void CuckooFilter::clear()
+{
+    std::fill(m_buckets.begin(), m_buckets.end(), 0);
+    m_count = 0;
+    m_victim_used = false;
+}
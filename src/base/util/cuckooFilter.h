@@ -0,0 +1,83 @@
+/**
+ * @file cuckooFilter.h
+ * @brief 布谷鸟过滤器，支持删除的近似集合
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/// 每个桶的槽数，4个16位指纹放在一个uint64_t中
+#define CUCKOO_BUCKET_SLOTS 4
+/// 插入时最多踢出的次数
+#define CUCKOO_MAX_KICKS 256
+
+/**
+ * @brief 布谷鸟过滤器
+ * @details 保存元素哈希的16位指纹，每个指纹有两个候选桶i1 = h % n，i2 = i1 ^ hash(fp)，
+ *          查询只检查两个桶，用SWAR一次比较桶内4个槽，没有分支循环；误判率约为 8 / 2^16。
+ *          插入时两个桶都满则随机踢出一个指纹到它的另一个桶，踢出次数用完时把最后一个指纹放入
+ *          备用槽并认为过滤器已满，不会丢失已插入的元素(不产生假阴性)。
+ *          调用方传入已经充分混合的64位哈希。
+ */
+class CuckooFilter
+{
+public:
+    /**
+     * @param[in] capacity 预期元素数，按95%负载向上取整为2的幂个桶
+     */
+    explicit CuckooFilter(size_t capacity = 0);
+
+    /**
+     * @brief 插入元素，同一元素可以插入多次
+     * @return 过滤器已满返回false
+     */
+    bool insert(uint64_t hash);
+
+    /**
+     * @brief 元素可能存在返回true，不存在一定返回false
+     */
+    bool contains(uint64_t hash) const;
+
+    /**
+     * @brief 删除一次插入过的元素，删除未插入的元素可能误删其他元素
+     */
+    bool remove(uint64_t hash);
+
+    void clear();
+
+    bool isFull() const { return m_victim_used; }
+    size_t size() const { return m_count; }
+    size_t getBucketCount() const { return m_buckets.size(); }
+    size_t memoryUsage() const { return m_buckets.capacity() * sizeof(uint64_t); }
+
+private:
+    static uint16_t Fingerprint(uint64_t hash)
+    {
+        uint16_t fp = (uint16_t)(hash >> 48);
+        return fp ? fp : 1;
+    }
+
+    size_t indexOf(uint64_t hash) const { return hash & m_mask; }
+
+    size_t altIndex(size_t index, uint16_t fp) const
+    {
+        return (index ^ (fp * 0x5bd1e995u)) & m_mask;
+    }
+
+    static bool BucketHas(uint64_t bucket, uint16_t fp);
+
+    bool tryInsert(size_t index, uint16_t fp);
+
+private:
+    std::vector<uint64_t> m_buckets;
+    size_t m_mask = 0;
+    size_t m_count = 0;
+    uint32_t m_rng = 0x9e3779b9u;
+
+    bool m_victim_used = false;
+    size_t m_victim_index = 0;
+    uint16_t m_victim_fp = 0;
+};
@@ -0,0 +1,184 @@
+#include "epoch.h"
+
+/**
+ * @brief 线程持有的epoch记录，线程退出时归还
+ */
+struct EpochThread
+{
+    EpochRecord *rec = nullptr;
+
+    EpochRecord *get()
+    {
+        if (!rec)
+        {
+            rec = EpochMgr::getInstance()->acquireRecord();
+        }
+        return rec;
+    }
+
+    ~EpochThread()
+    {
+        if (rec)
+        {
+            EpochMgr::getInstance()->releaseRecord(rec);
+        }
+    }
+};
+
+static thread_local EpochThread t_epoch;
+
+EpochRecord *EpochManager::acquireRecord()
+{
+    // 优先复用已退出线程的记录
+    for (EpochRecord *rec = m_records.load(std::memory_order_acquire); rec; rec = rec->next)
+    {
+        bool expected = false;
+        if (!rec->in_use.load(std::memory_order_relaxed) &&
+            rec->in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+        {
+            return rec;
+        }
+    }
+
+    EpochRecord *rec = new EpochRecord;
+    rec->in_use.store(true, std::memory_order_relaxed);
+    rec->retired.reserve(EPOCH_RETIRE_BATCH);
+    EpochRecord *head = m_records.load(std::memory_order_relaxed);
+    do
+    {
+        rec->next = head;
+    } while (!m_records.compare_exchange_weak(head, rec, std::memory_order_release, std::memory_order_relaxed));
+    return rec;
+}
+
+void EpochManager::releaseRecord(EpochRecord *rec)
+{
+    rec->epoch.store(0, std::memory_order_release);
+    rec->nesting = 0;
+    if (!rec->retired.empty())
+    {
+        MutexType::Lock lock(m_orphan_mutex);
+        m_orphans.insert(m_orphans.end(), rec->retired.begin(), rec->retired.end());
+        rec->retired.clear();
+    }
+    rec->in_use.store(false, std::memory_order_release);
+}
+
+void EpochManager::enter()
+{
+    EpochRecord *rec = t_epoch.get();
+    if (rec->nesting++)
+    {
+        return;
+    }
+    uint64_t epoch = m_epoch.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        rec->epoch.store(epoch, std::memory_order_relaxed);
+        // 发布本线程epoch之后的读取不能重排到发布之前
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t now = m_epoch.load(std::memory_order_relaxed);
+        if (now == epoch)
+        {
+            break;
+        }
+        // 发布期间epoch已推进，用新值重新发布
+        epoch = now;
+    }
+}
+
+void EpochManager::exit()
+{
+    EpochRecord *rec = t_epoch.get();
+    if (--rec->nesting == 0)
+    {
+        rec->epoch.store(0, std::memory_order_release);
+    }
+}
+
+void EpochManager::retire(void *ptr, void (*deleter)(void *))
+{
+    EpochRecord *rec = t_epoch.get();
+    rec->retired.push_back({ptr, deleter, m_epoch.load(std::memory_order_acquire)});
+    if (rec->retired.size() >= EPOCH_RETIRE_BATCH)
+    {
+        collect();
+    }
+}
+
+bool EpochManager::tryAdvance()
+{
+    uint64_t epoch = m_epoch.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (EpochRecord *rec = m_records.load(std::memory_order_acquire); rec; rec = rec->next)
+    {
+        uint64_t local = rec->epoch.load(std::memory_order_acquire);
+        if (local && local != epoch)
+        {
+            return false;
+        }
+    }
+    return m_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_acq_rel);
+}
+
+size_t EpochManager::FreeSafe(std::vector<EpochRetired> &list, uint64_t epoch)
+{
+    size_t freed = 0;
+    size_t keep = 0;
+    for (size_t i = 0; i < list.size(); ++i)
+    {
+        if (list[i].epoch + 2 <= epoch)
+        {
+            list[i].deleter(list[i].ptr);
+            ++freed;
+        }
+        else
+        {
+            list[keep++] = list[i];
+        }
+    }
+    list.resize(keep);
+    return freed;
+}
+
+size_t EpochManager::collect()
+{
+    tryAdvance();
+    uint64_t epoch = m_epoch.load(std::memory_order_acquire);
+
+    // 换出后再释放，析构函数中再次retire不会破坏正在遍历的列表
+    EpochRecord *rec = t_epoch.get();
+    std::vector<EpochRetired> retired;
+    retired.swap(rec->retired);
+    size_t freed = FreeSafe(retired, epoch);
+    if (rec->retired.empty())
+    {
+        rec->retired.swap(retired);
+    }
+    else
+    {
+        rec->retired.insert(rec->retired.end(), retired.begin(), retired.end());
+    }
+
+    std::vector<EpochRetired> orphans;
+    {
+        MutexType::Lock lock(m_orphan_mutex);
+        if (m_orphans.empty())
+        {
+            return freed;
+        }
+        orphans.swap(m_orphans);
+    }
+    freed += FreeSafe(orphans, epoch);
+    if (!orphans.empty())
+    {
+        MutexType::Lock lock(m_orphan_mutex);
+        m_orphans.insert(m_orphans.end(), orphans.begin(), orphans.end());
+    }
+    return freed;
+}
+
+size_t EpochManager::pending()
+{
+    return t_epoch.get()->retired.size();
+}
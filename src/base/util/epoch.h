@@ -0,0 +1,183 @@
+/**
+ * @file epoch.h
+ * @brief 基于epoch的延迟内存回收
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include "mutex.h"
+#include "noncopyble.h"
+#include "singleton.h"
+
+/// 每个线程待回收对象达到该数量时尝试推进epoch并回收
+#define EPOCH_RETIRE_BATCH 64
+
+/**
+ * @brief 待回收对象
+ */
+struct EpochRetired
+{
+    void *ptr;
+    void (*deleter)(void *);
+    uint64_t epoch; // 退役时的全局epoch
+};
+
+/**
+ * @brief 线程的epoch记录，线程退出后由新线程复用
+ */
+struct EpochRecord
+{
+    std::atomic<uint64_t> epoch{0}; // 进入临界区时看到的全局epoch，0表示不在临界区
+    std::atomic<bool> in_use{false};
+    EpochRecord *next = nullptr;
+    uint32_t nesting = 0;               // 临界区嵌套深度，仅所属线程访问
+    std::vector<EpochRetired> retired; // 本线程退役的对象，仅所属线程访问
+};
+
+/**
+ * @brief epoch回收管理器
+ * @details 读者进入临界区(EpochGuard)时记录当前全局epoch，之后可以无锁、无引用计数地遍历共享结构；
+ *          写者摘除旧版本后调用retire()，对象挂到本线程的退役列表并记下当时的epoch。
+ *          所有处于临界区的线程都已看到当前epoch时，全局epoch才能推进；
+ *          退役时epoch比当前全局epoch小2及以上的对象不可能再被任何读者引用，可以释放。
+ *          退役列表达到EPOCH_RETIRE_BATCH时自动尝试回收，
+ *          事件循环应在每轮结束、不持有任何共享指针时调用quiescent()，保证epoch持续推进。
+ *          线程退出时未回收的对象转入全局孤儿列表，由其他线程回收。
+ */
+class EpochManager : Noncopyble
+{
+public:
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 进入临界区，可嵌套
+     */
+    void enter();
+
+    /**
+     * @brief 退出临界区
+     */
+    void exit();
+
+    /**
+     * @brief 退役一个已从共享结构中摘除的对象
+     */
+    void retire(void *ptr, void (*deleter)(void *));
+
+    template <class T>
+    void retire(T *ptr)
+    {
+        retire(static_cast<void *>(ptr), [](void *p)
+               { delete static_cast<T *>(p); });
+    }
+
+    /**
+     * @brief 尝试推进全局epoch
+     * @return 所有活跃线程都已看到当前epoch并推进成功时返回true
+     */
+    bool tryAdvance();
+
+    /**
+     * @brief 尝试推进epoch并释放本线程和孤儿列表中已安全的对象
+     * @return 本次释放的对象数
+     */
+    size_t collect();
+
+    /**
+     * @brief 静止点，事件循环每轮调用一次，当前线程不能处于临界区
+     */
+    size_t quiescent() { return collect(); }
+
+    uint64_t getEpoch() const { return m_epoch.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 当前线程待回收的对象数
+     */
+    size_t pending();
+
+private:
+    friend struct EpochThread;
+
+    EpochRecord *acquireRecord();
+    void releaseRecord(EpochRecord *rec);
+
+    /**
+     * @brief 释放列表中epoch已安全的对象
+     */
+    static size_t FreeSafe(std::vector<EpochRetired> &list, uint64_t epoch);
+
+private:
+    std::atomic<uint64_t> m_epoch{2};
+    std::atomic<EpochRecord *> m_records{nullptr};
+
+    MutexType m_orphan_mutex;
+    std::vector<EpochRetired> m_orphans; // 已退出线程留下的待回收对象
+};
+
+typedef Singleton<EpochManager> EpochMgr;
+
+/**
+ * @brief 读者临界区
+ */
+class EpochGuard : Noncopyble
+{
+public:
+    EpochGuard() { EpochMgr::getInstance()->enter(); }
+    ~EpochGuard() { EpochMgr::getInstance()->exit(); }
+};
+
+/**
+ * @brief 版本指针，读者在EpochGuard内load()，写者store()替换版本，旧版本延迟释放
+ * @details 适用于配置快照、路由表等读多写少、整体替换的结构
+ */
+template <class T>
+class EpochPtr : Noncopyble
+{
+public:
+    explicit EpochPtr(T *ptr = nullptr) : m_ptr(ptr) {}
+
+    ~EpochPtr()
+    {
+        delete m_ptr.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 读取当前版本，返回的指针在EpochGuard作用域内有效
+     */
+    T *load() const { return m_ptr.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 发布新版本并退役旧版本
+     */
+    void store(T *ptr)
+    {
+        T *old = m_ptr.exchange(ptr, std::memory_order_acq_rel);
+        if (old)
+        {
+            EpochMgr::getInstance()->retire(old);
+        }
+    }
+
+    /**
+     * @brief 当前版本仍为expected时发布新版本，成功后退役expected
+     */
+    bool compareExchange(T *&expected, T *desired)
+    {
+        if (m_ptr.compare_exchange_strong(expected, desired, std::memory_order_acq_rel))
+        {
+            if (expected)
+            {
+                EpochMgr::getInstance()->retire(expected);
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    std::atomic<T *> m_ptr;
+};
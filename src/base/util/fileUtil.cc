@@ -0,0 +1,21 @@
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+#include "fileUtil.h"
+
+bool MakeDirs(const std::string &dir)
+{
+    for (size_t pos = 1; pos <= dir.size(); ++pos)
+    {
+        if (pos != dir.size() && dir[pos] != '/')
+        {
+            continue;
+        }
+        std::string sub = dir.substr(0, pos);
+        if (mkdir(sub.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            return false;
+        }
+    }
+    return true;
+}
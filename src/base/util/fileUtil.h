@@ -0,0 +1,25 @@
+/**
+ * @file fileUtil.h
+ * @brief 消息存储和WAL共用的文件工具
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+/**
+ * @brief 记录头加内容按align对齐后的长度
+ * @param[in] len 记录内容长度
+ * @param[in] align 对齐字节数，必须是2的幂
+ */
+template <class Header>
+inline size_t AlignedRecordSize(size_t len, size_t align)
+{
+    return (sizeof(Header) + len + align - 1) & ~(align - 1);
+}
+
+/**
+ * @brief 逐级创建目录，已存在不算失败
+ */
+bool MakeDirs(const std::string &dir);
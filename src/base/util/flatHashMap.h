@@ -0,0 +1,623 @@
+/**
+ * @file flatHashMap.h
+ * @brief 开放寻址哈希表(SwissTable风格)
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <utility>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * @brief 默认哈希函数，std::string支持以std::string_view/const char*异构查找
+ */
+template <class K>
+struct FlatHash : std::hash<K>
+{
+};
+
+template <>
+struct FlatHash<std::string>
+{
+    typedef void is_transparent;
+    size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+};
+
+template <class K>
+struct FlatEqual : std::equal_to<K>
+{
+};
+
+template <>
+struct FlatEqual<std::string> : std::equal_to<>
+{
+};
+
+/**
+ * @brief 槽位控制字节
+ * @details 最高位为1表示空槽或墓碑，否则低7位保存哈希值的低7位(H2)
+ */
+enum FlatCtrl : int8_t
+{
+    FLAT_CTRL_EMPTY = -128,
+    FLAT_CTRL_DELETED = -2,
+};
+
+/**
+ * @brief 16个控制字节组成一组，一次比较整组
+ */
+struct FlatGroup
+{
+    static constexpr size_t WIDTH = 16;
+
+#ifdef __SSE2__
+    explicit FlatGroup(const int8_t *ctrl)
+        : m_ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl))) {}
+
+    uint32_t match(int8_t h2) const
+    {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), m_ctrl));
+    }
+
+    uint32_t matchEmpty() const
+    {
+        return match(FLAT_CTRL_EMPTY);
+    }
+
+    uint32_t matchEmptyOrDeleted() const
+    {
+        // 空槽和墓碑都小于-1
+        return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), m_ctrl));
+    }
+
+private:
+    __m128i m_ctrl;
+#else
+    explicit FlatGroup(const int8_t *ctrl) : m_ctrl(ctrl) {}
+
+    uint32_t match(int8_t h2) const
+    {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < WIDTH; ++i)
+        {
+            mask |= (uint32_t)(m_ctrl[i] == h2) << i;
+        }
+        return mask;
+    }
+
+    uint32_t matchEmpty() const
+    {
+        return match(FLAT_CTRL_EMPTY);
+    }
+
+    uint32_t matchEmptyOrDeleted() const
+    {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < WIDTH; ++i)
+        {
+            mask |= (uint32_t)(m_ctrl[i] < -1) << i;
+        }
+        return mask;
+    }
+
+private:
+    const int8_t *m_ctrl;
+#endif
+};
+
+/**
+ * @brief 从map的元素中取key
+ */
+struct FlatMapKeyOf
+{
+    template <class P>
+    static const auto &get(const P &value) { return value.first; }
+};
+
+/**
+ * @brief 从set的元素中取key
+ */
+struct FlatSetKeyOf
+{
+    template <class K>
+    static const K &get(const K &value) { return value; }
+};
+
+/**
+ * @brief 开放寻址哈希表
+ * @details 元素连续存放在槽位数组中，另有一个控制字节数组，每个槽位一个字节，16个一组。
+ *          查找时用哈希值高位选组、低7位与整组控制字节做SIMD比较，只对匹配的槽位比较key；
+ *          组内有空槽即停止探测，组间按三角数序列跳跃。
+ *          最大负载7/8，删除时所在组仍有空槽则直接置空，否则留下墓碑，墓碑在扩容/重建时清除。
+ *          插入和扩容会使迭代器和元素引用失效。
+ */
+template <class K, class Value, class KeyOf, class Hash, class Eq>
+class FlatHashTable
+{
+public:
+    typedef K key_type;
+    typedef Value value_type;
+    typedef size_t size_type;
+    typedef Hash hasher;
+    typedef Eq key_equal;
+
+    template <bool Const>
+    class Iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename FlatHashTable::value_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef typename std::conditional<Const, const value_type *, value_type *>::type pointer;
+        typedef typename std::conditional<Const, const value_type &, value_type &>::type reference;
+
+        Iterator() = default;
+        // 非const迭代器可隐式转换为const迭代器
+        template <bool C = Const, class = typename std::enable_if<C>::type>
+        Iterator(const Iterator<false> &other) : m_table(other.m_table), m_index(other.m_index) {}
+
+        reference operator*() const { return m_table->m_slots[m_index]; }
+        pointer operator->() const { return &m_table->m_slots[m_index]; }
+
+        Iterator &operator++()
+        {
+            m_index = m_table->nextFull(m_index + 1);
+            return *this;
+        }
+
+        Iterator operator++(int)
+        {
+            Iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        bool operator==(const Iterator &other) const { return m_index == other.m_index; }
+        bool operator!=(const Iterator &other) const { return m_index != other.m_index; }
+
+    private:
+        friend class FlatHashTable;
+        friend class Iterator<!Const>;
+        typedef typename std::conditional<Const, const FlatHashTable *, FlatHashTable *>::type TablePtr;
+
+        Iterator(TablePtr table, size_t index) : m_table(table), m_index(index) {}
+
+        TablePtr m_table = nullptr;
+        size_t m_index = 0;
+    };
+
+    typedef Iterator<false> iterator;
+    typedef Iterator<true> const_iterator;
+
+    FlatHashTable() = default;
+
+    explicit FlatHashTable(size_t count)
+    {
+        reserve(count);
+    }
+
+    FlatHashTable(const FlatHashTable &other)
+    {
+        reserve(other.m_size);
+        for (auto &i : other)
+        {
+            insertUnique(i);
+        }
+    }
+
+    FlatHashTable(FlatHashTable &&other) noexcept
+    {
+        swap(other);
+    }
+
+    FlatHashTable &operator=(const FlatHashTable &other)
+    {
+        if (this != &other)
+        {
+            FlatHashTable tmp(other);
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    FlatHashTable &operator=(FlatHashTable &&other) noexcept
+    {
+        if (this != &other)
+        {
+            destroy();
+            swap(other);
+        }
+        return *this;
+    }
+
+    ~FlatHashTable()
+    {
+        destroy();
+    }
+
+    void swap(FlatHashTable &other) noexcept
+    {
+        std::swap(m_ctrl, other.m_ctrl);
+        std::swap(m_slots, other.m_slots);
+        std::swap(m_capacity, other.m_capacity);
+        std::swap(m_size, other.m_size);
+        std::swap(m_growth_left, other.m_growth_left);
+    }
+
+    iterator begin() { return iterator(this, nextFull(0)); }
+    iterator end() { return iterator(this, m_capacity); }
+    const_iterator begin() const { return const_iterator(this, nextFull(0)); }
+    const_iterator end() const { return const_iterator(this, m_capacity); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    /**
+     * @brief 槽位数
+     */
+    size_t bucket_count() const { return m_capacity; }
+    float load_factor() const { return m_capacity ? (float)m_size / m_capacity : 0.0f; }
+
+    /**
+     * @brief 表本身占用的内存(槽位+控制字节)，不含元素内部再申请的内存
+     */
+    size_t memoryUsage() const { return m_capacity * (sizeof(value_type) + 1); }
+
+    void clear()
+    {
+        for (size_t i = 0; i < m_capacity; ++i)
+        {
+            if (m_ctrl[i] >= 0)
+            {
+                m_slots[i].~value_type();
+            }
+            m_ctrl[i] = FLAT_CTRL_EMPTY;
+        }
+        m_size = 0;
+        m_growth_left = GrowthOf(m_capacity);
+    }
+
+    /**
+     * @brief 预留至少能容纳count个元素而不扩容的空间
+     */
+    void reserve(size_t count)
+    {
+        size_t cap = FlatGroup::WIDTH;
+        while (GrowthOf(cap) < count)
+        {
+            cap <<= 1;
+        }
+        if (cap > m_capacity)
+        {
+            rehash(cap);
+        }
+    }
+
+    template <class Q, class H = Hash, class E = Eq,
+              class = typename H::is_transparent, class = typename E::is_transparent>
+    iterator find(const Q &key)
+    {
+        return iterator(this, findIndex(key));
+    }
+
+    template <class Q, class H = Hash, class E = Eq,
+              class = typename H::is_transparent, class = typename E::is_transparent>
+    const_iterator find(const Q &key) const
+    {
+        return const_iterator(this, findIndex(key));
+    }
+
+    iterator find(const key_type &key) { return iterator(this, findIndex(key)); }
+    const_iterator find(const key_type &key) const { return const_iterator(this, findIndex(key)); }
+
+    template <class Q>
+    size_t count(const Q &key) const { return find(key) != end(); }
+
+    template <class Q>
+    bool contains(const Q &key) const { return find(key) != end(); }
+
+    std::pair<iterator, bool> insert(const value_type &value)
+    {
+        return emplaceWithKey(KeyOf::get(value), value);
+    }
+
+    std::pair<iterator, bool> insert(value_type &&value)
+    {
+        return emplaceWithKey(KeyOf::get(value), std::move(value));
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&...args)
+    {
+        // 先构造再查找，key已存在时丢弃
+        value_type value(std::forward<Args>(args)...);
+        return emplaceWithKey(KeyOf::get(value), std::move(value));
+    }
+
+    template <class Q, class H = Hash, class E = Eq,
+              class = typename H::is_transparent, class = typename E::is_transparent>
+    size_t erase(const Q &key)
+    {
+        return eraseKey(key);
+    }
+
+    size_t erase(const key_type &key)
+    {
+        return eraseKey(key);
+    }
+
+    /**
+     * @brief 删除迭代器指向的元素，返回下一个元素的迭代器
+     */
+    iterator erase(const_iterator pos)
+    {
+        eraseIndex(pos.m_index);
+        return iterator(this, nextFull(pos.m_index + 1));
+    }
+
+    iterator erase(iterator pos)
+    {
+        return erase(const_iterator(pos));
+    }
+
+protected:
+    /**
+     * @brief 查找key，不存在时用args在空槽上构造元素
+     */
+    template <class Q, class... Args>
+    std::pair<iterator, bool> emplaceWithKey(const Q &key, Args &&...args)
+    {
+        size_t hash = hashOf(key);
+        size_t index = findIndex(key, hash);
+        if (index != m_capacity)
+        {
+            return std::make_pair(iterator(this, index), false);
+        }
+        index = prepareInsert(hash);
+        new (&m_slots[index]) value_type(std::forward<Args>(args)...);
+        return std::make_pair(iterator(this, index), true);
+    }
+
+    void insertUnique(const value_type &value)
+    {
+        size_t index = prepareInsert(hashOf(KeyOf::get(value)));
+        new (&m_slots[index]) value_type(value);
+    }
+
+private:
+    static size_t GrowthOf(size_t capacity) { return capacity - capacity / 8; }
+
+    static int8_t H2(size_t hash) { return (int8_t)(hash & 0x7f); }
+
+    template <class Q>
+    size_t hashOf(const Q &key) const
+    {
+        // 标准库整数哈希是恒等映射，乘法混合后高位才有区分度
+        unsigned __int128 r = (unsigned __int128)Hash()(key) * 0x9E3779B97F4A7C15ull;
+        return (size_t)r ^ (size_t)(r >> 64);
+    }
+
+    template <class Q>
+    size_t findIndex(const Q &key) const
+    {
+        return m_capacity ? findIndex(key, hashOf(key)) : m_capacity;
+    }
+
+    template <class Q>
+    size_t findIndex(const Q &key, size_t hash) const
+    {
+        if (!m_capacity)
+        {
+            return 0;
+        }
+        size_t group_mask = m_capacity / FlatGroup::WIDTH - 1;
+        size_t group = (hash >> 7) & group_mask;
+        int8_t h2 = H2(hash);
+        for (size_t step = 1;; ++step)
+        {
+            size_t base = group * FlatGroup::WIDTH;
+            FlatGroup g(m_ctrl + base);
+            for (uint32_t mask = g.match(h2); mask; mask &= mask - 1)
+            {
+                size_t index = base + __builtin_ctz(mask);
+                if (Eq()(KeyOf::get(m_slots[index]), key))
+                {
+                    return index;
+                }
+            }
+            if (g.matchEmpty())
+            {
+                return m_capacity;
+            }
+            group = (group + step) & group_mask;
+        }
+    }
+
+    /**
+     * @brief 为新元素找到空槽并写好控制字节，必要时先扩容
+     */
+    size_t prepareInsert(size_t hash)
+    {
+        if (m_growth_left == 0)
+        {
+            // 墓碑较多时原地重建即可，否则翻倍
+            size_t cap = m_capacity ? m_capacity : FlatGroup::WIDTH;
+            rehash(m_size + 1 > GrowthOf(cap) / 2 ? cap * 2 : cap);
+        }
+        size_t group_mask = m_capacity / FlatGroup::WIDTH - 1;
+        size_t group = (hash >> 7) & group_mask;
+        for (size_t step = 1;; ++step)
+        {
+            size_t base = group * FlatGroup::WIDTH;
+            uint32_t mask = FlatGroup(m_ctrl + base).matchEmptyOrDeleted();
+            if (mask)
+            {
+                size_t index = base + __builtin_ctz(mask);
+                if (m_ctrl[index] == FLAT_CTRL_EMPTY)
+                {
+                    --m_growth_left;
+                }
+                m_ctrl[index] = H2(hash);
+                ++m_size;
+                return index;
+            }
+            group = (group + step) & group_mask;
+        }
+    }
+
+    template <class Q>
+    size_t eraseKey(const Q &key)
+    {
+        size_t index = findIndex(key);
+        if (index == m_capacity)
+        {
+            return 0;
+        }
+        eraseIndex(index);
+        return 1;
+    }
+
+    void eraseIndex(size_t index)
+    {
+        m_slots[index].~value_type();
+        --m_size;
+        size_t base = index / FlatGroup::WIDTH * FlatGroup::WIDTH;
+        // 组内仍有空槽说明没有探测序列越过本组，可以直接置空
+        if (FlatGroup(m_ctrl + base).matchEmpty())
+        {
+            m_ctrl[index] = FLAT_CTRL_EMPTY;
+            ++m_growth_left;
+        }
+        else
+        {
+            m_ctrl[index] = FLAT_CTRL_DELETED;
+        }
+    }
+
+    size_t nextFull(size_t index) const
+    {
+        while (index < m_capacity && m_ctrl[index] < 0)
+        {
+            ++index;
+        }
+        return index;
+    }
+
+    void rehash(size_t capacity)
+    {
+        int8_t *old_ctrl = m_ctrl;
+        value_type *old_slots = m_slots;
+        size_t old_capacity = m_capacity;
+
+        m_ctrl = new int8_t[capacity];
+        m_slots = static_cast<value_type *>(::operator new(capacity * sizeof(value_type), std::align_val_t(alignof(value_type))));
+        m_capacity = capacity;
+        m_size = 0;
+        m_growth_left = GrowthOf(capacity);
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            m_ctrl[i] = FLAT_CTRL_EMPTY;
+        }
+
+        for (size_t i = 0; i < old_capacity; ++i)
+        {
+            if (old_ctrl[i] >= 0)
+            {
+                size_t index = prepareInsert(hashOf(KeyOf::get(old_slots[i])));
+                new (&m_slots[index]) value_type(std::move(old_slots[i]));
+                old_slots[i].~value_type();
+            }
+        }
+        freeStorage(old_ctrl, old_slots);
+    }
+
+    void destroy()
+    {
+        for (size_t i = 0; i < m_capacity; ++i)
+        {
+            if (m_ctrl[i] >= 0)
+            {
+                m_slots[i].~value_type();
+            }
+        }
+        freeStorage(m_ctrl, m_slots);
+        m_ctrl = nullptr;
+        m_slots = nullptr;
+        m_capacity = 0;
+        m_size = 0;
+        m_growth_left = 0;
+    }
+
+    static void freeStorage(int8_t *ctrl, value_type *slots)
+    {
+        delete[] ctrl;
+        if (slots)
+        {
+            ::operator delete(slots, std::align_val_t(alignof(value_type)));
+        }
+    }
+
+private:
+    int8_t *m_ctrl = nullptr;
+    value_type *m_slots = nullptr;
+    size_t m_capacity = 0;    // 槽位数，0或16的2的幂倍
+    size_t m_size = 0;        // 元素数
+    size_t m_growth_left = 0; // 不扩容还能占用的空槽数
+};
+
+/**
+ * @brief 开放寻址哈希map
+ * @details 元素类型为std::pair<const K, V>，扩容时移动构造到新位置
+ */
+template <class K, class V, class Hash = FlatHash<K>, class Eq = FlatEqual<K>>
+class FlatHashMap : public FlatHashTable<K, std::pair<const K, V>, FlatMapKeyOf, Hash, Eq>
+{
+public:
+    typedef FlatHashTable<K, std::pair<const K, V>, FlatMapKeyOf, Hash, Eq> Base;
+    typedef V mapped_type;
+    typedef typename Base::iterator iterator;
+
+    using Base::Base;
+
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const K &key, Args &&...args)
+    {
+        return this->emplaceWithKey(key, std::piecewise_construct, std::forward_as_tuple(key),
+                                    std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(K &&key, Args &&...args)
+    {
+        return this->emplaceWithKey(key, std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+                                    std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    V &operator[](const K &key) { return try_emplace(key).first->second; }
+    V &operator[](K &&key) { return try_emplace(std::move(key)).first->second; }
+};
+
+/**
+ * @brief 开放寻址哈希set
+ */
+template <class K, class Hash = FlatHash<K>, class Eq = FlatEqual<K>>
+class FlatHashSet : public FlatHashTable<K, K, FlatSetKeyOf, Hash, Eq>
+{
+public:
+    typedef FlatHashTable<K, K, FlatSetKeyOf, Hash, Eq> Base;
+    using Base::Base;
+};
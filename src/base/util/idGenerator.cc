@@ -0,0 +1,178 @@
+#include <sched.h>
+#include <algorithm>
+#include "idGenerator.h"
+#include "log.h"
+
+static_assert(1 + ID_TIMESTAMP_BITS + ID_NODE_BITS + ID_SHARD_BITS + ID_SEQUENCE_BITS == 64,
+              "id fields must fill 63 bits");
+
+static Logger::ptr g_logger = LOG_NAME("system");
+
+/// 最后一个分片保留给共享分配器
+#define ID_SHARED_SHARD (ID_MAX_SHARDS - 1)
+
+/**
+ * @brief 线程占用的分配器，线程退出时归还分片
+ */
+struct LocalIdAllocator
+{
+    IdGenerator *generator = nullptr;
+    IdAllocator::ptr allocator;
+};
+
+static thread_local LocalIdAllocator t_allocator;
+
+IdAllocator::IdAllocator(IdGenerator *generator, U32_t shard, U64_t last_ms)
+    : m_generator(generator),
+      m_shard(shard),
+      m_prefix(((U64_t)generator->getNodeId() << ID_NODE_SHIFT) | ((U64_t)shard << ID_SHARD_SHIFT)),
+      m_last_ms(last_ms),
+      m_seq(ID_SEQUENCE_LIMIT)
+{
+}
+
+IdAllocator::~IdAllocator()
+{
+    m_generator->release(m_shard, m_last_ms);
+}
+
+void IdAllocator::borrow(U64_t now)
+{
+    // 缓存时间可能落后，超前的判断和等待都使用精确时间
+    now = std::max(now, m_generator->currentMs());
+    if (m_last_ms >= now + ID_MAX_BORROW_MS)
+    {
+        // 持续超过每毫秒的容量，等待单调时钟追上，时间戳不会偏离太远
+        LOG_WARNING_RATELIMIT(g_logger, 1) << "id shard " << m_shard << " exhausted, ahead of clock "
+                                           << m_last_ms - now << "ms";
+        while (m_last_ms >= now + ID_MAX_BORROW_MS)
+        {
+            sched_yield();
+            now = m_generator->currentMs();
+        }
+    }
+    m_last_ms = std::max(m_last_ms + 1, now);
+    m_seq = 0;
+}
+
+size_t IdAllocator::reserve(size_t n, U64_t &first)
+{
+    if (n == 0)
+    {
+        return 0;
+    }
+    refresh();
+    size_t count = std::min<size_t>(n, ID_SEQUENCE_LIMIT - m_seq);
+    first = (m_last_ms << ID_TIMESTAMP_SHIFT) | m_prefix | m_seq;
+    m_seq += count;
+    return count;
+}
+
+///------------------------------------------------------------------
+
+IdGenerator::IdGenerator()
+{
+    m_base_ms = Clock::WallMs() - Clock::NowMs() - ID_EPOCH_MS;
+    for (auto &ms : m_shard_ms)
+    {
+        ms.store(0, std::memory_order_relaxed);
+    }
+    m_used.store(1u << ID_SHARED_SHARD, std::memory_order_relaxed);
+    m_shared.reset(new IdAllocator(this, ID_SHARED_SHARD, 0));
+}
+
+bool IdGenerator::init(U32_t node_id, U64_t floor_id)
+{
+    if (node_id > ID_MAX_NODE)
+    {
+        LOG_ERROR(g_logger) << "id node " << node_id << " out of range, max " << ID_MAX_NODE;
+        return false;
+    }
+    MutexType::Lock lock(m_shared_mutex);
+    m_node_id = node_id;
+    U64_t floor_ms = floor_id >> ID_TIMESTAMP_SHIFT;
+    if (floor_ms >= currentMs())
+    {
+        LOG_WARNING(g_logger) << "id floor " << floor_id << " is " << floor_ms - currentMs()
+                              << "ms ahead of clock, wall clock moved backwards";
+    }
+    for (auto &ms : m_shard_ms)
+    {
+        ms.store(floor_ms, std::memory_order_relaxed);
+    }
+    // 析构时把分片归还到位图，重新占用以使用新的节点id
+    m_shared.reset();
+    m_used.fetch_or(1u << ID_SHARED_SHARD, std::memory_order_acquire);
+    m_shared.reset(new IdAllocator(this, ID_SHARED_SHARD, floor_ms));
+    return true;
+}
+
+IdAllocator::ptr IdGenerator::acquire()
+{
+    U32_t used = m_used.load(std::memory_order_relaxed);
+    while (~used)
+    {
+        U32_t shard = __builtin_ctz(~used);
+        if (m_used.compare_exchange_weak(used, used | (1u << shard), std::memory_order_acquire))
+        {
+            return IdAllocator::ptr(new IdAllocator(this, shard, m_shard_ms[shard].load(std::memory_order_relaxed)));
+        }
+    }
+    return nullptr;
+}
+
+IdAllocator::ptr IdGenerator::acquire(U32_t shard)
+{
+    if (shard >= ID_SHARED_SHARD)
+    {
+        return nullptr;
+    }
+    U32_t bit = 1u << shard;
+    if (m_used.fetch_or(bit, std::memory_order_acquire) & bit)
+    {
+        return nullptr;
+    }
+    return IdAllocator::ptr(new IdAllocator(this, shard, m_shard_ms[shard].load(std::memory_order_relaxed)));
+}
+
+void IdGenerator::release(U32_t shard, U64_t last_ms)
+{
+    m_shard_ms[shard].store(last_ms, std::memory_order_relaxed);
+    m_used.fetch_and(~(1u << shard), std::memory_order_release);
+}
+
+IdAllocator *IdGenerator::localAllocator()
+{
+    if (t_allocator.generator != this)
+    {
+        t_allocator.generator = this;
+        t_allocator.allocator = acquire();
+        if (!t_allocator.allocator)
+        {
+            LOG_WARNING(g_logger) << "id shards exhausted, thread falls back to the shared allocator";
+        }
+    }
+    return t_allocator.allocator.get();
+}
+
+U64_t IdGenerator::nextId()
+{
+    IdAllocator *allocator = localAllocator();
+    if (allocator)
+    {
+        return allocator->next();
+    }
+    MutexType::Lock lock(m_shared_mutex);
+    return m_shared->next();
+}
+
+size_t IdGenerator::reserve(size_t n, U64_t &first)
+{
+    IdAllocator *allocator = localAllocator();
+    if (allocator)
+    {
+        return allocator->reserve(n, first);
+    }
+    MutexType::Lock lock(m_shared_mutex);
+    return m_shared->reserve(n, first);
+}
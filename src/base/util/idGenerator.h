@@ -0,0 +1,188 @@
+/**
+ * @file idGenerator.h
+ * @brief 全局有序的64位消息id生成器(snowflake)
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include "ostype.h"
+#include "mutex.h"
+#include "clock.h"
+#include "singleton.h"
+#include "noncopyble.h"
+
+/// id中时间戳的起点，2024-01-01 00:00:00 UTC(ms)
+#define ID_EPOCH_MS 1704067200000ull
+/// 各字段位数，最高位保留为0：| 0 | 时间戳40 | 节点6 | 分片5 | 序号12 |
+#define ID_TIMESTAMP_BITS 40
+#define ID_NODE_BITS 6
+#define ID_SHARD_BITS 5
+#define ID_SEQUENCE_BITS 12
+
+#define ID_SHARD_SHIFT ID_SEQUENCE_BITS
+#define ID_NODE_SHIFT (ID_SHARD_SHIFT + ID_SHARD_BITS)
+#define ID_TIMESTAMP_SHIFT (ID_NODE_SHIFT + ID_NODE_BITS)
+#define ID_MAX_NODE ((1u << ID_NODE_BITS) - 1)
+#define ID_MAX_SHARDS (1u << ID_SHARD_BITS)
+/// 每个分片每毫秒可分配的序号数
+#define ID_SEQUENCE_LIMIT (1u << ID_SEQUENCE_BITS)
+/// 序号用完时借用后续毫秒的上限，超过后等待时钟追上
+#define ID_MAX_BORROW_MS 100
+
+class IdGenerator;
+
+/**
+ * @brief 独占一个分片的id分配器，只能由一个线程(事件循环)使用，分配时没有任何共享写
+ * @details 时间戳取本线程的缓存时间，不读时钟；同一毫秒内序号递增，序号用完时借用下一毫秒，
+ *          突发超过每毫秒ID_SEQUENCE_LIMIT个时不阻塞，超前精确时间ID_MAX_BORROW_MS后才等待时钟。
+ */
+class IdAllocator : Noncopyble
+{
+public:
+    typedef std::shared_ptr<IdAllocator> ptr;
+
+    ~IdAllocator();
+
+    /**
+     * @brief 分配一个id，同一分配器返回的id严格递增
+     */
+    U64_t next()
+    {
+        refresh();
+        return (m_last_ms << ID_TIMESTAMP_SHIFT) | m_prefix | m_seq++;
+    }
+
+    /**
+     * @brief 预留一段连续的id，[first, first + 返回值)
+     * @details 一段id位于同一毫秒内，最多预留到当前毫秒的序号用完，需要更多时再次调用
+     * @return 预留的个数，n为0时返回0
+     */
+    size_t reserve(size_t n, U64_t &first);
+
+    U32_t getShard() const { return m_shard; }
+
+private:
+    friend class IdGenerator;
+
+    IdAllocator(IdGenerator *generator, U32_t shard, U64_t last_ms);
+
+    void refresh();
+
+    /**
+     * @brief 当前毫秒序号用完，切换到下一毫秒
+     */
+    void borrow(U64_t now);
+
+private:
+    IdGenerator *m_generator;
+    U32_t m_shard;
+    U64_t m_prefix;  // 节点和分片字段
+    U64_t m_last_ms; // 当前分配的毫秒，相对ID_EPOCH_MS
+    U32_t m_seq;     // 下一个序号
+};
+
+/**
+ * @brief id生成器
+ * @details id由时间戳、节点id、分片id和序号组成，不同节点、不同分片的id互不重复，按时间大致有序。
+ *          每个事件循环通过acquire()独占一个分片，分配id只读时钟、不访问共享变量；
+ *          其他线程调用nextId()时首次自动占用一个分片保存在线程局部变量中，分片用完后退化为加锁的共享分配器。
+ *          时间戳使用启动时的墙上时间加单调时间，运行期间校时回拨不影响id递增；
+ *          重启时墙上时间可能回拨，init()传入持久化的最大id，之后的id都大于它。
+ */
+class IdGenerator : Noncopyble
+{
+public:
+    typedef Mutex MutexType;
+
+    IdGenerator();
+
+    /**
+     * @brief 设置节点id，需要在分配id之前调用
+     * @param[in] node_id 节点id，集群内唯一，不超过ID_MAX_NODE
+     * @param[in] floor_id 已经分配过的最大id，0表示没有
+     */
+    bool init(U32_t node_id, U64_t floor_id = 0);
+
+    /**
+     * @brief 占用一个空闲分片
+     * @return 分片用完返回nullptr
+     */
+    IdAllocator::ptr acquire();
+
+    /**
+     * @brief 占用指定分片，一般传入事件循环id
+     * @return 分片已被占用或超出范围返回nullptr
+     */
+    IdAllocator::ptr acquire(U32_t shard);
+
+    /**
+     * @brief 在当前线程的分配器上分配id
+     */
+    U64_t nextId();
+
+    /**
+     * @brief 在当前线程的分配器上预留连续的id，见IdAllocator::reserve()
+     */
+    size_t reserve(size_t n, U64_t &first);
+
+    U32_t getNodeId() const { return m_node_id; }
+
+    /**
+     * @brief 当前时间，相对ID_EPOCH_MS的毫秒数
+     */
+    U64_t currentMs() const { return Clock::NowMs() + m_base_ms; }
+
+    /**
+     * @brief 本线程缓存的当前时间，事件循环同一轮内分配的id共享时间戳
+     */
+    U64_t cachedMs() const { return Clock::CachedMs() + m_base_ms; }
+
+    /**
+     * @brief id中的unix时间(ms)
+     */
+    static U64_t GetTimestamp(U64_t id) { return (id >> ID_TIMESTAMP_SHIFT) + ID_EPOCH_MS; }
+    static U32_t GetNodeId(U64_t id) { return (id >> ID_NODE_SHIFT) & ID_MAX_NODE; }
+    static U32_t GetShard(U64_t id) { return (id >> ID_SHARD_SHIFT) & (ID_MAX_SHARDS - 1); }
+    static U32_t GetSequence(U64_t id) { return id & (ID_SEQUENCE_LIMIT - 1); }
+
+private:
+    friend class IdAllocator;
+
+    /**
+     * @brief 归还分片，记录分片最后使用的毫秒，再次占用时从下一毫秒开始
+     */
+    void release(U32_t shard, U64_t last_ms);
+
+    /**
+     * @brief 当前线程的分配器，没有可用分片时返回nullptr
+     */
+    IdAllocator *localAllocator();
+
+private:
+    U32_t m_node_id = 0;
+    U64_t m_base_ms = 0; // 墙上时间 - 单调时间 - ID_EPOCH_MS
+    std::atomic<U32_t> m_used{0}; // 已占用分片的位图
+    std::atomic<U64_t> m_shard_ms[ID_MAX_SHARDS];
+
+    MutexType m_shared_mutex;
+    IdAllocator::ptr m_shared; // 分片用完后各线程共享的分配器
+};
+
+typedef Singleton<IdGenerator> IdMgr;
+
+inline void IdAllocator::refresh()
+{
+    U64_t now = m_generator->cachedMs();
+    if (now > m_last_ms)
+    {
+        m_last_ms = now;
+        m_seq = 0;
+    }
+    else if (m_seq >= ID_SEQUENCE_LIMIT)
+    {
+        borrow(now);
+    }
+}
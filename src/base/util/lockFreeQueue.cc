@@ -0,0 +1,108 @@
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <limits.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "lockFreeQueue.h"
+
+static long Futex(std::atomic<uint32_t> *addr, int op, uint32_t val, const timespec *timeout)
+{
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), op, val, timeout, nullptr, 0);
+}
+
+void FutexWaiter::notify()
+{
+    m_seq.fetch_add(1, std::memory_order_release);
+    // 与wait中登记睡眠者配对，保证入队对睡眠者可见或睡眠者能看到seq变化
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_waiters.load(std::memory_order_relaxed))
+    {
+        Futex(&m_seq, FUTEX_WAKE_PRIVATE, 1, nullptr);
+    }
+}
+
+void FutexWaiter::notifyAll()
+{
+    m_seq.fetch_add(1, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_waiters.load(std::memory_order_relaxed))
+    {
+        Futex(&m_seq, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr);
+    }
+}
+
+bool FutexWaiter::sleep(uint32_t seq, int64_t timeout_us)
+{
+    timespec ts;
+    timespec *pts = nullptr;
+    if (timeout_us >= 0)
+    {
+        ts.tv_sec = timeout_us / 1000000;
+        ts.tv_nsec = (timeout_us % 1000000) * 1000L;
+        pts = &ts;
+    }
+    // seq已变化时内核返回EAGAIN，视为已被唤醒
+    long ret = Futex(&m_seq, FUTEX_WAIT_PRIVATE, seq, pts);
+    return !(ret == -1 && errno == ETIMEDOUT);
+}
+
+///------------------------------------------------------------------
+
+EventFdWaiter::EventFdWaiter()
+{
+    m_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_fd < 0)
+    {
+        throw std::runtime_error("eventfd error");
+    }
+}
+
+EventFdWaiter::~EventFdWaiter()
+{
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+}
+
+void EventFdWaiter::notify()
+{
+    // 与drain中的fence配对：要么这里看到通知已清除并写fd，要么消费者看到新元素
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_signaled.exchange(true, std::memory_order_acq_rel))
+    {
+        return;
+    }
+    uint64_t one = 1;
+    ssize_t ret = ::write(m_fd, &one, sizeof(one));
+    (void)ret;
+}
+
+void EventFdWaiter::drain()
+{
+    // 先读空fd再清除标记，清除之后的notify一定会重新写fd
+    uint64_t val = 0;
+    ssize_t ret = ::read(m_fd, &val, sizeof(val));
+    (void)ret;
+    m_signaled.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+bool EventFdWaiter::sleep(int timeout_ms)
+{
+    pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int ret = ::poll(&pfd, 1, timeout_ms);
+    if (ret <= 0)
+    {
+        return false;
+    }
+    drain();
+    return true;
+}
@@ -0,0 +1,546 @@
+/**
+ * @file lockFreeQueue.h
+ * @brief 无锁队列及配套的等待策略
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include "clock.h"
+#include "noncopyble.h"
+
+/// 缓存行大小，队列的生产者/消费者下标分别独占一行，避免伪共享
+#define CACHE_LINE_SIZE 64
+
+/**
+ * @brief 容量向上取整到2的幂
+ */
+inline size_t QueueRoundCapacity(size_t capacity)
+{
+    size_t cap = 2;
+    while (cap < capacity)
+    {
+        cap <<= 1;
+    }
+    return cap;
+}
+
+/**
+ * @brief 有界单生产者单消费者环形队列
+ * @details 生产者只写tail、消费者只写head，各自缓存对方下标，
+ *          只有缓存值显示队列满/空时才读取对方的原子变量。
+ *          批量接口一次发布整批下标，N个元素只需一次release写。
+ */
+template <class T>
+class SpscQueue : Noncopyble
+{
+public:
+    explicit SpscQueue(size_t capacity)
+        : m_capacity(QueueRoundCapacity(capacity)),
+          m_mask(m_capacity - 1),
+          m_slots(new Slot[m_capacity])
+    {
+    }
+
+    ~SpscQueue()
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        for (; head != tail; ++head)
+        {
+            m_slots[head & m_mask].get()->~T();
+        }
+    }
+
+    template <class... Args>
+    bool tryEmplace(Args &&...args)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head_cache >= m_capacity)
+        {
+            m_head_cache = m_head.load(std::memory_order_acquire);
+            if (tail - m_head_cache >= m_capacity)
+            {
+                return false;
+            }
+        }
+        new (m_slots[tail & m_mask].get()) T(std::forward<Args>(args)...);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPush(const T &value) { return tryEmplace(value); }
+    bool tryPush(T &&value) { return tryEmplace(std::move(value)); }
+
+    bool tryPop(T &out)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail_cache)
+        {
+            m_tail_cache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tail_cache)
+            {
+                return false;
+            }
+        }
+        T *slot = m_slots[head & m_mask].get();
+        out = std::move(*slot);
+        slot->~T();
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 批量入队，元素被移走
+     * @return 实际入队的个数
+     */
+    size_t pushBatch(T *items, size_t count)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t free = m_capacity - (tail - m_head_cache);
+        if (free < count)
+        {
+            m_head_cache = m_head.load(std::memory_order_acquire);
+            free = m_capacity - (tail - m_head_cache);
+        }
+        size_t n = count < free ? count : free;
+        for (size_t i = 0; i < n; ++i)
+        {
+            new (m_slots[(tail + i) & m_mask].get()) T(std::move(items[i]));
+        }
+        m_tail.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    /**
+     * @brief 批量出队，最多取max个
+     * @return 实际出队的个数
+     */
+    size_t popBatch(T *out, size_t max)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t avail = m_tail_cache - head;
+        if (avail < max)
+        {
+            m_tail_cache = m_tail.load(std::memory_order_acquire);
+            avail = m_tail_cache - head;
+        }
+        size_t n = max < avail ? max : avail;
+        for (size_t i = 0; i < n; ++i)
+        {
+            T *slot = m_slots[(head + i) & m_mask].get();
+            out[i] = std::move(*slot);
+            slot->~T();
+        }
+        m_head.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    /**
+     * @brief 近似元素数，并发修改时只作参考
+     */
+    size_t sizeApprox() const
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    bool empty() const { return sizeApprox() == 0; }
+    size_t capacity() const { return m_capacity; }
+
+private:
+    struct Slot
+    {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        T *get() { return reinterpret_cast<T *>(&storage); }
+    };
+
+    const size_t m_capacity;
+    const size_t m_mask;
+    std::unique_ptr<Slot[]> m_slots;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_head{0}; // 消费者写
+    size_t m_tail_cache = 0;                                 // 消费者缓存的tail
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_tail{0}; // 生产者写
+    size_t m_head_cache = 0;                                 // 生产者缓存的head
+    char m_pad[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+};
+
+/**
+ * @brief 有界多生产者多消费者环形队列(Vyukov)
+ * @details 每个槽位带一个序号：序号等于入队位置表示可写，等于位置+1表示可读，
+ *          生产者/消费者各自CAS推进tail/head抢占位置，抢到后只访问自己的槽位。
+ *          批量接口逐个抢占，省去的是调用方的循环和唤醒次数。
+ */
+template <class T>
+class MpmcQueue : Noncopyble
+{
+public:
+    explicit MpmcQueue(size_t capacity)
+        : m_capacity(QueueRoundCapacity(capacity)),
+          m_mask(m_capacity - 1),
+          m_slots(new Slot[m_capacity])
+    {
+        for (size_t i = 0; i < m_capacity; ++i)
+        {
+            m_slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~MpmcQueue()
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        for (size_t pos = m_head.load(std::memory_order_relaxed); pos != tail; ++pos)
+        {
+            Slot &slot = m_slots[pos & m_mask];
+            if (slot.seq.load(std::memory_order_relaxed) == pos + 1)
+            {
+                slot.get()->~T();
+            }
+        }
+    }
+
+    template <class... Args>
+    bool tryEmplace(Args &&...args)
+    {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        Slot *slot;
+        for (;;)
+        {
+            slot = &m_slots[pos & m_mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // 队列满
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+        new (slot->get()) T(std::forward<Args>(args)...);
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPush(const T &value) { return tryEmplace(value); }
+    bool tryPush(T &&value) { return tryEmplace(std::move(value)); }
+
+    bool tryPop(T &out)
+    {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        Slot *slot;
+        for (;;)
+        {
+            slot = &m_slots[pos & m_mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // 队列空
+            }
+            else
+            {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+        T *value = slot->get();
+        out = std::move(*value);
+        value->~T();
+        slot->seq.store(pos + m_capacity, std::memory_order_release);
+        return true;
+    }
+
+    size_t pushBatch(T *items, size_t count)
+    {
+        size_t n = 0;
+        while (n < count && tryPush(std::move(items[n])))
+        {
+            ++n;
+        }
+        return n;
+    }
+
+    size_t popBatch(T *out, size_t max)
+    {
+        size_t n = 0;
+        while (n < max && tryPop(out[n]))
+        {
+            ++n;
+        }
+        return n;
+    }
+
+    size_t sizeApprox() const
+    {
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        size_t head = m_head.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+    bool empty() const { return sizeApprox() == 0; }
+    size_t capacity() const { return m_capacity; }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        T *get() { return reinterpret_cast<T *>(&storage); }
+    };
+
+    const size_t m_capacity;
+    const size_t m_mask;
+    std::unique_ptr<Slot[]> m_slots;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_head{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_tail{0};
+    char m_pad[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+};
+
+/**
+ * @brief 无界多生产者单消费者链表队列(Vyukov)
+ * @details 生产者一次原子exchange挂到链表尾，不会失败也不会自旋；
+ *          消费者持有一个哨兵节点，取走哨兵后继节点的值后把后继当作新的哨兵。
+ *          生产者exchange之后、链上next之前被挂起时，消费者会暂时看到队列为空。
+ */
+template <class T>
+class MpscQueue : Noncopyble
+{
+public:
+    MpscQueue()
+    {
+        Node *stub = new Node;
+        m_head.store(stub, std::memory_order_relaxed);
+        m_tail = stub;
+    }
+
+    ~MpscQueue()
+    {
+        Node *node = m_tail->next.load(std::memory_order_relaxed);
+        delete m_tail;
+        while (node)
+        {
+            Node *next = node->next.load(std::memory_order_relaxed);
+            node->get()->~T();
+            delete node;
+            node = next;
+        }
+    }
+
+    template <class... Args>
+    void emplace(Args &&...args)
+    {
+        Node *node = new Node;
+        new (node->get()) T(std::forward<Args>(args)...);
+        Node *prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    void push(const T &value) { emplace(value); }
+    void push(T &&value) { emplace(std::move(value)); }
+
+    /**
+     * @brief 出队，只能由单个消费者线程调用
+     */
+    bool tryPop(T &out)
+    {
+        Node *tail = m_tail;
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (!next)
+        {
+            return false;
+        }
+        T *value = next->get();
+        out = std::move(*value);
+        value->~T();
+        m_tail = next;
+        delete tail;
+        return true;
+    }
+
+    size_t popBatch(T *out, size_t max)
+    {
+        size_t n = 0;
+        while (n < max && tryPop(out[n]))
+        {
+            ++n;
+        }
+        return n;
+    }
+
+    /**
+     * @brief 是否为空，只能由消费者线程调用
+     */
+    bool empty() const
+    {
+        return m_tail->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    struct Node
+    {
+        std::atomic<Node *> next{nullptr};
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        T *get() { return reinterpret_cast<T *>(&storage); }
+    };
+
+    alignas(CACHE_LINE_SIZE) std::atomic<Node *> m_head; // 生产者写
+    alignas(CACHE_LINE_SIZE) Node *m_tail;               // 消费者独占
+};
+
+/**
+ * @brief 基于futex的等待策略
+ * @details 消费者在队列为空时睡眠，生产者入队后调用notify()。
+ *          只有存在睡眠者时notify才进入内核，正常高负载下生产者没有系统调用。
+ *          用法:
+ *          生产者: queue.tryPush(v); waiter.notify();
+ *          消费者: waiter.wait([&] { return !queue.empty(); });
+ */
+class FutexWaiter : Noncopyble
+{
+public:
+    /**
+     * @brief 等待ready()为真
+     * @param[in] ready 检查条件，通常为队列非空
+     * @param[in] timeout_ms 超时时间，-1表示一直等待
+     * @return 条件满足返回true，超时返回false
+     */
+    template <class Pred>
+    bool wait(Pred ready, int timeout_ms = -1)
+    {
+        while (!ready())
+        {
+            uint32_t seq = m_seq.load(std::memory_order_acquire);
+            m_waiters.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // 登记为睡眠者后再检查一次，避免与notify错过
+            if (ready())
+            {
+                m_waiters.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            bool woken = sleep(seq, timeout_ms < 0 ? -1 : (int64_t)timeout_ms * 1000);
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+            if (!woken)
+            {
+                return ready();
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief 最多等待timeout_us微秒，被唤醒后条件仍不满足时按剩余时间继续等待
+     */
+    template <class Pred>
+    bool waitUs(Pred ready, int64_t timeout_us)
+    {
+        int64_t deadline = (int64_t)Clock::NowUs() + timeout_us;
+        while (!ready())
+        {
+            int64_t left = deadline - (int64_t)Clock::NowUs();
+            if (left <= 0)
+            {
+                return ready();
+            }
+            uint32_t seq = m_seq.load(std::memory_order_acquire);
+            m_waiters.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ready())
+            {
+                m_waiters.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            sleep(seq, left);
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    /**
+     * @brief 唤醒一个等待者
+     */
+    void notify();
+
+    /**
+     * @brief 唤醒全部等待者
+     */
+    void notifyAll();
+
+private:
+    /**
+     * @brief seq未变化时睡眠，超时返回false
+     * @param[in] timeout_us 超时时间(us)，-1表示一直等待
+     */
+    bool sleep(uint32_t seq, int64_t timeout_us);
+
+private:
+    std::atomic<uint32_t> m_seq{0};
+    std::atomic<uint32_t> m_waiters{0};
+};
+
+/**
+ * @brief 基于eventfd的等待策略
+ * @details 除了wait/notify之外，fd可以直接注册到事件循环的epoll中，
+ *          队列消费者与socket事件在同一个循环里处理。
+ *          未消费的通知只写一次eventfd，消费者drain()后才会再次写入。
+ */
+class EventFdWaiter : Noncopyble
+{
+public:
+    EventFdWaiter();
+    ~EventFdWaiter();
+
+    int getFd() const { return m_fd; }
+
+    template <class Pred>
+    bool wait(Pred ready, int timeout_ms = -1)
+    {
+        while (!ready())
+        {
+            if (!sleep(timeout_ms))
+            {
+                return ready();
+            }
+        }
+        return true;
+    }
+
+    void notify();
+
+    /**
+     * @brief 清除通知状态，事件循环收到fd可读事件后、消费队列之前调用
+     */
+    void drain();
+
+private:
+    /**
+     * @brief 等待fd可读并清除通知，超时返回false
+     */
+    bool sleep(int timeout_ms);
+
+private:
+    int m_fd = -1;
+    std::atomic<bool> m_signaled{false};
+};
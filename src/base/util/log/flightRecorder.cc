@@ -0,0 +1,272 @@
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include "flightRecorder.h"
+
+// 写日志时持有的全局锁，定义在log.cc
+extern Mutex s_log_mutex;
+
+static FlightRecorderAppender::ptr s_signal_recorder;
+
+static std::atomic<uint64_t> s_recorder_ids{0};
+
+/**
+ * @brief 线程使用的各个记录器的环形缓冲区
+ * @details 按记录器id查找，一个线程同时写多个记录器时各自命中，不会反复分配。
+ *          线程退出时把ring标记为空闲，由之后的新线程复用；记录器已释放时weak_ptr失效，跳过。
+ */
+struct FlightThreadCache
+{
+    struct Item
+    {
+        uint64_t recorder_id;
+        FlightRecorderAppender::Ring *ring; // 记录器存活期间有效，记录器正在被调用时一定存活
+        std::weak_ptr<FlightRecorderAppender::Ring> owner;
+    };
+
+    std::vector<Item> items;
+
+    FlightRecorderAppender::Ring *find(uint64_t recorder_id) const
+    {
+        for (const Item &item : items)
+        {
+            if (item.recorder_id == recorder_id)
+            {
+                return item.ring;
+            }
+        }
+        return nullptr;
+    }
+
+    ~FlightThreadCache()
+    {
+        for (Item &item : items)
+        {
+            if (auto ring = item.owner.lock())
+            {
+                ring->in_use.store(false, std::memory_order_release);
+            }
+        }
+    }
+};
+
+static thread_local FlightThreadCache t_flight_cache;
+
+FlightRecorderAppender::FlightRecorderAppender(LogAppender::ptr target, uint32_t capacity,
+                                               LogLevel::Level record_level,
+                                               LogLevel::Level trigger_level)
+    : m_target(target),
+      m_capacity(capacity ? capacity : 1),
+      m_recordLevel(record_level),
+      m_triggerLevel(trigger_level),
+      m_id(++s_recorder_ids)
+{
+    m_level = LogLevel::DEBUG;
+}
+
+FlightRecorderAppender::Ring *FlightRecorderAppender::getRing(LogEvent::ptr event)
+{
+    if (Ring *ring = t_flight_cache.find(m_id))
+    {
+        return ring;
+    }
+
+    // 清理已释放记录器的缓存项
+    auto &items = t_flight_cache.items;
+    items.erase(std::remove_if(items.begin(), items.end(), [](const FlightThreadCache::Item &item)
+                               { return item.owner.expired(); }),
+                items.end());
+
+    std::shared_ptr<Ring> ring;
+    {
+        Mutex::Lock lock(m_mutex);
+        // 优先复用已退出线程的ring，其中的旧记录保留到被覆盖
+        for (auto &r : m_rings)
+        {
+            bool expected = false;
+            if (!r->in_use.load(std::memory_order_relaxed) &&
+                r->in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+            {
+                ring = r;
+                break;
+            }
+        }
+        if (!ring)
+        {
+            ring = std::make_shared<Ring>();
+            ring->records.reset(new Record[m_capacity]);
+            m_rings.push_back(ring);
+        }
+        ring->thread_id = GetThreadId();
+        ring->thread_name = event->getThreadName();
+    }
+    items.push_back({m_id, ring.get(), ring});
+    return ring.get();
+}
+
+void FlightRecorderAppender::record(Ring *ring, LogLevel::Level level, LogEvent::ptr event)
+{
+    uint64_t idx = ring->head.load(std::memory_order_relaxed);
+    Record &r = ring->records[idx % m_capacity];
+    r.seq.store(idx * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    r.time = event->getTime();
+    r.file = event->getFile();
+    r.logger = event->getLogger().get();
+    r.line = event->getLine();
+    r.thread_id = ring->thread_id;
+    r.level = level;
+    r.size = event->copyContent(r.content, LOG_FLIGHT_CONTENT_SIZE);
+
+    r.seq.store(idx * 2 + 2, std::memory_order_release);
+    ring->head.store(idx + 1, std::memory_order_release);
+}
+
+template <class CB>
+void FlightRecorderAppender::visit(Ring *ring, CB cb)
+{
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t begin = head > m_capacity ? head - m_capacity : 0;
+    for (uint64_t i = begin; i < head; i++)
+    {
+        Record &r = ring->records[i % m_capacity];
+        uint64_t seq = r.seq.load(std::memory_order_acquire);
+        if (seq != i * 2 + 2)
+        {
+            continue;
+        }
+        Record copy;
+        copy.time = r.time;
+        copy.file = r.file;
+        copy.logger = r.logger;
+        copy.line = r.line;
+        copy.thread_id = r.thread_id;
+        copy.level = r.level;
+        copy.size = r.size;
+        memcpy(copy.content, r.content, copy.size);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (r.seq.load(std::memory_order_relaxed) != seq)
+        {
+            // 读取过程中被覆盖
+            continue;
+        }
+        cb(copy);
+    }
+}
+
+void FlightRecorderAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
+{
+    if (level < m_level)
+    {
+        return;
+    }
+    if (level <= m_recordLevel)
+    {
+        record(getRing(event), level, event);
+    }
+    if (level >= m_triggerLevel || m_dumpRequested.exchange(false, std::memory_order_relaxed))
+    {
+        // 已持有s_log_mutex
+        dumpLocked(logger);
+    }
+}
+
+void FlightRecorderAppender::dumpLocked(Logger::ptr logger)
+{
+    Mutex::Lock lock(m_mutex);
+    if (!m_target->getFormatter())
+    {
+        m_target->setFormatter(logger->getFormatter());
+    }
+    for (auto &ring : m_rings)
+    {
+        visit(ring.get(), [&](const Record &r)
+              {
+                  Logger::ptr owner = r.logger ? r.logger->shared_from_this() : logger;
+                  LogEvent::ptr e(new LogEvent(owner, (LogLevel::Level)r.level, r.file, r.line, 0,
+                                               r.thread_id, 0, r.time, ring->thread_name));
+                  e->getSS().write(r.content, r.size);
+                  m_target->log(owner, (LogLevel::Level)r.level, e); });
+        // 转储过的记录不再重复输出
+        ring->head.store(0, std::memory_order_release);
+    }
+}
+
+void FlightRecorderAppender::dump()
+{
+    m_dumpRequested.store(false, std::memory_order_relaxed);
+    Mutex::Lock lock(s_log_mutex);
+    dumpLocked(LOG_ROOT());
+}
+
+void FlightRecorderAppender::dumpToFd(int fd)
+{
+    static const char s_banner[] = "==== flight recorder dump ====\n";
+    ssize_t ret = ::write(fd, s_banner, sizeof(s_banner) - 1);
+    for (auto &ring : m_rings)
+    {
+        visit(ring.get(), [&](const Record &r)
+              {
+                  char buf[LOG_FLIGHT_CONTENT_SIZE + 128];
+                  size_t n = LogFmtUint(buf, r.time);
+                  buf[n++] = '\t';
+                  const char *level = LogLevel::ToString((LogLevel::Level)r.level);
+                  size_t len = strlen(level);
+                  memcpy(buf + n, level, len);
+                  n += len;
+                  buf[n++] = '\t';
+                  n += LogFmtUint(buf + n, r.thread_id);
+                  buf[n++] = '\t';
+                  len = std::min<size_t>(strlen(r.file), 64);
+                  memcpy(buf + n, r.file, len);
+                  n += len;
+                  buf[n++] = ':';
+                  n += LogFmtUint(buf + n, r.line);
+                  buf[n++] = '\t';
+                  memcpy(buf + n, r.content, r.size);
+                  n += r.size;
+                  if (buf[n - 1] != '\n')
+                  {
+                      buf[n++] = '\n';
+                  }
+                  ret = ::write(fd, buf, n); });
+    }
+    (void)ret;
+}
+
+static void FlightRecorderSignalHandler(int sig)
+{
+    FlightRecorderAppender *recorder = s_signal_recorder.get();
+    if (!recorder)
+    {
+        return;
+    }
+    switch (sig)
+    {
+    case SIGSEGV:
+    case SIGABRT:
+    case SIGBUS:
+    case SIGFPE:
+    case SIGILL:
+        recorder->dumpToFd(STDERR_FILENO);
+        signal(sig, SIG_DFL);
+        raise(sig);
+        break;
+    default:
+        recorder->requestDump();
+        break;
+    }
+}
+
+void FlightRecorderAppender::InstallSignalHandler(FlightRecorderAppender::ptr recorder, int sig)
+{
+    s_signal_recorder = recorder;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = FlightRecorderSignalHandler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(sig, &sa, nullptr);
+}
@@ -0,0 +1,115 @@
+/**
+ * @file flightRecorder.h
+ * @brief 日志飞行记录器，在内存中保留最近的低级别日志，出错时再输出
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "log.h"
+#include "mutex.h"
+
+#define LOG_FLIGHT_CONTENT_SIZE 200
+
+/**
+ * @brief 飞行记录器日志输出目标
+ * @details 每个线程一个定长环形缓冲区，按二进制记录最近capacity条不高于record_level的日志，
+ *          记录时不经过格式器，只有一次内容拷贝。
+ *          出现不低于trigger_level的日志、收到信号或调用dump()时，
+ *          把所有线程的记录格式化后写入目标输出器。
+ *          使用方式：日志器级别设为DEBUG，落盘的输出器级别设为INFO/WARNING，
+ *          再挂上本输出器，平时DEBUG日志只进内存。
+ */
+class FlightRecorderAppender : public LogAppender
+{
+public:
+    typedef std::shared_ptr<FlightRecorderAppender> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] target 转储时的目标输出器
+     * @param[in] capacity 每个线程保留的日志条数
+     * @param[in] record_level 记录的最高日志级别
+     * @param[in] trigger_level 触发转储的最低日志级别
+     */
+    FlightRecorderAppender(LogAppender::ptr target, uint32_t capacity = 1024,
+                           LogLevel::Level record_level = LogLevel::INFO,
+                           LogLevel::Level trigger_level = LogLevel::ERROR);
+
+    void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
+
+    /**
+     * @brief 将所有线程的记录格式化后写入目标输出器并清空，供管理接口调用
+     */
+    void dump();
+
+    /**
+     * @brief 请求在下一次写日志时转储，可在信号处理函数中调用
+     */
+    void requestDump() { m_dumpRequested.store(true, std::memory_order_relaxed); }
+
+    /**
+     * @brief 以最简格式把记录直接写入fd，只使用write，供崩溃信号处理函数使用
+     */
+    void dumpToFd(int fd);
+
+    /**
+     * @brief 安装信号处理
+     * @details SIGUSR1/SIGUSR2 等管理信号只设置转储标记；
+     *          SIGSEGV/SIGABRT/SIGBUS/SIGFPE/SIGILL 直接写stderr后按默认行为重新触发
+     */
+    static void InstallSignalHandler(FlightRecorderAppender::ptr recorder, int sig);
+
+private:
+    /**
+     * @brief 二进制日志记录
+     */
+    struct Record
+    {
+        std::atomic<uint64_t> seq{0}; // 写入中为奇数
+        uint64_t time;
+        const char *file;
+        Logger *logger;
+        int32_t line;
+        uint32_t thread_id;
+        uint8_t level;
+        uint16_t size;
+        char content[LOG_FLIGHT_CONTENT_SIZE];
+    };
+
+    /**
+     * @brief 单个线程的环形缓冲区
+     */
+    struct Ring
+    {
+        uint32_t thread_id = 0;
+        std::string thread_name;
+        std::atomic<uint64_t> head{0}; // 已写入的记录总数
+        std::atomic<bool> in_use{true}; // 线程退出后置为false，由新线程复用
+        std::unique_ptr<Record[]> records;
+    };
+
+    friend struct FlightThreadCache;
+
+    Ring *getRing(LogEvent::ptr event);
+    void dumpLocked(Logger::ptr logger);
+    void record(Ring *ring, LogLevel::Level level, LogEvent::ptr event);
+
+    /**
+     * @brief 逐条读取ring中有效的记录
+     */
+    template <class CB>
+    void visit(Ring *ring, CB cb);
+
+private:
+    LogAppender::ptr m_target;
+    uint32_t m_capacity;
+    LogLevel::Level m_recordLevel;
+    LogLevel::Level m_triggerLevel;
+    std::atomic<bool> m_dumpRequested{false};
+    uint64_t m_id;                              // 记录器id，不复用，作为线程缓存的键
+    Mutex m_mutex;                              // 保护m_rings和转储
+    std::vector<std::shared_ptr<Ring>> m_rings; // 线程退出后保留到被新线程复用，便于事后分析
+};
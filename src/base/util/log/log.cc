@@ -5,6 +5,8 @@
 #include <map>
 #include <set>
 #include <type_traits>
+#include <algorithm>
+#include <sys/stat.h>
 #include "log.h"
 #include "mutex.h"
 
@@ -54,6 +56,48 @@ LogLevel::Level LogLevel::FromString(const std::string &str)
 #undef XX
 }
 
+// 已绑定的日志调用点链表，只在绑定和级别变化时访问
+static LogSite *s_log_sites = nullptr;
+
+static Mutex &GetLogSiteMutex()
+{
+    static Mutex s_mutex;
+    return s_mutex;
+}
+
+bool LogSite::bind(Logger *logger, LogLevel::Level level)
+{
+    bool enabled = logger->getLevel() <= level;
+    if (m_bound.load(std::memory_order_relaxed) != UNBOUND)
+    {
+        // 已绑定到其他日志器，直接比较
+        return enabled;
+    }
+
+    Mutex::Lock lock(GetLogSiteMutex());
+    if (m_bound.load(std::memory_order_relaxed) == UNBOUND)
+    {
+        m_level = level;
+        m_next = s_log_sites;
+        s_log_sites = this;
+        m_bound.store(Pack(logger->getId(), enabled ? ENABLED : DISABLED), std::memory_order_relaxed);
+    }
+    return enabled;
+}
+
+void LogSite::Refresh(const Logger *logger)
+{
+    Mutex::Lock lock(GetLogSiteMutex());
+    for (LogSite *site = s_log_sites; site; site = site->m_next)
+    {
+        if ((site->m_bound.load(std::memory_order_relaxed) >> 2) == logger->getId())
+        {
+            bool enabled = logger->getLevel() <= site->m_level;
+            site->m_bound.store(Pack(logger->getId(), enabled ? ENABLED : DISABLED), std::memory_order_relaxed);
+        }
+    }
+}
+
 LogEventWrap::LogEventWrap(LogEvent::ptr e) : m_event(e) {}
 
 LogEventWrap::~LogEventWrap()
@@ -72,16 +116,54 @@ void LogEvent::format(const char *fmt, ...)
 
 void LogEvent::format(const char *fmt, va_list al)
 {
-    char *buf = nullptr;
-    int len = vasprintf(&buf, fmt, al);
-    if (len != -1)
+    va_list copy;
+    va_copy(copy, al);
+    size_t avail = LOG_BUFFER_INLINE_SIZE;
+    int len = vsnprintf(m_buf.reserve(avail), avail, fmt, al);
+    if (len >= 0 && (size_t)len >= avail)
     {
-        m_ss << std::string(buf, len);
-        free(buf);
+        len = vsnprintf(m_buf.reserve(len + 1), len + 1, fmt, copy);
+    }
+    va_end(copy);
+    if (len > 0)
+    {
+        m_buf.commit(len);
     }
 }
 
-std::stringstream &LogEventWrap::getSS()
+std::string LogEvent::getContent() const
+{
+    std::string content(m_buf.data(), m_buf.size());
+    if (m_ss)
+    {
+        content.append(m_ss->data(), m_ss->size());
+    }
+    return content;
+}
+
+size_t LogEvent::copyContent(char *dst, size_t cap) const
+{
+    size_t n = std::min(cap, m_buf.size());
+    memcpy(dst, m_buf.data(), n);
+    if (m_ss && n < cap)
+    {
+        size_t m = std::min(cap - n, m_ss->size());
+        memcpy(dst + n, m_ss->data(), m);
+        n += m;
+    }
+    return n;
+}
+
+void LogEvent::writeContent(std::ostream &os) const
+{
+    os.write(m_buf.data(), m_buf.size());
+    if (m_ss)
+    {
+        os.write(m_ss->data(), m_ss->size());
+    }
+}
+
+LogStream &LogEventWrap::getSS()
 {
     return m_event->getSS();
 }
@@ -112,7 +194,7 @@ public:
     MessageFormatItem(const std::string &str = "") {}
     void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override
     {
-        os << event->getContent();
+        event->writeContent(os);
     }
 };
 
@@ -266,7 +348,8 @@ LogEvent::LogEvent(Logger::ptr logger, LogLevel::Level level,
       m_time(time),
       m_threadName(thread_name),
       m_logger(logger),
-      m_level(level)
+      m_level(level),
+      m_traced(LogTrace::IsActive())
 {
 }
 
@@ -274,13 +357,22 @@ LogEvent::LogEvent(Logger::ptr logger, LogLevel::Level level,
 
 //}
 
+static std::atomic<uint64_t> s_logger_ids{0};
+
 Logger::Logger(const std::string &name)
     : m_name(name),
-      m_level(LogLevel::DEBUG)
+      m_level(LogLevel::DEBUG),
+      m_id(++s_logger_ids)
 {
     m_formatter.reset(new LogFormatter("%d{[(%Y-%m-%d %H:%M:%S)]}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
 }
 
+void Logger::setLevel(LogLevel::Level val)
+{
+    m_level = val;
+    LogSite::Refresh(this);
+}
+
 void Logger::setFormatter(LogFormatter::ptr val)
 {
     // MutexType::Lock lock(m_mutex);
@@ -350,7 +442,7 @@ void Logger::delAppender(LogAppender::ptr appender)
 
 void Logger::log(LogLevel::Level level, LogEvent::ptr event)
 {
-    if (level >= m_level)
+    if (level >= m_level || event->isTraced())
     {
         auto self = shared_from_this();
         // MutexType::Lock lock(m_mutex);
@@ -393,14 +485,16 @@ void Logger::fatal(LogEvent::ptr event)
     log(LogLevel::FATAL, event);
 }
 
-FileLogAppender::FileLogAppender(const std::string &filename) : m_filename(filename)
+FileLogAppender::FileLogAppender(const std::string &filename, uint64_t max_size)
+    : m_filename(filename),
+      m_maxSize(max_size)
 {
     reopen();
 }
 
 void FileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
 {
-    if (level >= m_level)
+    if (level >= m_level || event->isTraced())
     {
         uint64_t now = event->getTime();
         if (now >= (m_lastTime + 3))
@@ -408,12 +502,26 @@ void FileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level,
             reopen();
             m_lastTime = now;
         }
+        if (m_maxSize && m_written >= m_maxSize)
+        {
+            rotate(now);
+        }
+        // 每秒第一条日志记录一个时间标记，供压缩索引按时间定位；不轮转压缩时标记不会被消费，不记录
+        if (m_maxSize && m_compressor && (m_marks.empty() || m_marks.back().time != now))
+        {
+            m_marks.push_back({now, m_written});
+        }
         // MutexType::Lock lock(m_mutex);
         // m_filestream << m_formatter.format(logger, level, event);
         if (!m_formatter->format(m_filestream, logger, level, event))
         {
             std::cout << "File outout error" << std::endl;
         }
+        std::streamoff pos = m_filestream.tellp();
+        if (pos > 0)
+        {
+            m_written = pos;
+        }
     }
 }
 
@@ -440,15 +548,50 @@ bool FileLogAppender::reopen()
     {
         m_filestream.close();
     }
-    m_filestream.open(m_filename);
+    m_filestream.open(m_filename, std::ios::app);
+
+    // 文件可能被外部移走，以磁盘上的实际大小为准
+    struct stat st;
+    uint64_t size = ::stat(m_filename.c_str(), &st) == 0 ? st.st_size : 0;
+    if (size < m_written)
+    {
+        m_marks.clear();
+    }
+    m_written = size;
 
     return !!m_filestream;
     // return FSUtil::OpenForWrite(m_filestream, m_filename, std::ios::app);
 }
 
+bool FileLogAppender::rotate(uint64_t now)
+{
+    m_filestream.close();
+
+    struct tm tm;
+    time_t t = now;
+    localtime_r(&t, &tm);
+    char buf[64];
+    strftime(buf, sizeof(buf), "%Y%m%d-%H%M%S", &tm);
+    std::string path = m_filename + "." + buf + "." + std::to_string(m_rotateSeq++);
+
+    bool ok = ::rename(m_filename.c_str(), path.c_str()) == 0;
+    if (!ok)
+    {
+        std::cout << "FileLogAppender rotate " << m_filename << " to " << path << " failed" << std::endl;
+    }
+    else if (m_compressor)
+    {
+        m_compressor->submit({path, std::move(m_marks)});
+    }
+    m_marks.clear();
+    m_written = 0;
+
+    return reopen() && ok;
+}
+
 void StdOutLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
 {
-    if (level >= m_level)
+    if (level >= m_level || event->isTraced())
     {
         // MutexType::Lock lock(m_mutex);
         m_formatter->format(std::cout, logger, level, event);
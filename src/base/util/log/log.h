@@ -15,11 +15,17 @@
 #include <vector>
 #include <stdarg.h>
 #include <map>
+#include <atomic>
+#include <optional>
 #include "singleton.h"
 #include "ostype.h"
+#include "logCompressor.h"
+#include "logFormat.h"
 #include <cstdarg>
 // #include "util.h"
-// #include "thread.h"
+#include "thread.h"
+#include "clock.h"
+#include "flatHashMap.h"
 
 /**
  * @brief 使用流方式将日志级别level的日志写入logger
@@ -38,9 +44,24 @@
                                 __FILE__, __LINE__, 0, 0, \
                                 1, time(0), "thread1"))).getSS()
 */
-#define LOG_LEVEL(logger, level)     \
-    if (logger->getLevel() <= level) \
-    LogEventWrap(LogEvent::ptr(new LogEvent(logger, level, __FILE__, __LINE__, 0, 0, 0, time(0), ""))).getSS()
+
+/**
+ * @brief 编译期日志级别下限，低于该级别的日志调用点在编译期被整体消除
+ * @details 取值同LogLevel::Level，例如 -DLOG_ACTIVE_LEVEL=2 去掉所有DEBUG日志
+ */
+#ifndef LOG_ACTIVE_LEVEL
+#define LOG_ACTIVE_LEVEL 1
+#endif
+
+/**
+ * @brief 日志级别是否在编译期保留
+ */
+#define LOG_LEVEL_ACTIVE(level) ((level) >= LOG_ACTIVE_LEVEL)
+
+#define LOG_LEVEL(logger, level)                                                     \
+    if (LOG_LEVEL_ACTIVE(level))                                                     \
+        if (static LogSite __log_site; __log_site.isEnabled(logger, level) || LogTrace::IsActive()) \
+    LogEventWrap(LogEvent::ptr(new LogEvent(logger, level, __FILE__, __LINE__, Clock::ElapsedMs(), GetThreadId(), GetFibreId(), Clock::CachedWallSec(), Thread::GetName()))).getSS()
 
 /**
  * @brief 使用流方式将日志级别debug的日志写到logger
@@ -78,30 +99,71 @@
         .getEvent()                                                                     \
         ->format(fmt, __VA_ARGS__)
 
+/**
+ * @details 占位符语法见logFormat.h，格式串必须是字符串字面量，占位符与参数个数在编译期校验
+ */
+#define LOG_FMT_LEVEL(logger, level, pattern, ...)                                   \
+    if (LOG_LEVEL_ACTIVE(level))                                                     \
+        if (static LogSite __log_site; __log_site.isEnabled(logger, level) || LogTrace::IsActive()) \
+    LogEventWrap(LogEvent::ptr(new LogEvent(logger, level, __FILE__, __LINE__, Clock::ElapsedMs(), GetThreadId(), GetFibreId(), Clock::CachedWallSec(), Thread::GetName()))) \
+        .getEvent()                                                                  \
+        ->fmt(LOG_FMT_STRING(pattern), ##__VA_ARGS__)
+
 /**
  * @brief 使用格式化方式将日志级别debug的日志写入到logger
  */
-#define LOG_FMT_DEBUG(logger, fmt, ...) LOG_FMT_LEVEL(logger, LogLevel::DEBUG, fmt, __VA_ARGS)
+#define LOG_FMT_DEBUG(logger, fmt, ...) LOG_FMT_LEVEL(logger, LogLevel::DEBUG, fmt, ##__VA_ARGS__)
 
 /**
  * @brief 使用格式化方式将日志级别info的日志写入到logger
  */
-#define LOG_FMT_INFO(logger, fmt, ...) LOG_FMT_LEVEL(logger, LogLevel::INFO, fmt, __VA_ARGS)
+#define LOG_FMT_INFO(logger, fmt, ...) LOG_FMT_LEVEL(logger, LogLevel::INFO, fmt, ##__VA_ARGS__)
 
 /**
  * @brief 使用格式化方式将日志级别warning的日志写入到logger
  */
-#define LOG_FMT_WARNING(logger, fmt, ...) LOG_FMT_LEVEL(logger, LogLevel::WARNING, fmt, __VA_ARGS)
+#define LOG_FMT_WARNING(logger, fmt, ...) LOG_FMT_LEVEL(logger, LogLevel::WARNING, fmt, ##__VA_ARGS__)
 
 /**
  * @brief 使用格式化方式将日志级别error的日志写入到logger
  */
-#define LOG_FMT_ERROR(logger, fmt, ...) LOG_FMT_LEVEL(logger, LogLevel::ERROR, fmt, __VA_ARGS)
+#define LOG_FMT_ERROR(logger, fmt, ...) LOG_FMT_LEVEL(logger, LogLevel::ERROR, fmt, ##__VA_ARGS__)
 
 /**
  * @brief 使用格式化方式将日志级别fatal的日志写入到logger
  */
-#define LOG_FMT_FATAL(logger, fmt, ...) LOG_FMT_LEVEL(logger, LogLevel::FATAL, fmt, __VA_ARGS)
+#define LOG_FMT_FATAL(logger, fmt, ...) LOG_FMT_LEVEL(logger, LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
+/**
+ * @brief 使用流方式写日志，同一调用点每秒最多写n条
+ * @details 调用点持有静态的LogSiteLimiter，被抑制的条数会附在下一条放行日志的开头
+ */
+#define LOG_LEVEL_RATELIMIT(logger, level, n)                                        \
+    if (LOG_LEVEL_ACTIVE(level))                                                     \
+        if (static LogSite __log_site; __log_site.isEnabled(logger, level) || LogTrace::IsActive()) \
+            if (static LogSiteLimiter __log_limiter;                                 \
+                LogSiteLimiter::Result __log_res = __log_limiter.rateAllow(n, Clock::CachedWallSec())) \
+    LogEventWrap(LogEvent::ptr(new LogEvent(logger, level, __FILE__, __LINE__, Clock::ElapsedMs(), GetThreadId(), GetFibreId(), Clock::CachedWallSec(), Thread::GetName()))).getSS() << __log_res
+
+/**
+ * @brief 使用流方式写日志，同一调用点每k条只写1条
+ */
+#define LOG_LEVEL_SAMPLE(logger, level, k)                                           \
+    if (LOG_LEVEL_ACTIVE(level))                                                     \
+        if (static LogSite __log_site; __log_site.isEnabled(logger, level) || LogTrace::IsActive()) \
+            if (static LogSiteLimiter __log_limiter;                                 \
+                LogSiteLimiter::Result __log_res = __log_limiter.sampleAllow(k))     \
+    LogEventWrap(LogEvent::ptr(new LogEvent(logger, level, __FILE__, __LINE__, Clock::ElapsedMs(), GetThreadId(), GetFibreId(), Clock::CachedWallSec(), Thread::GetName()))).getSS() << __log_res
+
+#define LOG_DEBUG_RATELIMIT(logger, n) LOG_LEVEL_RATELIMIT(logger, LogLevel::DEBUG, n)
+#define LOG_INFO_RATELIMIT(logger, n) LOG_LEVEL_RATELIMIT(logger, LogLevel::INFO, n)
+#define LOG_WARNING_RATELIMIT(logger, n) LOG_LEVEL_RATELIMIT(logger, LogLevel::WARNING, n)
+#define LOG_ERROR_RATELIMIT(logger, n) LOG_LEVEL_RATELIMIT(logger, LogLevel::ERROR, n)
+
+#define LOG_DEBUG_SAMPLE(logger, k) LOG_LEVEL_SAMPLE(logger, LogLevel::DEBUG, k)
+#define LOG_INFO_SAMPLE(logger, k) LOG_LEVEL_SAMPLE(logger, LogLevel::INFO, k)
+#define LOG_WARNING_SAMPLE(logger, k) LOG_LEVEL_SAMPLE(logger, LogLevel::WARNING, k)
+#define LOG_ERROR_SAMPLE(logger, k) LOG_LEVEL_SAMPLE(logger, LogLevel::ERROR, k)
 
 /**
  * @brief 获取主日志器
@@ -155,6 +217,180 @@ public:
     static LogLevel::Level FromString(const std::string &str);
 };
 
+/**
+ * @brief 线程级的调试跟踪开关
+ * @details 处理被跟踪连接的事件时开启，期间所有LOG_*调用点忽略日志器和输出器的级别限制，
+ *          未被跟踪的连接只多一次线程局部变量的判断
+ */
+class LogTrace
+{
+public:
+    static bool IsActive() { return t_active; }
+
+    /**
+     * @brief 在作用域内开启跟踪，析构时恢复
+     */
+    class Scope
+    {
+    public:
+        Scope(bool on) : m_prev(t_active) { t_active = m_prev || on; }
+        ~Scope() { t_active = m_prev; }
+
+    private:
+        bool m_prev;
+    };
+
+private:
+    static inline thread_local bool t_active = false;
+};
+
+/**
+ * @brief 日志调用点开关
+ * @details 每个LOG_*调用点一个静态实例，缓存"该调用点当前是否需要输出"，
+ *          调用点被禁用时只需一次字节加载和一次可预测的分支。
+ *          首次执行时绑定日志器并注册到全局链表，日志器级别变化时由Logger::setLevel统一刷新。
+ *          绑定的日志器id和开关状态打包在同一个原子变量中，读取时一次加载，不与bind/Refresh竞争；
+ *          日志器id全局递增不复用，日志器释放后地址被复用也不会误判。
+ *          调用点绑定的日志器与本次传入的不同(例如日志器作为参数传入)时退化为直接比较级别。
+ */
+class LogSite
+{
+public:
+    enum State : uint8_t
+    {
+        UNBOUND = 0,
+        DISABLED = 1,
+        ENABLED = 2
+    };
+
+    inline bool isEnabled(const std::shared_ptr<Logger> &logger, LogLevel::Level level);
+
+    /**
+     * @brief 刷新绑定到logger的所有调用点
+     */
+    static void Refresh(const Logger *logger);
+
+private:
+    bool bind(Logger *logger, LogLevel::Level level);
+
+    static uint64_t Pack(uint64_t logger_id, State state) { return (logger_id << 2) | state; }
+
+private:
+    std::atomic<uint64_t> m_bound{UNBOUND}; // (日志器id << 2) | State
+    LogLevel::Level m_level = LogLevel::UNKNOW;
+    LogSite *m_next = nullptr; // 全局调用点链表
+};
+
+/**
+ * @brief 日志调用点限流/采样状态
+ * @details 每个调用点一个静态实例，只使用relaxed原子计数，不加锁
+ */
+class LogSiteLimiter
+{
+public:
+    /**
+     * @brief 判定结果，放行时携带此前被抑制的条数
+     */
+    class Result
+    {
+    public:
+        Result(bool allowed, uint64_t dropped) : m_allowed(allowed), m_dropped(dropped) {}
+        explicit operator bool() const { return m_allowed; }
+        uint64_t getDropped() const { return m_dropped; }
+
+        friend std::ostream &operator<<(std::ostream &os, const Result &res)
+        {
+            if (res.m_dropped)
+            {
+                os << "[" << res.m_dropped << " similar messages suppressed] ";
+            }
+            return os;
+        }
+
+    private:
+        bool m_allowed;
+        uint64_t m_dropped;
+    };
+
+    /**
+     * @brief 每秒最多放行n条
+     * @param[in] n 每秒放行条数
+     * @param[in] now 当前时间(s)
+     */
+    Result rateAllow(uint32_t n, uint64_t now)
+    {
+        uint64_t window = m_window.load(std::memory_order_relaxed);
+        if (window != now && m_window.compare_exchange_strong(window, now, std::memory_order_relaxed))
+        {
+            m_count.store(0, std::memory_order_relaxed);
+        }
+        // 超限后只读不写，避免日志风暴时所有线程争抢同一缓存行
+        if (m_count.load(std::memory_order_relaxed) < n &&
+            m_count.fetch_add(1, std::memory_order_relaxed) < n)
+        {
+            return Result(true, takeDropped());
+        }
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return Result(false, 0);
+    }
+
+    /**
+     * @brief 每k条放行1条
+     */
+    Result sampleAllow(uint32_t k)
+    {
+        if (k <= 1 || m_count.fetch_add(1, std::memory_order_relaxed) % k == 0)
+        {
+            return Result(true, takeDropped());
+        }
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return Result(false, 0);
+    }
+
+private:
+    uint64_t takeDropped()
+    {
+        if (m_dropped.load(std::memory_order_relaxed) == 0)
+        {
+            return 0;
+        }
+        return m_dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> m_window{0};  // 当前计数窗口(s)
+    std::atomic<uint64_t> m_count{0};   // 窗口内/累计调用次数
+    std::atomic<uint64_t> m_dropped{0}; // 未报告的抑制条数
+};
+
+/**
+ * @brief 可以直接访问已写入内容的字符串缓冲区
+ */
+class LogStringBuf : public std::stringbuf
+{
+public:
+    LogStringBuf() : std::stringbuf(std::ios::out) {}
+
+    const char *data() const { return pbase(); }
+    size_t size() const { return pptr() - pbase(); }
+};
+
+/**
+ * @brief 日志内容流
+ * @details 与std::stringstream用法相同，额外提供对已写入内容的直接访问，
+ *          飞行记录器等只需读取内容的地方不必经过str()拷贝出一个std::string。
+ *          缓冲区放在先构造的基类中，构造std::ostream时已经可用。
+ */
+class LogStream : private LogStringBuf, public std::ostream
+{
+public:
+    LogStream() : LogStringBuf(), std::ostream(static_cast<LogStringBuf *>(this)) {}
+
+    using LogStringBuf::data;
+    using LogStringBuf::size;
+    using LogStringBuf::str;
+};
+
 /**
  * @brief 日志事件
  */
@@ -187,18 +423,51 @@ public:
     uint32_t getFibreId() const { return m_fibreId; }
     uint64_t getTime() const { return m_time; }
     const std::string &getThreadName() const { return m_threadName; }
-    std::string getContent() const { return m_ss.str(); }
+    bool isTraced() const { return m_traced; }
+    std::string getContent() const;
     std::shared_ptr<Logger> getLogger() const { return m_logger; }
     LogLevel::Level getLevel() const { return m_level; }
-    std::stringstream &getSS() { return m_ss; }
     void setContent(const std::string &str) { m_content = str; }
 
     /**
-     * @brief 格式化写入日志内容
+     * @brief 获取日志内容流，首次调用时才构造
+     */
+    LogStream &getSS()
+    {
+        if (!m_ss)
+        {
+            m_ss.emplace();
+        }
+        return *m_ss;
+    }
+
+    /**
+     * @brief 将日志内容写入输出流，不产生中间字符串
+     */
+    void writeContent(std::ostream &os) const;
+
+    /**
+     * @brief 将日志内容拷贝到dst，超过cap的部分截断
+     * @return 返回拷贝的字节数
+     */
+    size_t copyContent(char *dst, size_t cap) const;
+
+    /**
+     * @brief printf风格格式化写入日志内容
      */
     void format(const char *fmt, ...);
     void format(const char *fmt, va_list al);
 
+    /**
+     * @brief {}风格格式化写入日志内容，直接写入事件缓冲区
+     * @param[in] s LOG_FMT_STRING生成的格式串
+     */
+    template <class S, class... Args>
+    void fmt(S s, const Args &...args)
+    {
+        LogFormatTo(m_buf, s, args...);
+    }
+
 private:
     const char *m_file = nullptr;     // 文件名
     int32_t m_line = 0;               // 行号
@@ -210,7 +479,9 @@ private:
     std::string m_content;            // 日志内容
     std::shared_ptr<Logger> m_logger; // 日志器
     LogLevel::Level m_level;          // 日志级别
-    std::stringstream m_ss;           // 日志字符串流
+    bool m_traced;                    // 是否在跟踪作用域内产生，跟踪日志不受级别限制
+    LogBuffer m_buf;                  // 格式化日志内容
+    std::optional<LogStream> m_ss;    // 日志字符串流
 };
 
 /**
@@ -238,7 +509,7 @@ public:
     /**
      * @brief 获取日志内容流
      */
-    std::stringstream &getSS();
+    LogStream &getSS();
 
 private:
     LogEvent::ptr m_event;
@@ -399,7 +670,16 @@ public:
     void clearAppender();
 
     LogLevel::Level getLevel() const { return m_level; }
-    void setLevel(LogLevel::Level val) { m_level = val; }
+
+    /**
+     * @brief 进程内唯一的日志器id，从1开始，不复用
+     */
+    uint64_t getId() const { return m_id; }
+
+    /**
+     * @brief 设置日志级别，同时刷新绑定到该日志器的调用点开关
+     */
+    void setLevel(LogLevel::Level val);
 
     /**
      * @brief 返回日志名称
@@ -421,12 +701,23 @@ public:
 private:
     std::string m_name;      // 日志名称
     LogLevel::Level m_level; // 日志级别
+    uint64_t m_id;           // 日志器id
     // MutexType m_mutex;
     std::list<LogAppender::ptr> m_appenders; // Appender集合
     LogFormatter::ptr m_formatter;           // 日志格式器
     Logger::ptr m_root;                      // 主日志器
 };
 
+bool LogSite::isEnabled(const std::shared_ptr<Logger> &logger, LogLevel::Level level)
+{
+    uint64_t bound = m_bound.load(std::memory_order_relaxed);
+    if (__builtin_expect((bound >> 2) == logger->getId(), 1))
+    {
+        return (bound & 3) == ENABLED;
+    }
+    return bind(logger.get(), level);
+}
+
 /**
  * 日志输出到stdout
  */
@@ -446,7 +737,12 @@ class FileLogAppender : public LogAppender
 {
 public:
     typedef std::shared_ptr<FileLogAppender> ptr;
-    FileLogAppender(const std::string &filename);
+    /**
+     * @brief 构造函数
+     * @param[in] filename 文件路径
+     * @param[in] max_size 单个分段的最大字节数，0表示不切分
+     */
+    FileLogAppender(const std::string &filename, uint64_t max_size = 0);
     void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
     // std::string toYamlString() override;
 
@@ -455,10 +751,33 @@ public:
      */
     bool reopen();
 
+    /**
+     * @brief 设置分段大小，0表示不切分
+     */
+    void setMaxSize(uint64_t val) { m_maxSize = val; }
+    uint64_t getMaxSize() const { return m_maxSize; }
+
+    /**
+     * @brief 设置分段压缩器，切分后的分段提交给压缩器后台压缩
+     */
+    void setCompressor(LogCompressor::ptr val) { m_compressor = val; }
+    LogCompressor::ptr getCompressor() const { return m_compressor; }
+
+private:
+    /**
+     * @brief 关闭当前分段，重命名为 filename.YYYYmmdd-HHMMSS.N 后重新打开
+     */
+    bool rotate(uint64_t now);
+
 private:
     std::string m_filename;     // 文件路径
     std::ofstream m_filestream; // 文件流
     uint64_t m_lastTime = 0;    // 上次重新打开时间
+    uint64_t m_maxSize = 0;     // 分段最大字节数
+    uint64_t m_written = 0;     // 当前分段已写入字节数
+    uint32_t m_rotateSeq = 0;   // 分段序号，避免同一秒内重名
+    std::vector<LogCompressor::Mark> m_marks; // 当前分段的时间标记
+    LogCompressor::ptr m_compressor;          // 分段压缩器
 };
 
 /**
@@ -493,7 +812,7 @@ public:
 
 private:
     // MutexType m_mutex;
-    std::map<std::string, Logger::ptr> m_loggers; // 日志器容器
+    FlatHashMap<std::string, Logger::ptr> m_loggers; // 日志器容器
     Logger::ptr m_root;                           // 主日志器
 };
 
@@ -0,0 +1,259 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <zstd.h>
+#include "logCompressor.h"
+
+// ioprio_set参数，glibc没有导出对应头文件
+#define LOG_IOPRIO_WHO_PROCESS 1
+#define LOG_IOPRIO_CLASS_IDLE 3
+#define LOG_IOPRIO_CLASS_SHIFT 13
+
+#define LOG_COMPRESS_CHUNK (64 * 1024)
+
+LogCompressor::LogCompressor(int level, uint32_t cpu_percent, uint64_t frame_size)
+    : m_level(level),
+      m_frameSize(frame_size ? frame_size : LOG_COMPRESS_CHUNK)
+{
+    setCpuPercent(cpu_percent);
+}
+
+LogCompressor::~LogCompressor()
+{
+    stop();
+}
+
+void LogCompressor::start()
+{
+    Mutex::Lock lock(m_mutex);
+    if (m_thread.joinable())
+    {
+        return;
+    }
+    m_stopping = false;
+    m_thread = std::thread([this]()
+                           { run(); });
+}
+
+void LogCompressor::stop()
+{
+    {
+        Mutex::Lock lock(m_mutex);
+        if (!m_thread.joinable())
+        {
+            return;
+        }
+        m_stopping = true;
+    }
+    m_sem.notify();
+    m_thread.join();
+}
+
+void LogCompressor::submit(Segment segment)
+{
+    {
+        Mutex::Lock lock(m_mutex);
+        m_segments.push_back(std::move(segment));
+    }
+    m_sem.notify();
+}
+
+bool LogCompressor::Seek(const std::string &idx_path, uint64_t time, uint64_t &zst_offset, uint64_t &raw_offset)
+{
+    std::ifstream ifs(idx_path);
+    if (!ifs)
+    {
+        return false;
+    }
+
+    bool found = false;
+    uint64_t t = 0, raw = 0, zst = 0;
+    while (ifs >> t >> raw >> zst)
+    {
+        if (found && t > time)
+        {
+            break;
+        }
+        // 第一个frame总是可用的起点
+        zst_offset = zst;
+        raw_offset = raw;
+        found = true;
+    }
+    return found;
+}
+
+void LogCompressor::run()
+{
+    setIdlePriority();
+    while (true)
+    {
+        m_sem.wait();
+
+        Segment segment;
+        {
+            Mutex::Lock lock(m_mutex);
+            if (m_stopping)
+            {
+                break;
+            }
+            if (m_segments.empty())
+            {
+                continue;
+            }
+            segment = std::move(m_segments.front());
+            m_segments.pop_front();
+        }
+
+        if (compress(segment))
+        {
+            ::unlink(segment.path.c_str());
+        }
+    }
+}
+
+void LogCompressor::setIdlePriority()
+{
+#ifdef __linux__
+    sched_param param;
+    param.sched_priority = 0;
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param))
+    {
+        std::cout << "LogCompressor set SCHED_IDLE failed" << std::endl;
+    }
+    // who = 0 表示调用线程
+    syscall(SYS_ioprio_set, LOG_IOPRIO_WHO_PROCESS, 0, LOG_IOPRIO_CLASS_IDLE << LOG_IOPRIO_CLASS_SHIFT);
+#endif
+}
+
+void LogCompressor::throttle(uint64_t busy_us)
+{
+    uint32_t percent = getCpuPercent();
+    if (percent >= 100)
+    {
+        return;
+    }
+    uint64_t sleep_us = busy_us * (100 - percent) / percent;
+    if (sleep_us)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(sleep_us));
+    }
+}
+
+bool LogCompressor::compress(const Segment &segment)
+{
+    std::ifstream ifs(segment.path, std::ios::binary);
+    if (!ifs)
+    {
+        std::cout << "LogCompressor open " << segment.path << " failed" << std::endl;
+        return false;
+    }
+    ifs.seekg(0, std::ios::end);
+    uint64_t raw_size = ifs.tellg();
+    ifs.seekg(0, std::ios::beg);
+
+    std::string zst_path = segment.path + ".zst";
+    std::string tmp_path = zst_path + ".tmp";
+    std::string idx_path = zst_path + ".idx";
+    std::string idx_tmp_path = idx_path + ".tmp";
+    std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+    std::ofstream idx(idx_tmp_path, std::ios::trunc);
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    if (!ofs || !idx || !cctx)
+    {
+        std::cout << "LogCompressor open " << zst_path << " failed" << std::endl;
+        ZSTD_freeCCtx(cctx);
+        ::unlink(tmp_path.c_str());
+        ::unlink(idx_tmp_path.c_str());
+        return false;
+    }
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, getLevel());
+
+    std::vector<char> in_buf(LOG_COMPRESS_CHUNK);
+    std::vector<char> out_buf(ZSTD_CStreamOutSize());
+    uint64_t raw_pos = 0, zst_pos = 0;
+    size_t mark_idx = 0;
+    bool ok = true;
+
+    while (ok && raw_pos < raw_size)
+    {
+        // frame起点对齐到最近的时间标记
+        uint64_t frame_time = 0;
+        while (mark_idx < segment.marks.size() && segment.marks[mark_idx].offset <= raw_pos)
+        {
+            frame_time = segment.marks[mark_idx].time;
+            mark_idx++;
+        }
+        // 没有标记时按固定大小切分，否则在frame_size之后的第一个标记处切分
+        uint64_t frame_end = raw_size;
+        if (segment.marks.empty())
+        {
+            frame_end = std::min(raw_size, raw_pos + m_frameSize);
+        }
+        for (size_t i = mark_idx; i < segment.marks.size(); i++)
+        {
+            if (segment.marks[i].offset >= raw_pos + m_frameSize)
+            {
+                frame_end = std::min(raw_size, segment.marks[i].offset);
+                break;
+            }
+        }
+
+        idx << frame_time << "\t" << raw_pos << "\t" << zst_pos << "\n";
+        ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+
+        while (ok && raw_pos < frame_end)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            size_t n = std::min<uint64_t>(in_buf.size(), frame_end - raw_pos);
+            if (!ifs.read(in_buf.data(), n))
+            {
+                ok = false;
+                break;
+            }
+            raw_pos += n;
+            ZSTD_EndDirective mode = raw_pos == frame_end ? ZSTD_e_end : ZSTD_e_continue;
+            ZSTD_inBuffer input = {in_buf.data(), n, 0};
+            bool finished = false;
+            while (!finished)
+            {
+                ZSTD_outBuffer output = {out_buf.data(), out_buf.size(), 0};
+                size_t remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+                if (ZSTD_isError(remaining))
+                {
+                    std::cout << "LogCompressor zstd error: " << ZSTD_getErrorName(remaining) << std::endl;
+                    ok = false;
+                    break;
+                }
+                ofs.write(out_buf.data(), output.pos);
+                zst_pos += output.pos;
+                finished = (mode == ZSTD_e_end) ? (remaining == 0) : (input.pos == input.size);
+            }
+            auto busy = std::chrono::steady_clock::now() - begin;
+            throttle(std::chrono::duration_cast<std::chrono::microseconds>(busy).count());
+        }
+    }
+
+    ZSTD_freeCCtx(cctx);
+    ofs.close();
+    idx.close();
+    // 索引在.zst就位后才出现，失败或崩溃时不会留下指向不存在文件的索引
+    if (!ok || !ofs || !idx || ::rename(tmp_path.c_str(), zst_path.c_str()) != 0)
+    {
+        ::unlink(tmp_path.c_str());
+        ::unlink(idx_tmp_path.c_str());
+        return false;
+    }
+    if (::rename(idx_tmp_path.c_str(), idx_path.c_str()) != 0)
+    {
+        // .zst完整可用，只是不能按时间定位
+        std::cout << "LogCompressor rename " << idx_path << " failed" << std::endl;
+        ::unlink(idx_tmp_path.c_str());
+    }
+    return true;
+}
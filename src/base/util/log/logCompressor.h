@@ -0,0 +1,104 @@
+/**
+ * @file logCompressor.h
+ * @brief 日志分段后台压缩
+ */
+
+#pragma once
+
+#include <string>
+#include <stdint.h>
+#include <memory>
+#include <atomic>
+#include <list>
+#include <vector>
+#include <thread>
+#include "mutex.h"
+#include "noncopyble.h"
+
+/**
+ * @brief 已关闭日志分段的后台压缩器
+ * @details 由FileLogAppender在切分日志时提交分段，工作线程以SCHED_IDLE/IO idle优先级运行，
+ *          按CPU占用百分比限速，使用zstd流式压缩。
+ *          每个分段被切成若干独立的zstd frame，frame边界对齐到日志事件起始位置，
+ *          同时生成 <segment>.zst.idx 索引文件(先写临时文件，.zst就位后再改名)，每行 "时间(s)\t原始偏移\t压缩偏移"，
+ *          工具可据此按时间定位到某个frame直接解压，例如:
+ *          tail -c +$((zst_offset + 1)) app.log.xxx.zst | zstd -dc | grep ...
+ */
+class LogCompressor : Noncopyble
+{
+public:
+    typedef std::shared_ptr<LogCompressor> ptr;
+
+    /**
+     * @brief 分段内的时间标记，记录某秒第一条日志在分段中的偏移
+     */
+    struct Mark
+    {
+        uint64_t time = 0;   // 时间戳(s)
+        uint64_t offset = 0; // 原始文件偏移
+    };
+
+    /**
+     * @brief 待压缩的分段
+     */
+    struct Segment
+    {
+        std::string path;        // 分段文件路径
+        std::vector<Mark> marks; // 时间标记，按偏移递增
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] level zstd压缩级别
+     * @param[in] cpu_percent 工作线程最多占用的单核CPU百分比(1-100)
+     * @param[in] frame_size 单个zstd frame的原始数据大小，决定按时间定位的粒度
+     */
+    LogCompressor(int level = 3, uint32_t cpu_percent = 20, uint64_t frame_size = 4 * 1024 * 1024);
+    ~LogCompressor();
+
+    /**
+     * @brief 启动后台工作线程
+     */
+    void start();
+
+    /**
+     * @brief 停止工作线程，已提交但未压缩的分段保留原文件
+     */
+    void stop();
+
+    /**
+     * @brief 提交一个已关闭的分段
+     */
+    void submit(Segment segment);
+
+    void setLevel(int level) { m_level.store(level, std::memory_order_relaxed); }
+    int getLevel() const { return m_level.load(std::memory_order_relaxed); }
+    void setCpuPercent(uint32_t v) { m_cpuPercent.store((v == 0 || v > 100) ? 100 : v, std::memory_order_relaxed); }
+    uint32_t getCpuPercent() const { return m_cpuPercent.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 在索引文件中查找不晚于time的最后一个frame
+     * @param[in] idx_path 索引文件路径
+     * @param[in] time 时间戳(s)
+     * @param[out] zst_offset frame在压缩文件中的偏移
+     * @param[out] raw_offset frame在原始分段中的偏移
+     * @return 找到返回true
+     */
+    static bool Seek(const std::string &idx_path, uint64_t time, uint64_t &zst_offset, uint64_t &raw_offset);
+
+private:
+    void run();
+    bool compress(const Segment &segment);
+    void throttle(uint64_t busy_us);
+    void setIdlePriority();
+
+private:
+    std::atomic<int> m_level;          // 工作线程读取，可在运行中修改
+    std::atomic<uint32_t> m_cpuPercent;
+    uint64_t m_frameSize;
+    bool m_stopping = false;
+    Mutex m_mutex;
+    Semaphore m_sem;
+    std::list<Segment> m_segments; // 待压缩队列
+    std::thread m_thread;
+};
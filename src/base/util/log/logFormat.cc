@@ -0,0 +1,115 @@
+#include "logFormat.h"
+
+void LogFmtWriteArg(LogBuffer &buf, const LogFmtArg &arg, bool hex, int precision)
+{
+    char *p = nullptr;
+    switch (arg.type)
+    {
+    case LogFmtArg::INT:
+        p = buf.reserve(24);
+        if (hex)
+        {
+            buf.commit(LogFmtHex(p, (uint64_t)arg.i));
+        }
+        else if (arg.i < 0)
+        {
+            *p = '-';
+            buf.commit(1 + LogFmtUint(p + 1, 0 - (uint64_t)arg.i));
+        }
+        else
+        {
+            buf.commit(LogFmtUint(p, arg.i));
+        }
+        break;
+    case LogFmtArg::UINT:
+        p = buf.reserve(24);
+        buf.commit(hex ? LogFmtHex(p, arg.u) : LogFmtUint(p, arg.u));
+        break;
+    case LogFmtArg::DOUBLE:
+    {
+        // 定点格式最长为 1e308 的整数部分加小数部分
+        p = buf.reserve(precision >= 0 ? 320 + precision : 32);
+        std::to_chars_result res = precision >= 0
+                                       ? std::to_chars(p, p + 320 + precision, arg.d, std::chars_format::fixed, precision)
+                                       : std::to_chars(p, p + 32, arg.d);
+        buf.commit(res.ptr - p);
+        break;
+    }
+    case LogFmtArg::BOOL:
+        if (arg.b)
+        {
+            buf.append("true", 4);
+        }
+        else
+        {
+            buf.append("false", 5);
+        }
+        break;
+    case LogFmtArg::CHAR:
+        buf.append(arg.c);
+        break;
+    case LogFmtArg::STRING:
+        buf.append(arg.s.data, arg.s.size);
+        break;
+    case LogFmtArg::POINTER:
+        p = buf.reserve(18);
+        p[0] = '0';
+        p[1] = 'x';
+        buf.commit(2 + LogFmtHex(p + 2, (uint64_t)(uintptr_t)arg.p));
+        break;
+    }
+}
+
+void LogFmtWrite(LogBuffer &buf, std::string_view fmt, const LogFmtArg *args, size_t count)
+{
+    size_t idx = 0;
+    size_t begin = 0;
+    for (size_t i = 0; i < fmt.size(); i++)
+    {
+        char c = fmt[i];
+        if (c != '{' && c != '}')
+        {
+            continue;
+        }
+        buf.append(fmt.data() + begin, i - begin);
+
+        // {{ 和 }} 转义，格式串已在编译期校验
+        if (fmt[i + 1] == c)
+        {
+            buf.append(c);
+            i++;
+            begin = i + 1;
+            continue;
+        }
+
+        bool hex = false;
+        int precision = -1;
+        size_t j = i + 1;
+        if (fmt[j] == ':')
+        {
+            j++;
+            if (fmt[j] == 'x')
+            {
+                hex = true;
+                j++;
+            }
+            else
+            {
+                j++;
+                precision = 0;
+                while (fmt[j] != '}')
+                {
+                    precision = precision * 10 + (fmt[j] - '0');
+                    j++;
+                }
+            }
+        }
+        if (idx < count)
+        {
+            LogFmtWriteArg(buf, args[idx++], hex, precision);
+        }
+        i = j;
+        begin = j + 1;
+    }
+    buf.append(fmt.data() + begin, fmt.size() - begin);
+}
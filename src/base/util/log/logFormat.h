@@ -0,0 +1,344 @@
+/**
+ * @file logFormat.h
+ * @brief {}风格的日志格式化，格式串在编译期校验
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <charconv>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include "noncopyble.h"
+
+/**
+ * @brief 占位符语法
+ * @details {}      按参数类型默认输出
+ *          {:x}    整数/指针按十六进制输出
+ *          {:.N}   浮点数保留N位小数
+ *          {{ }}   输出字面量 { }
+ */
+#define LOG_FMT_INVALID ((size_t)-1)
+
+/**
+ * @brief 将字符串字面量包装成携带编译期常量的类型，供LogEvent::fmt校验
+ */
+#define LOG_FMT_STRING(s)                                                    \
+    [] {                                                                     \
+        struct __LogFmtString                                                \
+        {                                                                    \
+            static constexpr std::string_view str() { return s; }            \
+        };                                                                   \
+        return __LogFmtString{};                                             \
+    }()
+
+/**
+ * @brief 校验格式串
+ * @return 返回占位符个数，格式错误返回LOG_FMT_INVALID
+ */
+constexpr size_t LogFmtCheck(std::string_view fmt)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < fmt.size(); i++)
+    {
+        if (fmt[i] == '}')
+        {
+            if (i + 1 < fmt.size() && fmt[i + 1] == '}')
+            {
+                i++;
+                continue;
+            }
+            return LOG_FMT_INVALID;
+        }
+        if (fmt[i] != '{')
+        {
+            continue;
+        }
+        if (i + 1 < fmt.size() && fmt[i + 1] == '{')
+        {
+            i++;
+            continue;
+        }
+
+        size_t j = i + 1;
+        if (j < fmt.size() && fmt[j] == ':')
+        {
+            j++;
+            if (j < fmt.size() && fmt[j] == 'x')
+            {
+                j++;
+            }
+            else if (j < fmt.size() && fmt[j] == '.')
+            {
+                j++;
+                size_t digits = 0;
+                while (j < fmt.size() && fmt[j] >= '0' && fmt[j] <= '9')
+                {
+                    j++;
+                    digits++;
+                }
+                if (digits == 0 || digits > 2)
+                {
+                    return LOG_FMT_INVALID;
+                }
+            }
+            else
+            {
+                return LOG_FMT_INVALID;
+            }
+        }
+        if (j >= fmt.size() || fmt[j] != '}')
+        {
+            return LOG_FMT_INVALID;
+        }
+        count++;
+        i = j;
+    }
+    return count;
+}
+
+/**
+ * @brief 日志内容缓冲区
+ * @details 小于LOG_BUFFER_INLINE_SIZE的内容直接写入对象内部，超出时才申请堆内存
+ */
+#define LOG_BUFFER_INLINE_SIZE 256
+
+class LogBuffer : Noncopyble
+{
+public:
+    LogBuffer() : m_data(m_inline), m_size(0), m_capacity(LOG_BUFFER_INLINE_SIZE) {}
+    ~LogBuffer()
+    {
+        if (m_data != m_inline)
+        {
+            free(m_data);
+        }
+    }
+
+    const char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    void clear() { m_size = 0; }
+
+    /**
+     * @brief 预留n字节并返回写入位置，写完后调用commit
+     */
+    char *reserve(size_t n)
+    {
+        if (m_size + n > m_capacity)
+        {
+            grow(m_size + n);
+        }
+        return m_data + m_size;
+    }
+
+    void commit(size_t n) { m_size += n; }
+
+    void append(const char *str, size_t n)
+    {
+        memcpy(reserve(n), str, n);
+        m_size += n;
+    }
+
+    void append(char c) { *reserve(1) = c; m_size++; }
+
+private:
+    void grow(size_t need)
+    {
+        size_t capacity = m_capacity * 2;
+        while (capacity < need)
+        {
+            capacity *= 2;
+        }
+        char *data = (char *)malloc(capacity);
+        memcpy(data, m_data, m_size);
+        if (m_data != m_inline)
+        {
+            free(m_data);
+        }
+        m_data = data;
+        m_capacity = capacity;
+    }
+
+private:
+    char *m_data;
+    size_t m_size;
+    size_t m_capacity;
+    char m_inline[LOG_BUFFER_INLINE_SIZE];
+};
+
+/**
+ * @brief 类型擦除后的格式化参数，不持有数据
+ */
+struct LogFmtArg
+{
+    enum Type : uint8_t
+    {
+        INT,
+        UINT,
+        DOUBLE,
+        BOOL,
+        CHAR,
+        STRING,
+        POINTER
+    };
+
+    Type type;
+    union
+    {
+        int64_t i;
+        uint64_t u;
+        double d;
+        bool b;
+        char c;
+        const void *p;
+        struct
+        {
+            const char *data;
+            size_t size;
+        } s;
+    };
+};
+
+template <class T>
+LogFmtArg LogFmtMakeArg(const T &v)
+{
+    typedef std::decay_t<T> U;
+    LogFmtArg arg;
+    if constexpr (std::is_same_v<U, bool>)
+    {
+        arg.type = LogFmtArg::BOOL;
+        arg.b = v;
+    }
+    else if constexpr (std::is_same_v<U, char>)
+    {
+        arg.type = LogFmtArg::CHAR;
+        arg.c = v;
+    }
+    else if constexpr (std::is_enum_v<U>)
+    {
+        return LogFmtMakeArg(static_cast<std::underlying_type_t<U>>(v));
+    }
+    else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>)
+    {
+        arg.type = LogFmtArg::INT;
+        arg.i = v;
+    }
+    else if constexpr (std::is_integral_v<U>)
+    {
+        arg.type = LogFmtArg::UINT;
+        arg.u = v;
+    }
+    else if constexpr (std::is_floating_point_v<U>)
+    {
+        arg.type = LogFmtArg::DOUBLE;
+        arg.d = v;
+    }
+    else if constexpr (std::is_same_v<U, const char *> || std::is_same_v<U, char *>)
+    {
+        arg.type = LogFmtArg::STRING;
+        arg.s.data = v ? v : "(null)";
+        arg.s.size = strlen(arg.s.data);
+    }
+    else if constexpr (std::is_convertible_v<const U &, std::string_view>)
+    {
+        std::string_view sv = v;
+        arg.type = LogFmtArg::STRING;
+        arg.s.data = sv.data();
+        arg.s.size = sv.size();
+    }
+    else if constexpr (std::is_pointer_v<U>)
+    {
+        arg.type = LogFmtArg::POINTER;
+        arg.p = v;
+    }
+    else
+    {
+        static_assert(std::is_same_v<U, void>, "LOG_FMT_*: unsupported argument type, use the stream macros");
+    }
+    return arg;
+}
+
+/**
+ * @brief 无符号整数转十进制，逆序写入两位一组
+ */
+inline size_t LogFmtUint(char *buf, uint64_t v)
+{
+    static const char s_digits[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    while (v >= 100)
+    {
+        unsigned idx = (v % 100) * 2;
+        v /= 100;
+        *--p = s_digits[idx + 1];
+        *--p = s_digits[idx];
+    }
+    if (v >= 10)
+    {
+        unsigned idx = v * 2;
+        *--p = s_digits[idx + 1];
+        *--p = s_digits[idx];
+    }
+    else
+    {
+        *--p = '0' + v;
+    }
+    size_t n = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, n);
+    return n;
+}
+
+inline size_t LogFmtHex(char *buf, uint64_t v)
+{
+    static const char s_hex[] = "0123456789abcdef";
+    char tmp[16];
+    char *p = tmp + sizeof(tmp);
+    do
+    {
+        *--p = s_hex[v & 0xf];
+        v >>= 4;
+    } while (v);
+    size_t n = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, n);
+    return n;
+}
+
+/**
+ * @brief 按占位符格式写入一个参数
+ * @param[in] hex 是否十六进制
+ * @param[in] precision 浮点小数位数，-1表示最短表示
+ */
+void LogFmtWriteArg(LogBuffer &buf, const LogFmtArg &arg, bool hex, int precision);
+
+/**
+ * @brief 运行时按已校验的格式串写入缓冲区
+ */
+void LogFmtWrite(LogBuffer &buf, std::string_view fmt, const LogFmtArg *args, size_t count);
+
+/**
+ * @brief 格式化写入缓冲区
+ * @param[in] S LOG_FMT_STRING生成的格式串类型
+ */
+template <class S, class... Args>
+void LogFormatTo(LogBuffer &buf, S, const Args &...args)
+{
+    constexpr size_t count = LogFmtCheck(S::str());
+    static_assert(count != LOG_FMT_INVALID, "LOG_FMT_*: invalid format string");
+    static_assert(count == sizeof...(Args), "LOG_FMT_*: placeholder count does not match argument count");
+    if constexpr (sizeof...(Args) == 0)
+    {
+        LogFmtWrite(buf, S::str(), nullptr, 0);
+    }
+    else
+    {
+        const LogFmtArg arr[] = {LogFmtMakeArg(args)...};
+        LogFmtWrite(buf, S::str(), arr, sizeof...(Args));
+    }
+}
@@ -1,3 +1,4 @@
+#include <sched.h>
 #include "mutex.h"
 // #include "macro.h"
 
@@ -29,3 +30,51 @@ void Semaphore::notify()
         throw std::logic_error("sem_post error");
     }
 }
+
+/// 线程累加多少次后重新获取所在CPU
+#define CPU_REFRESH_INTERVAL 1024
+
+PerCpuCounter::PerCpuCounter(size_t shards)
+{
+    if (shards == 0)
+    {
+        shards = std::thread::hardware_concurrency();
+    }
+    size_t n = 1;
+    while (n < shards)
+    {
+        n <<= 1;
+    }
+    m_shards.reset(new Shard[n]);
+    m_mask = n - 1;
+}
+
+int64_t PerCpuCounter::read() const
+{
+    int64_t sum = 0;
+    for (size_t i = 0; i <= m_mask; ++i)
+    {
+        sum += m_shards[i].value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+void PerCpuCounter::reset()
+{
+    for (size_t i = 0; i <= m_mask; ++i)
+    {
+        m_shards[i].value.store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t PerCpuCounter::ShardIndex()
+{
+    static thread_local size_t t_cpu = 0;
+    static thread_local uint32_t t_calls = 0;
+    if (t_calls++ % CPU_REFRESH_INTERVAL == 0)
+    {
+        int cpu = sched_getcpu();
+        t_cpu = cpu < 0 ? 0 : cpu;
+    }
+    return t_cpu;
+}
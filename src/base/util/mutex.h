@@ -8,6 +8,8 @@
 #include <semaphore.h>
 #include <atomic>
 #include <list>
+#include <string.h>
+#include <type_traits>
 
 #include "noncopyble.h"
 // #include "fibre.h"
@@ -276,6 +278,181 @@ private:
     volatile std::atomic_flag m_mutex;
 };
 
+/**
+ * @brief 顺序锁，适合读多写少的小结构(统计快照、配置版本号等)
+ * @details 写者之间互斥，读者从不阻塞写者也不写共享内存：
+ *          读取前后比较序号，序号为奇数(正在写)或前后不一致时重读。
+ *          数据按8字节原子字保存，并发读写不构成数据竞争，T必须可平凡拷贝。
+ *          写者可以直接store()，也可以用Lock包住读-改-写:
+ *          {
+ *              SeqLock<Stats>::Lock lock(s);
+ *              Stats v = s.get();
+ *              ++v.count;
+ *              s.set(v);
+ *          }
+ */
+template <class T>
+class SeqLock : Noncopyble
+{
+public:
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock requires trivially copyable type");
+    typedef ScopedLockImpl<SeqLock<T>> Lock;
+
+    SeqLock(const T &value = T())
+    {
+        writeWords(value);
+    }
+
+    /**
+     * @brief 读者读取一致的快照
+     */
+    T read() const
+    {
+        for (;;)
+        {
+            uint64_t seq = m_seq.load(std::memory_order_acquire);
+            if (seq & 1)
+            {
+                continue;
+            }
+            T value = readWords();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_seq.load(std::memory_order_relaxed) == seq)
+            {
+                return value;
+            }
+        }
+    }
+
+    /**
+     * @brief 写入新值
+     */
+    void store(const T &value)
+    {
+        lock();
+        set(value);
+        unlock();
+    }
+
+    /**
+     * @brief 当前序号，每次写入加2
+     */
+    uint64_t getSeq() const { return m_seq.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 写者加锁，序号变为奇数
+     */
+    void lock()
+    {
+        uint64_t seq = m_seq.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            if (!(seq & 1) && m_seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire))
+            {
+                break;
+            }
+            seq = m_seq.load(std::memory_order_relaxed);
+        }
+        // 序号先于数据对读者可见
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    /**
+     * @brief 写者解锁，序号变回偶数
+     */
+    void unlock()
+    {
+        m_seq.fetch_add(1, std::memory_order_release);
+    }
+
+    /**
+     * @brief 持有锁的写者读取当前值
+     */
+    T get() const { return readWords(); }
+
+    /**
+     * @brief 持有锁的写者写入新值
+     */
+    void set(const T &value) { writeWords(value); }
+
+private:
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    T readWords() const
+    {
+        uint64_t buf[WORDS];
+        for (size_t i = 0; i < WORDS; ++i)
+        {
+            buf[i] = m_words[i].load(std::memory_order_relaxed);
+        }
+        T value;
+        memcpy(&value, buf, sizeof(T));
+        return value;
+    }
+
+    void writeWords(const T &value)
+    {
+        uint64_t buf[WORDS] = {0};
+        memcpy(buf, &value, sizeof(T));
+        for (size_t i = 0; i < WORDS; ++i)
+        {
+            m_words[i].store(buf[i], std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::atomic<uint64_t> m_seq{0};
+    std::atomic<uint64_t> m_words[WORDS];
+};
+
+/**
+ * @brief 按CPU分片的计数器
+ * @details 每个分片独占一个缓存行，线程按所在CPU选择分片并缓存下标，
+ *          多个IO线程同时计数时不再争抢同一个缓存行；读取时汇总所有分片。
+ *          线程迁移到其他CPU后最多累加CPU_REFRESH_INTERVAL次才更新下标，只影响分布不影响正确性。
+ */
+class PerCpuCounter : Noncopyble
+{
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] shards 分片数，0表示按CPU核数，向上取整到2的幂
+     */
+    explicit PerCpuCounter(size_t shards = 0);
+
+    void add(int64_t val = 1)
+    {
+        m_shards[ShardIndex() & m_mask].value.fetch_add(val, std::memory_order_relaxed);
+    }
+
+    void sub(int64_t val = 1) { add(-val); }
+
+    /**
+     * @brief 汇总所有分片，与并发的add之间不保证原子快照
+     */
+    int64_t read() const;
+
+    /**
+     * @brief 清零所有分片
+     */
+    void reset();
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<int64_t> value{0};
+    };
+
+    /**
+     * @brief 当前线程所在CPU，按线程缓存
+     */
+    static size_t ShardIndex();
+
+private:
+    std::unique_ptr<Shard[]> m_shards;
+    size_t m_mask;
+};
+
 // class Scheduler;
 // class FibreSemaphore : Noncopyble
 // {
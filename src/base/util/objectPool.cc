@@ -0,0 +1,112 @@
+#include <stdexcept>
+#include "objectPool.h"
+
+FixedPool::FixedPool(size_t block_size, size_t align, size_t blocks_per_chunk)
+    : m_align(align),
+      m_blocks_per_chunk(blocks_per_chunk ? blocks_per_chunk : 1)
+{
+    if (block_size)
+    {
+        setBlockSize(block_size, align);
+    }
+}
+
+FixedPool::~FixedPool()
+{
+    for (auto &i : m_chunks)
+    {
+        ::operator delete(i, std::align_val_t(m_align));
+    }
+}
+
+void *FixedPool::allocate(size_t size, size_t align)
+{
+    MutexType::Lock lock(m_mutex);
+    if (!m_block_size)
+    {
+        setBlockSize(size, align);
+        while (m_chunks.size() * m_blocks_per_chunk < m_reserve)
+        {
+            grow();
+        }
+    }
+    else if (size > m_block_size || align > m_align)
+    {
+        throw std::bad_alloc();
+    }
+
+    if (!m_free)
+    {
+        grow();
+    }
+    FreeNode *node = m_free;
+    m_free = node->next;
+    if (++m_in_use > m_peak)
+    {
+        m_peak = m_in_use;
+    }
+    return node;
+}
+
+void FixedPool::deallocate(void *p)
+{
+    if (!p)
+    {
+        return;
+    }
+    FreeNode *node = static_cast<FreeNode *>(p);
+    MutexType::Lock lock(m_mutex);
+    node->next = m_free;
+    m_free = node;
+    --m_in_use;
+}
+
+void FixedPool::reserve(size_t count)
+{
+    MutexType::Lock lock(m_mutex);
+    if (!m_block_size)
+    {
+        m_reserve = count > m_reserve ? count : m_reserve;
+        return;
+    }
+    while (m_chunks.size() * m_blocks_per_chunk < count)
+    {
+        grow();
+    }
+}
+
+ObjectPoolStats FixedPool::getStats()
+{
+    ObjectPoolStats stats;
+    MutexType::Lock lock(m_mutex);
+    stats.block_size = m_block_size;
+    stats.chunks = m_chunks.size();
+    stats.capacity = m_chunks.size() * m_blocks_per_chunk;
+    stats.in_use = m_in_use;
+    stats.peak = m_peak;
+    return stats;
+}
+
+void FixedPool::setBlockSize(size_t size, size_t align)
+{
+    // 槽位至少能放下空闲链表指针，并按对齐向上取整
+    m_align = align < alignof(FreeNode) ? alignof(FreeNode) : align;
+    if (size < sizeof(FreeNode))
+    {
+        size = sizeof(FreeNode);
+    }
+    m_block_size = (size + m_align - 1) / m_align * m_align;
+}
+
+void FixedPool::grow()
+{
+    char *chunk = static_cast<char *>(::operator new(m_block_size * m_blocks_per_chunk, std::align_val_t(m_align)));
+    m_chunks.push_back(chunk);
+    // 逆序挂入，保证分配顺序与地址顺序一致
+    for (size_t i = m_blocks_per_chunk; i > 0; --i)
+    {
+        FreeNode *node = reinterpret_cast<FreeNode *>(chunk + (i - 1) * m_block_size);
+        node->next = m_free;
+        m_free = node;
+    }
+}
@@ -0,0 +1,152 @@
+/**
+ * @file objectPool.h
+ * @brief 定长对象池
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <new>
+#include <utility>
+#include "mutex.h"
+#include "noncopyble.h"
+
+/**
+ * @brief 对象池运行统计
+ */
+struct ObjectPoolStats
+{
+    size_t block_size = 0; // 单个槽位大小
+    size_t chunks = 0;     // 已向系统申请的块数
+    size_t capacity = 0;   // 槽位总数
+    size_t in_use = 0;     // 正在使用的槽位数
+    size_t peak = 0;       // 使用槽位数峰值
+};
+
+/**
+ * @brief 定长内存池
+ * @details 以chunk为单位向系统申请内存，切成等长槽位挂在空闲链表上，
+ *          释放的槽位压回链表头部(LIFO)，下一次分配优先拿到刚释放、仍在cache中的槽位。
+ *          已申请的chunk在进程生命周期内不归还系统，大量短连接反复建立断开时不再触发malloc。
+ *          槽位大小可以在构造时指定，也可以延迟到第一次分配时确定，
+ *          后者用于allocate_shared这类实际分配类型由标准库决定的场景。
+ */
+class FixedPool : Noncopyble
+{
+public:
+    typedef CASLock MutexType;
+
+    /**
+     * @brief 构造函数
+     * @param[in] block_size 槽位大小，0表示由第一次分配决定
+     * @param[in] align 槽位对齐
+     * @param[in] blocks_per_chunk 每次向系统申请的槽位数
+     */
+    FixedPool(size_t block_size = 0, size_t align = alignof(std::max_align_t), size_t blocks_per_chunk = 256);
+    ~FixedPool();
+
+    /**
+     * @brief 分配一个槽位
+     * @param[in] size 对象大小，不能超过槽位大小
+     * @param[in] align 对象对齐，不能超过槽位对齐
+     */
+    void *allocate(size_t size, size_t align);
+    void deallocate(void *p);
+
+    /**
+     * @brief 预先申请足够容纳count个对象的槽位，槽位大小未确定时推迟到第一次分配
+     */
+    void reserve(size_t count);
+
+    ObjectPoolStats getStats();
+
+private:
+    void setBlockSize(size_t size, size_t align);
+    void grow();
+
+private:
+    struct FreeNode
+    {
+        FreeNode *next;
+    };
+
+    MutexType m_mutex;
+    size_t m_block_size = 0;
+    size_t m_align;
+    size_t m_blocks_per_chunk;
+    size_t m_reserve = 0;
+    FreeNode *m_free = nullptr;
+    std::vector<void *> m_chunks;
+    size_t m_in_use = 0;
+    size_t m_peak = 0;
+};
+
+/**
+ * @brief 按tag取全局定长池，同一tag的对象共享一个池
+ */
+template <class Tag>
+FixedPool &GetFixedPool()
+{
+    static FixedPool *pool = new FixedPool(); // 不析构，避免静态析构顺序问题
+    return *pool;
+}
+
+/**
+ * @brief 基于FixedPool的标准分配器
+ * @details 配合std::allocate_shared使用，对象和shared_ptr控制块在同一个槽位中，
+ *          引用计数随对象一起回收，每个对象只占用一个槽位。
+ *          rebind后保留Tag，因此实际分配的控制块类型也落在Tag对应的池中。
+ *          数组分配(n != 1)直接走operator new。
+ */
+template <class T, class Tag = T>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+
+    template <class U>
+    struct rebind
+    {
+        typedef PoolAllocator<U, Tag> other;
+    };
+
+    PoolAllocator() noexcept = default;
+    template <class U>
+    PoolAllocator(const PoolAllocator<U, Tag> &) noexcept {}
+
+    T *allocate(size_t n)
+    {
+        if (n != 1)
+        {
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T *>(GetFixedPool<Tag>().allocate(sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t n) noexcept
+    {
+        if (n != 1)
+        {
+            ::operator delete(p);
+            return;
+        }
+        GetFixedPool<Tag>().deallocate(p);
+    }
+
+    template <class U>
+    bool operator==(const PoolAllocator<U, Tag> &) const noexcept { return true; }
+    template <class U>
+    bool operator!=(const PoolAllocator<U, Tag> &) const noexcept { return false; }
+};
+
+/**
+ * @brief 从T对应的对象池创建shared_ptr
+ */
+template <class T, class... Args>
+std::shared_ptr<T> MakePooled(Args &&...args)
+{
+    return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
@@ -39,29 +39,6 @@
 #include <functional>
 #include <any>
 
-#ifdef __GNUC__
-
-#include <ext/hash_map>
-using namespace __gnu_cxx;
-
-namespace __gnu_cxx
-{
-    template <>
-    struct hash<std::string>
-    {
-        size_t operator()(const std::string &x) const
-        {
-            return hash<const char *>()(x.c_str());
-        }
-    };
-}
-
-#else
-#include <hash_mp>
-using namespace stdext;
-
-#endif //__GNUC__
-
 #ifdef _WIN32
 typedef char int8_t;
 typedef short int16_t;
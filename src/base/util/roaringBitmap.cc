@@ -0,0 +1,608 @@
+#include <string.h>
+#include <algorithm>
+#include "roaringBitmap.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ROARING_X86 1
+#endif
+
+/// 快照魔数 "RBM1"
+static const uint32_t s_snapshot_magic = 0x314D4252;
+
+/**
+ * @brief 两个位图容器按字AND，STORE为false时只统计基数
+ */
+template <bool STORE>
+static uint32_t AndWordsGeneric(const uint64_t *a, const uint64_t *b, uint64_t *out)
+{
+    uint32_t card = 0;
+    for (size_t i = 0; i < ROARING_BITMAP_WORDS; ++i)
+    {
+        uint64_t w = a[i] & b[i];
+        if (STORE)
+        {
+            out[i] = w;
+        }
+        card += __builtin_popcountll(w);
+    }
+    return card;
+}
+
+#ifdef ROARING_X86
+// 默认编译选项不含-mavx2/-mpopcnt，按函数指定指令集，运行时按CPU选择，不要求-march=native
+template <bool STORE>
+__attribute__((target("avx2,popcnt"))) static uint32_t AndWordsAvx2(const uint64_t *a, const uint64_t *b, uint64_t *out)
+{
+    uint32_t card = 0;
+    for (size_t i = 0; i < ROARING_BITMAP_WORDS; i += 4)
+    {
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                     _mm256_loadu_si256((const __m256i *)(b + i)));
+        uint64_t w[4];
+        _mm256_storeu_si256((__m256i *)w, v);
+        if (STORE)
+        {
+            memcpy(out + i, w, sizeof(w));
+        }
+        card += __builtin_popcountll(w[0]) + __builtin_popcountll(w[1]) +
+                __builtin_popcountll(w[2]) + __builtin_popcountll(w[3]);
+    }
+    return card;
+}
+
+template <bool STORE>
+__attribute__((target("sse2,popcnt"))) static uint32_t AndWordsSse2(const uint64_t *a, const uint64_t *b, uint64_t *out)
+{
+    uint32_t card = 0;
+    for (size_t i = 0; i < ROARING_BITMAP_WORDS; i += 2)
+    {
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(a + i)),
+                                  _mm_loadu_si128((const __m128i *)(b + i)));
+        uint64_t w[2];
+        _mm_storeu_si128((__m128i *)w, v);
+        if (STORE)
+        {
+            out[i] = w[0];
+            out[i + 1] = w[1];
+        }
+        card += __builtin_popcountll(w[0]) + __builtin_popcountll(w[1]);
+    }
+    return card;
+}
+
+/**
+ * @brief CPU支持的AND实现，0通用，1 SSE2+POPCNT，2 AVX2+POPCNT
+ */
+static int DetectAndLevel()
+{
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("popcnt"))
+    {
+        return 0;
+    }
+    return __builtin_cpu_supports("avx2") ? 2 : (__builtin_cpu_supports("sse2") ? 1 : 0);
+}
+
+static const int s_and_level = DetectAndLevel();
+#endif
+
+template <bool STORE>
+static uint32_t AndWords(const uint64_t *a, const uint64_t *b, uint64_t *out)
+{
+#ifdef ROARING_X86
+    if (s_and_level == 2)
+    {
+        return AndWordsAvx2<STORE>(a, b, out);
+    }
+    if (s_and_level == 1)
+    {
+        return AndWordsSse2<STORE>(a, b, out);
+    }
+#endif
+    return AndWordsGeneric<STORE>(a, b, out);
+}
+
+/**
+ * @brief 在有序数组[first, last)中从first开始倍增查找第一个不小于val的位置
+ */
+static const uint16_t *Gallop(const uint16_t *first, const uint16_t *last, uint16_t val)
+{
+    size_t step = 1;
+    const uint16_t *lo = first;
+    while (first + step < last && first[step] < val)
+    {
+        lo = first + step;
+        step <<= 1;
+    }
+    const uint16_t *hi = first + step < last ? first + step + 1 : last;
+    return std::lower_bound(lo, hi, val);
+}
+
+/**
+ * @brief 有序数组求交，out为空时只统计基数
+ */
+static uint32_t AndArrays(const std::vector<uint16_t> &a, const std::vector<uint16_t> &b, std::vector<uint16_t> *out)
+{
+    const std::vector<uint16_t> &small = a.size() <= b.size() ? a : b;
+    const std::vector<uint16_t> &large = a.size() <= b.size() ? b : a;
+    uint32_t card = 0;
+    const uint16_t *p = large.data();
+    const uint16_t *end = large.data() + large.size();
+
+    // 长度相差悬殊时小数组的每个元素在大数组中倍增查找
+    if (small.size() * 32 < large.size())
+    {
+        for (uint16_t v : small)
+        {
+            p = Gallop(p, end, v);
+            if (p == end)
+            {
+                break;
+            }
+            if (*p == v)
+            {
+                if (out)
+                {
+                    out->push_back(v);
+                }
+                ++card;
+            }
+        }
+        return card;
+    }
+
+    const uint16_t *q = small.data();
+    const uint16_t *qend = small.data() + small.size();
+    while (p != end && q != qend)
+    {
+        if (*p < *q)
+        {
+            ++p;
+        }
+        else if (*q < *p)
+        {
+            ++q;
+        }
+        else
+        {
+            if (out)
+            {
+                out->push_back(*p);
+            }
+            ++card;
+            ++p;
+            ++q;
+        }
+    }
+    return card;
+}
+
+///------------------------------------------------------------------
+
+bool RoaringBitmap::Container::contains(uint16_t low) const
+{
+    if (isBitmap())
+    {
+        return (bitmap[low >> 6] >> (low & 63)) & 1;
+    }
+    return std::binary_search(array.begin(), array.end(), low);
+}
+
+bool RoaringBitmap::Container::add(uint16_t low)
+{
+    if (isBitmap())
+    {
+        uint64_t &word = bitmap[low >> 6];
+        uint64_t mask = (uint64_t)1 << (low & 63);
+        if (word & mask)
+        {
+            return false;
+        }
+        word |= mask;
+        ++card;
+        return true;
+    }
+    auto it = std::lower_bound(array.begin(), array.end(), low);
+    if (it != array.end() && *it == low)
+    {
+        return false;
+    }
+    array.insert(it, low);
+    if (++card > ROARING_ARRAY_MAX)
+    {
+        toBitmap();
+    }
+    return true;
+}
+
+bool RoaringBitmap::Container::remove(uint16_t low)
+{
+    if (isBitmap())
+    {
+        uint64_t &word = bitmap[low >> 6];
+        uint64_t mask = (uint64_t)1 << (low & 63);
+        if (!(word & mask))
+        {
+            return false;
+        }
+        word &= ~mask;
+        if (--card <= ROARING_ARRAY_MAX)
+        {
+            toArray();
+        }
+        return true;
+    }
+    auto it = std::lower_bound(array.begin(), array.end(), low);
+    if (it == array.end() || *it != low)
+    {
+        return false;
+    }
+    array.erase(it);
+    --card;
+    return true;
+}
+
+void RoaringBitmap::Container::toBitmap()
+{
+    bitmap.assign(ROARING_BITMAP_WORDS, 0);
+    for (uint16_t low : array)
+    {
+        bitmap[low >> 6] |= (uint64_t)1 << (low & 63);
+    }
+    std::vector<uint16_t>().swap(array);
+}
+
+void RoaringBitmap::Container::toArray()
+{
+    std::vector<uint16_t> values;
+    values.reserve(card);
+    for (size_t i = 0; i < ROARING_BITMAP_WORDS; ++i)
+    {
+        uint64_t word = bitmap[i];
+        while (word)
+        {
+            values.push_back((uint16_t)(i * 64 + __builtin_ctzll(word)));
+            word &= word - 1;
+        }
+    }
+    array.swap(values);
+    std::vector<uint64_t>().swap(bitmap);
+}
+
+///------------------------------------------------------------------
+
+int RoaringBitmap::findContainer(uint16_t key) const
+{
+    int lo = 0;
+    int hi = (int)m_containers.size() - 1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) >> 1;
+        uint16_t k = m_containers[mid].key;
+        if (k == key)
+        {
+            return mid;
+        }
+        if (k < key)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+bool RoaringBitmap::add(uint32_t val)
+{
+    uint16_t key = (uint16_t)(val >> 16);
+    auto it = std::lower_bound(m_containers.begin(), m_containers.end(), key,
+                               [](const Container &c, uint16_t k)
+                               { return c.key < k; });
+    if (it == m_containers.end() || it->key != key)
+    {
+        it = m_containers.insert(it, Container());
+        it->key = key;
+    }
+    return it->add((uint16_t)val);
+}
+
+bool RoaringBitmap::remove(uint32_t val)
+{
+    int idx = findContainer((uint16_t)(val >> 16));
+    if (idx < 0)
+    {
+        return false;
+    }
+    Container &c = m_containers[idx];
+    if (!c.remove((uint16_t)val))
+    {
+        return false;
+    }
+    if (c.card == 0)
+    {
+        m_containers.erase(m_containers.begin() + idx);
+    }
+    return true;
+}
+
+bool RoaringBitmap::contains(uint32_t val) const
+{
+    int idx = findContainer((uint16_t)(val >> 16));
+    return idx >= 0 && m_containers[idx].contains((uint16_t)val);
+}
+
+uint64_t RoaringBitmap::cardinality() const
+{
+    uint64_t card = 0;
+    for (auto &c : m_containers)
+    {
+        card += c.card;
+    }
+    return card;
+}
+
+bool RoaringBitmap::AndContainer(const Container &a, const Container &b, Container &out)
+{
+    out.key = a.key;
+    if (a.isBitmap() && b.isBitmap())
+    {
+        out.bitmap.resize(ROARING_BITMAP_WORDS);
+        out.card = AndWords<true>(a.bitmap.data(), b.bitmap.data(), out.bitmap.data());
+        if (out.card <= ROARING_ARRAY_MAX)
+        {
+            out.toArray();
+        }
+        return out.card != 0;
+    }
+    if (a.isBitmap() || b.isBitmap())
+    {
+        const Container &arr = a.isBitmap() ? b : a;
+        const Container &bits = a.isBitmap() ? a : b;
+        // 无分支写入，按结果长度截断
+        out.array.resize(arr.card);
+        uint16_t *dst = out.array.data();
+        size_t n = 0;
+        for (uint16_t low : arr.array)
+        {
+            dst[n] = low;
+            n += (bits.bitmap[low >> 6] >> (low & 63)) & 1;
+        }
+        out.array.resize(n);
+        out.card = n;
+        return out.card != 0;
+    }
+    out.card = AndArrays(a.array, b.array, &out.array);
+    return out.card != 0;
+}
+
+uint32_t RoaringBitmap::AndContainerCardinality(const Container &a, const Container &b)
+{
+    if (a.isBitmap() && b.isBitmap())
+    {
+        return AndWords<false>(a.bitmap.data(), b.bitmap.data(), nullptr);
+    }
+    if (a.isBitmap() || b.isBitmap())
+    {
+        const Container &arr = a.isBitmap() ? b : a;
+        const Container &bits = a.isBitmap() ? a : b;
+        uint32_t card = 0;
+        for (uint16_t low : arr.array)
+        {
+            card += (bits.bitmap[low >> 6] >> (low & 63)) & 1;
+        }
+        return card;
+    }
+    return AndArrays(a.array, b.array, nullptr);
+}
+
+RoaringBitmap RoaringBitmap::And(const RoaringBitmap &a, const RoaringBitmap &b)
+{
+    RoaringBitmap result;
+    result.m_containers.reserve(std::min(a.m_containers.size(), b.m_containers.size()));
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.m_containers.size() && j < b.m_containers.size())
+    {
+        const Container &ca = a.m_containers[i];
+        const Container &cb = b.m_containers[j];
+        if (ca.key < cb.key)
+        {
+            ++i;
+        }
+        else if (cb.key < ca.key)
+        {
+            ++j;
+        }
+        else
+        {
+            Container out;
+            if (AndContainer(ca, cb, out))
+            {
+                result.m_containers.push_back(std::move(out));
+            }
+            ++i;
+            ++j;
+        }
+    }
+    return result;
+}
+
+uint64_t RoaringBitmap::AndCardinality(const RoaringBitmap &a, const RoaringBitmap &b)
+{
+    uint64_t card = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.m_containers.size() && j < b.m_containers.size())
+    {
+        const Container &ca = a.m_containers[i];
+        const Container &cb = b.m_containers[j];
+        if (ca.key < cb.key)
+        {
+            ++i;
+        }
+        else if (cb.key < ca.key)
+        {
+            ++j;
+        }
+        else
+        {
+            card += AndContainerCardinality(ca, cb);
+            ++i;
+            ++j;
+        }
+    }
+    return card;
+}
+
+void RoaringBitmap::toVector(std::vector<uint32_t> &out) const
+{
+    out.reserve(out.size() + cardinality());
+    forEach([&out](uint32_t val)
+            { out.push_back(val); });
+}
+
+std::string RoaringBitmap::serialize() const
+{
+    size_t len = 8;
+    for (auto &c : m_containers)
+    {
+        len += 7 + (c.isBitmap() ? ROARING_BITMAP_WORDS * 8 : c.card * 2);
+    }
+    std::string data(len, '\0');
+    char *p = &data[0];
+    uint32_t count = m_containers.size();
+    memcpy(p, &s_snapshot_magic, 4);
+    memcpy(p + 4, &count, 4);
+    p += 8;
+    for (auto &c : m_containers)
+    {
+        uint8_t type = c.isBitmap() ? 1 : 0;
+        memcpy(p, &c.key, 2);
+        memcpy(p + 2, &type, 1);
+        memcpy(p + 3, &c.card, 4);
+        p += 7;
+        if (type)
+        {
+            memcpy(p, c.bitmap.data(), ROARING_BITMAP_WORDS * 8);
+            p += ROARING_BITMAP_WORDS * 8;
+        }
+        else
+        {
+            memcpy(p, c.array.data(), c.card * 2);
+            p += c.card * 2;
+        }
+    }
+    return data;
+}
+
+bool RoaringBitmap::deserialize(const char *data, size_t len)
+{
+    m_containers.clear();
+    uint32_t magic = 0;
+    uint32_t count = 0;
+    if (len < 8)
+    {
+        return false;
+    }
+    memcpy(&magic, data, 4);
+    memcpy(&count, data + 4, 4);
+    // 每个容器至少7字节头，先按长度校验再分配，避免损坏的count触发大量分配
+    if (magic != s_snapshot_magic || count > 65536 || (uint64_t)count * 7 > len - 8)
+    {
+        return false;
+    }
+    const char *p = data + 8;
+    const char *end = data + len;
+    std::vector<Container> containers(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        Container &c = containers[i];
+        uint8_t type = 0;
+        if (end - p < 7)
+        {
+            return false;
+        }
+        memcpy(&c.key, p, 2);
+        memcpy(&type, p + 2, 1);
+        memcpy(&c.card, p + 3, 4);
+        p += 7;
+        if ((i > 0 && c.key <= containers[i - 1].key) || c.card == 0 || type > 1)
+        {
+            return false;
+        }
+        if (type)
+        {
+            if ((size_t)(end - p) < ROARING_BITMAP_WORDS * 8 || c.card <= ROARING_ARRAY_MAX)
+            {
+                return false;
+            }
+            c.bitmap.resize(ROARING_BITMAP_WORDS);
+            memcpy(c.bitmap.data(), p, ROARING_BITMAP_WORDS * 8);
+            p += ROARING_BITMAP_WORDS * 8;
+            uint32_t card = 0;
+            for (uint64_t word : c.bitmap)
+            {
+                card += __builtin_popcountll(word);
+            }
+            if (card != c.card)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            if (c.card > ROARING_ARRAY_MAX || (size_t)(end - p) < c.card * 2)
+            {
+                return false;
+            }
+            c.array.resize(c.card);
+            memcpy(c.array.data(), p, c.card * 2);
+            p += c.card * 2;
+            for (size_t k = 1; k < c.array.size(); ++k)
+            {
+                if (c.array[k] <= c.array[k - 1])
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    if (p != end)
+    {
+        return false;
+    }
+    m_containers.swap(containers);
+    return true;
+}
+
+size_t RoaringBitmap::memoryUsage() const
+{
+    size_t bytes = m_containers.capacity() * sizeof(Container);
+    for (auto &c : m_containers)
+    {
+        bytes += c.array.capacity() * sizeof(uint16_t) + c.bitmap.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+bool RoaringBitmap::operator==(const RoaringBitmap &other) const
+{
+    if (m_containers.size() != other.m_containers.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < m_containers.size(); ++i)
+    {
+        const Container &a = m_containers[i];
+        const Container &b = other.m_containers[i];
+        if (a.key != b.key || a.card != b.card || a.array != b.array || a.bitmap != b.bitmap)
+        {
+            return false;
+        }
+    }
+    return true;
+}
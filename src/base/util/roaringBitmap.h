@@ -0,0 +1,148 @@
+/**
+ * @file roaringBitmap.h
+ * @brief 压缩位图(Roaring)，用于群成员、在线用户等稠密id集合
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// 数组容器的最大基数，超过后转为位图容器
+#define ROARING_ARRAY_MAX 4096
+/// 位图容器的64位字数，覆盖低16位的全部65536个值
+#define ROARING_BITMAP_WORDS 1024
+
+/**
+ * @brief 压缩位图
+ * @details 按值的高16位分桶，每个桶一个容器：基数不超过ROARING_ARRAY_MAX时用有序的uint16数组，
+ *          否则用8KB的位图。稀疏集合按数组存储，每个成员2字节；稠密集合按位图存储，每个成员1位。
+ *          位图与位图求交按字AND并统计popcount，支持SSE2/AVX2时一次处理128/256位；
+ *          数组与位图求交逐个测试位，数组与数组求交用归并，长度悬殊时用倍增查找。
+ *          不是线程安全的，并发访问由调用方加锁。
+ */
+class RoaringBitmap
+{
+public:
+    typedef std::shared_ptr<RoaringBitmap> ptr;
+
+    RoaringBitmap() = default;
+
+    /**
+     * @brief 添加一个值
+     * @return 值原本不存在时返回true
+     */
+    bool add(uint32_t val);
+
+    /**
+     * @brief 删除一个值
+     * @return 值原本存在时返回true
+     */
+    bool remove(uint32_t val);
+
+    bool contains(uint32_t val) const;
+
+    uint64_t cardinality() const;
+    bool empty() const { return m_containers.empty(); }
+    void clear() { m_containers.clear(); }
+
+    /**
+     * @brief 交集
+     */
+    static RoaringBitmap And(const RoaringBitmap &a, const RoaringBitmap &b);
+
+    /**
+     * @brief 交集的基数，不生成结果
+     */
+    static uint64_t AndCardinality(const RoaringBitmap &a, const RoaringBitmap &b);
+
+    /**
+     * @brief 按升序遍历所有值
+     */
+    template <class F>
+    void forEach(F cb) const
+    {
+        for (auto &c : m_containers)
+        {
+            uint32_t high = (uint32_t)c.key << 16;
+            if (c.isBitmap())
+            {
+                for (size_t i = 0; i < ROARING_BITMAP_WORDS; ++i)
+                {
+                    uint64_t word = c.bitmap[i];
+                    while (word)
+                    {
+                        cb(high | (uint32_t)(i * 64 + __builtin_ctzll(word)));
+                        word &= word - 1;
+                    }
+                }
+            }
+            else
+            {
+                for (uint16_t low : c.array)
+                {
+                    cb(high | low);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief 按升序追加所有值到out
+     */
+    void toVector(std::vector<uint32_t> &out) const;
+
+    /**
+     * @brief 序列化为紧凑快照
+     * @details 格式(小端): magic(u32) 容器数(u32)，
+     *          每个容器: key(u16) 类型(u8, 0数组/1位图) 基数(u32)，随后是数组(基数*u16)或位图(1024*u64)
+     */
+    std::string serialize() const;
+
+    /**
+     * @brief 从快照恢复，格式错误时返回false且本对象被清空
+     */
+    bool deserialize(const char *data, size_t len);
+    bool deserialize(const std::string &data) { return deserialize(data.data(), data.size()); }
+
+    /**
+     * @brief 容器占用的堆内存(字节)
+     */
+    size_t memoryUsage() const;
+
+    bool operator==(const RoaringBitmap &other) const;
+    bool operator!=(const RoaringBitmap &other) const { return !(*this == other); }
+
+private:
+    /**
+     * @brief 低16位容器，array和bitmap只有一个非空
+     */
+    struct Container
+    {
+        uint16_t key = 0;
+        uint32_t card = 0;
+        std::vector<uint16_t> array;
+        std::vector<uint64_t> bitmap;
+
+        bool isBitmap() const { return !bitmap.empty(); }
+        bool contains(uint16_t low) const;
+        bool add(uint16_t low);
+        bool remove(uint16_t low);
+        void toBitmap();
+        void toArray();
+    };
+
+    /**
+     * @brief 二分查找高16位对应的容器下标，不存在返回-1
+     */
+    int findContainer(uint16_t key) const;
+
+    static bool AndContainer(const Container &a, const Container &b, Container &out);
+    static uint32_t AndContainerCardinality(const Container &a, const Container &b);
+
+private:
+    std::vector<Container> m_containers; // 按key升序
+};
@@ -0,0 +1,205 @@
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include <fstream>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include "thread.h"
+#include "log.h"
+
+thread_local pid_t t_thread_id = 0;
+static thread_local Thread *t_thread = nullptr;
+static thread_local std::string t_thread_name = "UNKNOW";
+
+static Logger::ptr g_logger = LOG_NAME("system");
+
+/**
+ * @brief 线程退出时从注册表中移除
+ */
+struct ThreadRegistration
+{
+    bool registered = false;
+    ~ThreadRegistration()
+    {
+        if (registered)
+        {
+            ThreadMgr::getInstance()->remove(t_thread_id);
+        }
+    }
+};
+
+static thread_local ThreadRegistration t_registration;
+
+pid_t CacheThreadId()
+{
+    t_thread_id = syscall(SYS_gettid);
+    if (!t_thread)
+    {
+        // 非Thread创建的线程，沿用内核中的线程名
+        char name[16] = {0};
+        if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0 && name[0])
+        {
+            t_thread_name = name;
+        }
+    }
+    t_registration.registered = true;
+    ThreadMgr::getInstance()->add(t_thread_id, pthread_self(), t_thread_name);
+    return t_thread_id;
+}
+
+Thread *Thread::GetThis()
+{
+    return t_thread;
+}
+
+const std::string &Thread::GetName()
+{
+    return t_thread_name;
+}
+
+void Thread::SetName(const std::string &name)
+{
+    if (name.empty())
+    {
+        return;
+    }
+    if (t_thread)
+    {
+        t_thread->m_name = name;
+    }
+    t_thread_name = name;
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+    ThreadMgr::getInstance()->rename(GetThreadId(), name);
+}
+
+ThreadStats Thread::GetStats()
+{
+    ThreadStats stats;
+    stats.id = GetThreadId();
+    stats.name = t_thread_name;
+
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+    {
+        stats.cpu_time_us = ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+    }
+#ifdef RUSAGE_THREAD
+    rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) == 0)
+    {
+        stats.voluntary_switches = usage.ru_nvcsw;
+        stats.involuntary_switches = usage.ru_nivcsw;
+    }
+#endif
+    return stats;
+}
+
+Thread::Thread(std::function<void()> cb, const std::string &name)
+    : m_cb(cb),
+      m_name(name.empty() ? "UNKNOW" : name)
+{
+    int ret = pthread_create(&m_thread, nullptr, &Thread::run, this);
+    if (ret)
+    {
+        LOG_ERROR(g_logger) << "pthread_create thread fail, ret = " << ret << " name = " << name;
+        throw std::logic_error("pthread_create error");
+    }
+    m_semaphore.wait();
+}
+
+Thread::~Thread()
+{
+    if (m_thread)
+    {
+        pthread_detach(m_thread);
+    }
+}
+
+void Thread::join()
+{
+    if (m_thread)
+    {
+        int ret = pthread_join(m_thread, nullptr);
+        if (ret)
+        {
+            LOG_ERROR(g_logger) << "pthread_join thread fail, ret = " << ret << " name = " << m_name;
+            throw std::logic_error("pthread_join error");
+        }
+        m_thread = 0;
+    }
+}
+
+void *Thread::run(void *arg)
+{
+    Thread *thread = (Thread *)arg;
+    t_thread = thread;
+    t_thread_name = thread->m_name;
+    pthread_setname_np(pthread_self(), thread->m_name.substr(0, 15).c_str());
+    thread->m_id = GetThreadId();
+
+    std::function<void()> cb;
+    cb.swap(thread->m_cb);
+
+    thread->m_semaphore.notify();
+
+    cb();
+    return 0;
+}
+
+void ThreadRegistry::add(pid_t id, pthread_t thread, const std::string &name)
+{
+    MutexType::Lock lock(m_mutex);
+    m_threads[id] = {thread, name};
+}
+
+void ThreadRegistry::remove(pid_t id)
+{
+    MutexType::Lock lock(m_mutex);
+    m_threads.erase(id);
+}
+
+void ThreadRegistry::rename(pid_t id, const std::string &name)
+{
+    MutexType::Lock lock(m_mutex);
+    auto it = m_threads.find(id);
+    if (it != m_threads.end())
+    {
+        it->second.name = name;
+    }
+}
+
+std::vector<ThreadStats> ThreadRegistry::snapshot()
+{
+    std::vector<ThreadStats> result;
+    MutexType::Lock lock(m_mutex);
+    for (auto &i : m_threads)
+    {
+        ThreadStats stats;
+        stats.id = i.first;
+        stats.name = i.second.name;
+
+        clockid_t cid;
+        timespec ts;
+        if (pthread_getcpuclockid(i.second.thread, &cid) == 0 && clock_gettime(cid, &ts) == 0)
+        {
+            stats.cpu_time_us = ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+        }
+
+        // 其他线程的上下文切换次数只能从procfs读取
+        std::ifstream ifs("/proc/self/task/" + std::to_string(i.first) + "/status");
+        std::string line;
+        while (std::getline(ifs, line))
+        {
+            if (line.compare(0, 24, "voluntary_ctxt_switches:") == 0)
+            {
+                stats.voluntary_switches = strtoull(line.c_str() + 24, nullptr, 10);
+            }
+            else if (line.compare(0, 27, "nonvoluntary_ctxt_switches:") == 0)
+            {
+                stats.involuntary_switches = strtoull(line.c_str() + 27, nullptr, 10);
+            }
+        }
+        result.push_back(stats);
+    }
+    return result;
+}
@@ -0,0 +1,139 @@
+/**
+ * @file thread.h
+ * @brief 线程封装及线程注册表
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <pthread.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include "mutex.h"
+#include "noncopyble.h"
+#include "singleton.h"
+
+/// 当前线程的内核线程id缓存，0表示尚未获取
+extern thread_local pid_t t_thread_id;
+
+/**
+ * @brief 首次获取线程id，缓存到线程局部变量并登记到线程注册表
+ */
+pid_t CacheThreadId();
+
+/**
+ * @brief 返回当前线程的内核线程id，只在线程第一次调用时触发gettid系统调用
+ */
+inline pid_t GetThreadId()
+{
+    return t_thread_id ? t_thread_id : CacheThreadId();
+}
+
+/**
+ * @brief 返回当前协程id，暂无协程实现，固定为0
+ */
+inline uint32_t GetFibreId()
+{
+    return 0;
+}
+
+/**
+ * @brief 线程运行统计
+ */
+struct ThreadStats
+{
+    pid_t id = 0;                    // 内核线程id
+    std::string name;                // 线程名称
+    uint64_t cpu_time_us = 0;        // 线程累计CPU时间(us)
+    uint64_t voluntary_switches = 0; // 主动上下文切换次数
+    uint64_t involuntary_switches = 0; // 被动上下文切换次数
+};
+
+/**
+ * @brief 线程类
+ */
+class Thread : Noncopyble
+{
+public:
+    typedef std::shared_ptr<Thread> ptr;
+
+    /**
+     * @brief 构造函数，创建并启动线程，线程id和名称设置完成后才返回
+     * @param[in] cb 线程执行函数
+     * @param[in] name 线程名称，内核中只保留前15个字符
+     */
+    Thread(std::function<void()> cb, const std::string &name);
+    ~Thread();
+
+    pid_t getId() const { return m_id; }
+    const std::string &getName() const { return m_name; }
+
+    /**
+     * @brief 等待线程执行完成
+     */
+    void join();
+
+    /**
+     * @brief 获取当前线程对象，非Thread创建的线程返回nullptr
+     */
+    static Thread *GetThis();
+
+    /**
+     * @brief 获取当前线程名称
+     */
+    static const std::string &GetName();
+
+    /**
+     * @brief 设置当前线程名称，同步到内核和线程注册表
+     */
+    static void SetName(const std::string &name);
+
+    /**
+     * @brief 获取当前线程的CPU时间和上下文切换次数
+     */
+    static ThreadStats GetStats();
+
+private:
+    static void *run(void *arg);
+
+private:
+    pid_t m_id = -1;
+    pthread_t m_thread = 0;
+    std::function<void()> m_cb;
+    std::string m_name;
+    Semaphore m_semaphore; // 等待线程完成初始化
+};
+
+/**
+ * @brief 线程注册表，记录进程内所有使用过日志/线程接口的线程
+ */
+class ThreadRegistry
+{
+public:
+    typedef Mutex MutexType;
+
+    void add(pid_t id, pthread_t thread, const std::string &name);
+    void remove(pid_t id);
+    void rename(pid_t id, const std::string &name);
+
+    /**
+     * @brief 获取所有已登记线程的运行统计
+     */
+    std::vector<ThreadStats> snapshot();
+
+private:
+    struct Entry
+    {
+        pthread_t thread;
+        std::string name;
+    };
+
+    MutexType m_mutex;
+    std::map<pid_t, Entry> m_threads;
+};
+
+typedef Singleton<ThreadRegistry> ThreadMgr;